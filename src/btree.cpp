@@ -9,9 +9,19 @@
 
 #include <climits>
 #include <stack>
-#include <climits>
+#include <algorithm>
+#include <thread>
+#include <numeric>
+#include <exception>
+#include <memory>
+#include <deque>
+#include <condition_variable>
 #include "btree.h"
-#include "filescan.h"
+#include "node_search.h"
+#include "leaf_codec.h"
+#include "file_iterator.h"
+#include "page_iterator.h"
+#include "staticindex.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
@@ -19,7 +29,6 @@
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
-#include "exceptions/end_of_file_exception.h"
 #include "exceptions/file_exists_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/hash_not_found_exception.h"
@@ -30,6 +39,280 @@
 
 namespace badgerdb {
 
+/**
+ * Holds the tree latch of an index for the duration of one call into the index.
+ */
+class TreeLatchGuard
+{
+public:
+    TreeLatchGuard(pthread_rwlock_t* latchIn, bool exclusive)
+        : latch(latchIn)
+    {
+        if (exclusive)
+            pthread_rwlock_wrlock(latch);
+        else
+            pthread_rwlock_rdlock(latch);
+    }
+
+    ~TreeLatchGuard()
+    {
+        pthread_rwlock_unlock(latch);
+    }
+
+private:
+    pthread_rwlock_t* latch;
+};
+
+/**
+ * Pages of records of a relation, each record with its record id.
+ */
+typedef std::vector<std::pair<RecordId, std::string> > RecordBatch;
+
+/**
+ * Bounded queue of pages of records from the read of a relation by a MultiIndexBuilder to the build of one
+ * index. The reader waits while the queue is full. A build that takes no records abandons the queue, and
+ * the pages pushed to it after that are dropped.
+ */
+class RecordQueue
+{
+public:
+    explicit RecordQueue(size_t capacityIn)
+        : capacity(capacityIn), closed(false), abandoned(false)
+    {
+    }
+
+    void push(const std::shared_ptr<const RecordBatch>& batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]() { return batches.size() < capacity || abandoned; });
+        if (!abandoned) {
+            batches.push_back(batch);
+            notEmpty.notify_one();
+        }
+    }
+
+    /* Marks the end of the records, pop() returns false once the queue is drained */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+    void abandon()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        abandoned = true;
+        batches.clear();
+        notFull.notify_all();
+    }
+
+    bool pop(std::shared_ptr<const RecordBatch>& batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return !batches.empty() || closed; });
+        if (batches.empty())
+            return false;
+        batch = batches.front();
+        batches.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    bool abandoned;
+    std::deque<std::shared_ptr<const RecordBatch> > batches;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+/**
+ * File keeps its open files in static maps without a lock, so indexes constructed in the threads of a
+ * MultiIndexBuilder open their files one at a time.
+ */
+static std::mutex indexFileMutex;
+
+/**
+ * Keeps the version of a node odd while a writer changes it, so that readers without latches can
+ * tell that what they read may be torn.
+ */
+class NodeWriteGuard
+{
+public:
+    explicit NodeWriteGuard(std::atomic<unsigned int>& versionIn)
+        : version(versionIn)
+    {
+        version.fetch_add(1);
+    }
+
+    ~NodeWriteGuard()
+    {
+        version.fetch_add(1);
+    }
+
+private:
+    std::atomic<unsigned int>& version;
+};
+
+/**
+ * Orders record ids by page and slot, the order of the record ids in a posting list.
+ */
+static bool ridLess(const RecordId& r1, const RecordId& r2)
+{
+    return r1.page_number < r2.page_number
+        || (r1.page_number == r2.page_number && r1.slot_number < r2.slot_number);
+}
+
+/**
+ * Codes the entries of compressed leaves. Only INTEGER keys have a frame-of-reference coding, the constructor
+ * turns COMPRESSED_LEAVES down for the other key types, so the generic version only has to compile.
+ */
+template <class T>
+struct LeafCodec
+{
+    static bool encode(CompressedLeafNode* node, const T* keys, const RecordId* rids, int count) { return false; }
+    static bool decode(const CompressedLeafNode* node, T* keys, RecordId* rids, int& count) { return false; }
+    static bool hasRoom(const CompressedLeafNode* node, const T& key, const RecordId& rid) { return false; }
+};
+
+template <>
+struct LeafCodec<int>
+{
+    /* Bytes of the three columns of count entries at the given widths */
+    static int encodedSize(int count, int keyBits, int pageBits, int slotBits)
+    {
+        return leafcodec::columnBytes(count, keyBits) + leafcodec::columnBytes(count, pageBits)
+            + leafcodec::columnBytes(count, slotBits);
+    }
+
+    /* Codes count sorted entries into the node, leaving its header but the count alone. Returns false,
+       changing nothing, if they do not fit. */
+    static bool encode(CompressedLeafNode* node, const int* keys, const RecordId* rids, int count)
+    {
+        if (count > COMPRESSEDLEAFSIZE)
+            return false;
+
+        PageId pageMin = count > 0 ? rids[0].page_number : 0, pageMax = pageMin;
+        SlotId slotMax = 0;
+        for (int i = 0; i < count; i++) {
+            pageMin = std::min(pageMin, rids[i].page_number);
+            pageMax = std::max(pageMax, rids[i].page_number);
+            slotMax = std::max(slotMax, rids[i].slot_number);
+        }
+        int keyBase = count > 0 ? keys[0] : 0;
+        int keyBits = leafcodec::bitWidth(count > 0 ? (uint32_t)keys[count - 1] - (uint32_t)keyBase : 0);
+        int pageBits = leafcodec::bitWidth(pageMax - pageMin);
+        int slotBits = leafcodec::bitWidth(slotMax);
+        if (encodedSize(count, keyBits, pageBits, slotBits) > COMPRESSEDLEAFDATASIZE - LEAF_CODEC_PADDING)
+            return false;
+
+        node->numEntries = count;
+        node->keyBase = keyBase;
+        node->pageBase = pageMin;
+        node->keyBits = keyBits;
+        node->pageBits = pageBits;
+        node->slotBits = slotBits;
+        memset(node->data, 0, sizeof(node->data));
+
+        uint32_t values[COMPRESSEDLEAFSIZE];
+        unsigned char* column = node->data;
+        for (int i = 0; i < count; i++)
+            values[i] = (uint32_t)keys[i] - (uint32_t)keyBase;
+        leafcodec::pack(column, values, count, keyBits);
+        column += leafcodec::columnBytes(count, keyBits);
+        for (int i = 0; i < count; i++)
+            values[i] = rids[i].page_number - pageMin;
+        leafcodec::pack(column, values, count, pageBits);
+        column += leafcodec::columnBytes(count, pageBits);
+        for (int i = 0; i < count; i++)
+            values[i] = rids[i].slot_number;
+        leafcodec::pack(column, values, count, slotBits);
+        return true;
+    }
+
+    /* Decodes the entries of the node into arrays with room for COMPRESSEDLEAFSIZE of them. The header is read
+       once and checked, so a node torn by a writer decodes to garbage, never out of bounds, or returns false. */
+    static bool decode(const CompressedLeafNode* node, int* keys, RecordId* rids, int& count)
+    {
+        count = node->numEntries;
+        int keyBits = node->keyBits, pageBits = node->pageBits, slotBits = node->slotBits;
+        uint32_t keyBase = node->keyBase, pageBase = node->pageBase;
+        if (count < 0 || count > COMPRESSEDLEAFSIZE || keyBits > 32 || pageBits > 32 || slotBits > 16
+            || encodedSize(count, keyBits, pageBits, slotBits) > COMPRESSEDLEAFDATASIZE - LEAF_CODEC_PADDING)
+            return false;
+
+        uint32_t values[COMPRESSEDLEAFSIZE];
+        const unsigned char* column = node->data;
+        leafcodec::unpack(column, count, keyBits, keyBase, (uint32_t*)keys);
+        column += leafcodec::columnBytes(count, keyBits);
+        leafcodec::unpack(column, count, pageBits, pageBase, values);
+        for (int i = 0; i < count; i++)
+            rids[i].page_number = values[i];
+        column += leafcodec::columnBytes(count, pageBits);
+        leafcodec::unpack(column, count, slotBits, 0, values);
+        for (int i = 0; i < count; i++)
+            rids[i].slot_number = values[i];
+        return true;
+    }
+
+    /* Returns true if the pair fits into the node at the widths it is coded with, so that inserting it cannot split the node */
+    static bool hasRoom(const CompressedLeafNode* node, const int& key, const RecordId& rid)
+    {
+        int count = node->numEntries;
+        uint64_t keyOffset = (uint64_t)((int64_t)key - node->keyBase);
+        uint64_t pageOffset = (uint64_t)((int64_t)rid.page_number - node->pageBase);
+        return count > 0 && count < COMPRESSEDLEAFSIZE
+            && key >= node->keyBase && keyOffset < ((uint64_t)1 << node->keyBits)
+            && rid.page_number >= node->pageBase && pageOffset < ((uint64_t)1 << node->pageBits)
+            && rid.slot_number < ((uint64_t)1 << node->slotBits)
+            && encodedSize(count + 1, node->keyBits, node->pageBits, node->slotBits)
+                <= COMPRESSEDLEAFDATASIZE - LEAF_CODEC_PADDING;
+    }
+};
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanLowVal / scanHighVal / leafEntries
+// -----------------------------------------------------------------------------
+template <> int& IndexScanCursor::scanLowVal<int>() { return lowValInt; }
+template <> int& IndexScanCursor::scanHighVal<int>() { return highValInt; }
+template <> double& IndexScanCursor::scanLowVal<double>() { return lowValDouble; }
+template <> double& IndexScanCursor::scanHighVal<double>() { return highValDouble; }
+template <> StringKey& IndexScanCursor::scanLowVal<StringKey>() { return lowValString; }
+template <> StringKey& IndexScanCursor::scanHighVal<StringKey>() { return highValString; }
+template <> LeafEntries<int>& IndexScanCursor::leafEntries<int>() { return intEntries; }
+template <> LeafEntries<double>& IndexScanCursor::leafEntries<double>() { return doubleEntries; }
+template <> LeafEntries<StringKey>& IndexScanCursor::leafEntries<StringKey>() { return stringEntries; }
+template <> std::vector<ScanRange<int> >& IndexScanCursor::scanRanges<int>() { return intRanges; }
+template <> std::vector<ScanRange<double> >& IndexScanCursor::scanRanges<double>() { return doubleRanges; }
+template <> std::vector<ScanRange<StringKey> >& IndexScanCursor::scanRanges<StringKey>() { return stringRanges; }
+
+// -----------------------------------------------------------------------------
+// SplitPolicy::splitPoint
+// -----------------------------------------------------------------------------
+int SplitPolicy::splitPoint(int size, int insertPos) const
+{
+    double bias = std::min(std::max(this->bias, 0.5), 1.0);
+    int point;
+    switch (kind) {
+    case LEFT_BIASED_SPLIT:
+        point = (int)(bias * size);
+        break;
+    case RIGHT_BIASED_SPLIT:
+        point = size - (int)(bias * size);
+        break;
+    case ADAPTIVE_SPLIT:
+        point = std::min(std::max(insertPos, size - (int)(bias * size)), (int)(bias * size));
+        break;
+    default:
+        point = (size + 1) / 2;
+        break;
+    }
+    return std::min(std::max(point, 1), size - 1);
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::BTreeIndex -- Constructor
 // -----------------------------------------------------------------------------
@@ -38,8 +321,40 @@ BTreeIndex::BTreeIndex(
     std::string& outIndexName,
     BufMgr* bufMgrIn,
     const int attrByteOffset,
-    const Datatype attrType)
+    const Datatype attrType,
+    const double fillFactor,
+    const ConcurrencyMode concurrencyModeIn,
+    const bool appendModeIn,
+    const SplitPolicy& splitPolicyIn,
+    const LeafFormat leafFormatIn,
+    const unsigned int buildThreads)
+    : BTreeIndex(relationName, outIndexName, bufMgrIn, attrByteOffset, attrType, fillFactor, concurrencyModeIn,
+                 appendModeIn, splitPolicyIn, leafFormatIn, buildThreads, nullptr)
+{
+}
+
+BTreeIndex::BTreeIndex(
+    const std::string& relationName,
+    std::string& outIndexName,
+    BufMgr* bufMgrIn,
+    const int attrByteOffset,
+    const Datatype attrType,
+    const double fillFactor,
+    const ConcurrencyMode concurrencyModeIn,
+    const bool appendModeIn,
+    const SplitPolicy& splitPolicyIn,
+    const LeafFormat leafFormatIn,
+    const unsigned int buildThreads,
+    RecordQueue* records)
+    : concurrencyMode(concurrencyModeIn), appendMode(appendModeIn),
+      splitPolicy(splitPolicyIn), leafFormat(leafFormatIn), scan(this),
+      appendLeafPageNum(Page::INVALID_NUMBER), appendsUncounted(0)
 {
+    /* Only INTEGER keys have a compressed coding */
+    if (leafFormat == COMPRESSED_LEAVES && attrType != INTEGER)
+        throw BadIndexInfoException("ERROR COMPRESSED LEAVES NEED INTEGER KEYS");
+
+    pthread_rwlock_init(&treeLatch, nullptr);
 
     /* Generate file name as proposed */
     std::ostringstream idxStr;
@@ -50,9 +365,22 @@ BTreeIndex::BTreeIndex(
     bufMgr = bufMgrIn;
     attributeType = attrType;
     this->attrByteOffset = attrByteOffset;
-    leafOccupancy = 0;
-    nodeOccupancy = 0;
-    scanExecuting = false;
+
+    /* Node capacities depend on the key type */
+    switch (attributeType) {
+    case INTEGER:
+        leafOccupancy = INTARRAYLEAFSIZE;
+        nodeOccupancy = INTARRAYNONLEAFSIZE;
+        break;
+    case DOUBLE:
+        leafOccupancy = DOUBLEARRAYLEAFSIZE;
+        nodeOccupancy = DOUBLEARRAYNONLEAFSIZE;
+        break;
+    case STRING:
+        leafOccupancy = STRINGARRAYLEAFSIZE;
+        nodeOccupancy = STRINGARRAYNONLEAFSIZE;
+        break;
+    }
 
     IndexMetaInfo* metadata;
     Page* headerPage;
@@ -61,11 +389,16 @@ BTreeIndex::BTreeIndex(
     try {
         /* create the file based on BlobFile as proposed and check if exists */
         /* create new index if not exist */
-        file = new BlobFile(outIndexName, true);
+        {
+            std::lock_guard<std::mutex> guard(indexFileMutex);
+            file = new BlobFile(outIndexName, true);
+        }
 
         /* Allocate index meta info page and btree root page */
+        PageId newRootPageNum;
         bufMgr->allocPage(file, headerPageNum, headerPage);
-        bufMgr->allocPage(file, rootPageNum, rootPage);
+        bufMgr->allocPage(file, newRootPageNum, rootPage);
+        rootPageNum = newRootPageNum;
 
         /* set meta data info for the index*/
         metadata = (IndexMetaInfo*)headerPage;
@@ -73,29 +406,26 @@ BTreeIndex::BTreeIndex(
         metadata->attrByteOffset = attrByteOffset;
         metadata->attrType = attrType;
         metadata->rootPageNo = rootPageNum;
+        metadata->freePageNo = freePageNum = Page::INVALID_NUMBER;
+        metadata->leafFormat = leafFormat;
 
-        /* assuming int as proposed */
-        /* set tree root */
-        auto root = (NonLeafNodeInt*)rootPage;
-        root->level = 1;
-        for (int i = 0; i < INTARRAYNONLEAFSIZE; i++) {
-            clearNonLeafNodeAtIdx(root, i);
-        }
-        root->pageNoArray[INTARRAYNONLEAFSIZE] = Page::INVALID_NUMBER;
+        /* The empty root makes a tree of one level, the bulk load counts what it builds */
+        memset(&stats, 0, sizeof(stats));
+        stats.height = 1;
 
-        /* Relation scan */
-        try {
-            FileScan fileScan(relationName, bufMgr);
-            RecordId rid = {};
-            while (true) {
-                fileScan.scanNext(rid);
-                /* insert data tuples into index */
-                insertEntry((int*)fileScan.getRecord().c_str() + attrByteOffset, rid);
-            }
-        }
-        catch (EndOfFileException& e) {
-            /* catch EOF as proposed */
+        /* set tree root and build the tree bottom-up instead of inserting tuple by tuple */
+        switch (attributeType) {
+        case INTEGER:
+            buildIndex<int>(relationName, fillFactor, buildThreads, records);
+            break;
+        case DOUBLE:
+            buildIndex<double>(relationName, fillFactor, buildThreads, records);
+            break;
+        case STRING:
+            buildIndex<StringKey>(relationName, fillFactor, buildThreads, records);
+            break;
         }
+        metadata->stats = stats;
 
         /* if the page isnt in use, unpin it */
         try {
@@ -113,7 +443,10 @@ BTreeIndex::BTreeIndex(
     }
     catch (FileExistsException& e) { 
         /* grab the file if exists */
-        file = new BlobFile(outIndexName, false);
+        {
+            std::lock_guard<std::mutex> guard(indexFileMutex);
+            file = new BlobFile(outIndexName, false);
+        }
 
         /* Get page number */
         headerPageNum = file->getFirstPageNo();
@@ -138,6 +471,9 @@ BTreeIndex::BTreeIndex(
 
         /* If metadata matches set root page for the index */
         rootPageNum = metadata->rootPageNo;
+        freePageNum = metadata->freePageNo;
+        leafFormat = metadata->leafFormat;
+        stats = metadata->stats;
 
         try {
             /* Unpin header */
@@ -149,25 +485,336 @@ BTreeIndex::BTreeIndex(
     }
 }
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::buildIndex
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::buildIndex(const std::string& relationName, double fillFactor, unsigned int numThreads, RecordQueue* records)
+{
+    /* set tree root */
+    Page* rootPage;
+    bufMgr->readPage(file, rootPageNum, rootPage);
+    auto root = (NonLeafNode<T>*)rootPage;
+    root->version = 0;
+    root->level = 1;
+    root->numKeys = 0;
+    root->rightSibPageNo = Page::INVALID_NUMBER;
+    root->pageNoArray[0] = Page::INVALID_NUMBER;
+    bufMgr->unPinPage(file, rootPageNum, true);
+
+    std::vector<RIDKeyPair<T> > entries;
+    if (records != nullptr)
+        readRecords(records, entries);
+    else
+        readRelation(relationName, numThreads, entries);
+    bulkLoad(entries, fillFactor);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readRelation
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::readRelation(const std::string& relationName, unsigned int numThreads, std::vector<RIDKeyPair<T> >& entries)
+{
+    /* Each thread reads its pages straight from the file, past the buffer pool, through a descriptor of its own.
+       The page numbers of the file are split into one run of consecutive numbers per thread. */
+    std::vector<std::unique_ptr<PageFileReader> > readers;
+    readers.push_back(std::unique_ptr<PageFileReader>(new PageFileReader(relationName)));
+    size_t numPages = readers[0]->numPages() - 1;
+    if (numThreads == 0)
+        numThreads = std::thread::hardware_concurrency();
+    numThreads = std::max((size_t)1, std::min((size_t)numThreads, numPages));
+    for (unsigned int t = 1; t < numThreads; t++)
+        readers.push_back(std::unique_ptr<PageFileReader>(new PageFileReader(relationName)));
+
+    /* Each thread collects the key rid pairs of the tuples of the pages in use in its run and sorts them. Pages are
+       copied out of the file, so a thread failing part way leaves nothing pinned. */
+    std::vector<std::vector<RIDKeyPair<T> > > runs(numThreads);
+    std::vector<std::exception_ptr> errors(numThreads);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; t++) {
+        PageId begin = 1 + numPages * t / numThreads, end = 1 + numPages * (t + 1) / numThreads;
+        threads.push_back(std::thread([&, t, begin, end]() {
+            try {
+                std::vector<RIDKeyPair<T> >& run = runs[t];
+                RIDKeyPair<T> entry;
+                Page page;
+                for (PageId pageNum = begin; pageNum < end; pageNum++) {
+                    if (!readers[t]->readPage(pageNum, page))
+                        continue;
+                    for (PageIterator iter = page.begin(); iter != page.end(); iter++) {
+                        std::string record = *iter;
+                        entry.set(iter.getCurrentRecord(), readKey<T>(record.c_str() + attrByteOffset));
+                        run.push_back(entry);
+                    }
+                }
+                std::sort(run.begin(), run.end());
+            }
+            catch (...) {
+                errors[t] = std::current_exception();
+            }
+        }));
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (auto& error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /* Merge the runs pairwise, runStarts holding the start of each run and the end of the last */
+    std::vector<size_t> runStarts(1, 0);
+    for (auto& run : runs) {
+        entries.insert(entries.end(), run.begin(), run.end());
+        runStarts.push_back(entries.size());
+        std::vector<RIDKeyPair<T> >().swap(run);
+    }
+    while (runStarts.size() > 2) {
+        std::vector<size_t> mergedStarts;
+        threads.clear();
+        for (size_t r = 0; r + 1 < runStarts.size(); r += 2) {
+            mergedStarts.push_back(runStarts[r]);
+            if (r + 2 < runStarts.size()) {
+                auto first = entries.begin() + runStarts[r], middle = entries.begin() + runStarts[r + 1],
+                     last = entries.begin() + runStarts[r + 2];
+                threads.push_back(std::thread([first, middle, last]() { std::inplace_merge(first, middle, last); }));
+            }
+        }
+        mergedStarts.push_back(entries.size());
+        for (auto& thread : threads)
+            thread.join();
+        runStarts.swap(mergedStarts);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readRecords
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::readRecords(RecordQueue* records, std::vector<RIDKeyPair<T> >& entries)
+{
+    std::shared_ptr<const RecordBatch> batch;
+    RIDKeyPair<T> entry;
+    while (records->pop(batch)) {
+        for (const auto& record : *batch) {
+            entry.set(record.first, readKey<T>(record.second.c_str() + attrByteOffset));
+            entries.push_back(entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::bulkLoad
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::bulkLoad(std::vector<RIDKeyPair<T> >& entries, double fillFactor)
+{
+    /* An empty relation keeps the empty root set up by the constructor */
+    if (entries.empty())
+        return;
+
+    if (fillFactor > 1.0)
+        fillFactor = 1.0;
+
+    stats.numEntries = entries.size();
+    memcpy(stats.minKey, &entries.front().key, sizeof(T));
+    memcpy(stats.maxKey, &entries.back().key, sizeof(T));
+    packPostingLists(entries);
+
+    /* Number of entries per leaf and children per non-leaf node at the requested fill factor */
+    size_t leafFill = std::max(1, (int)(fillFactor * NodeSize<T>::LEAF));
+    size_t nodeFill = std::max(2, (int)(fillFactor * (NodeSize<T>::NONLEAF + 1)));
+
+    /* Page number, lowest key and number of entries of every node of the level last built */
+    std::vector<PageKeyPair<T> > level;
+    std::vector<int> levelCounts;
+
+    /* Pack the leaves left to right, spreading the entries evenly so that the last leaf is not left nearly empty */
+    size_t numLeaves = (entries.size() + leafFill - 1) / leafFill;
+    level.reserve(numLeaves);
+
+    Page* page;
+    PageId pageId, prevPageId = Page::INVALID_NUMBER;
+    LeafNode<T>* prevLeaf = nullptr;
+    PageKeyPair<T> pair;
+    size_t pos = 0;
+
+    for (size_t leaf = 0; pos < entries.size(); leaf++) {
+        allocNodePage(pageId, page);
+        auto leafNode = (LeafNode<T>*)page;
+        leafNode->version = 0;
+
+        /* Compressed leaves take as many entries as their coding fits, so their number is not known up front */
+        size_t count;
+        if (leafFormat == COMPRESSED_LEAVES) {
+            count = packCompressedLeaf(page, entries, pos, fillFactor);
+        }
+        else {
+            count = entries.size() / numLeaves + (leaf < entries.size() % numLeaves ? 1 : 0);
+            for (size_t i = 0; i < count; i++) {
+                leafNode->keyArray[i] = entries[pos + i].key;
+                leafNode->ridArray[i] = entries[pos + i].rid;
+            }
+            leafNode->numEntries = count;
+        }
+        leafNode->rightSibPageNo = Page::INVALID_NUMBER;
+        leafNode->leftSibPageNo = prevPageId;
+
+        /* Link the previous leaf to this one, it is complete now */
+        if (prevLeaf != nullptr) {
+            prevLeaf->rightSibPageNo = pageId;
+            prevLeaf->highKey = entries[pos].key;
+            bufMgr->unPinPage(file, prevPageId, true);
+        }
+        prevLeaf = leafNode;
+        prevPageId = pageId;
+
+        int numRids = 0;
+        for (size_t i = 0; i < count; i++)
+            numRids += ridCount(entries[pos + i].rid);
+
+        pair.set(pageId, entries[pos].key);
+        level.push_back(pair);
+        levelCounts.push_back(numRids);
+        pos += count;
+    }
+    bufMgr->unPinPage(file, prevPageId, true);
+    stats.numLeaves = level.size();
+    stats.height = 2;
+
+    /* Build the non-leaf levels until the remaining nodes fit in the root */
+    int nodeLevel = 1;
+    while (level.size() > (size_t)NodeSize<T>::NONLEAF + 1) {
+        std::vector<PageKeyPair<T> > parents;
+        std::vector<int> parentCounts;
+        size_t numNodes = (level.size() + nodeFill - 1) / nodeFill;
+        parents.reserve(numNodes);
+        pos = 0;
+
+        NonLeafNode<T>* prevNode = nullptr;
+        for (size_t n = 0; n < numNodes; n++) {
+            size_t count = level.size() / numNodes + (n < level.size() % numNodes ? 1 : 0);
+
+            allocNodePage(pageId, page);
+            auto node = (NonLeafNode<T>*)page;
+            fillNonLeafNode(node, level, levelCounts, pos, count, nodeLevel);
+
+            /* Link the previous node of the level to this one, like the leaves */
+            if (prevNode != nullptr) {
+                prevNode->rightSibPageNo = pageId;
+                prevNode->highKey = level[pos].key;
+                bufMgr->unPinPage(file, prevPageId, true);
+            }
+            prevNode = node;
+            prevPageId = pageId;
+
+            pair.set(pageId, level[pos].key);
+            parents.push_back(pair);
+            parentCounts.push_back(std::accumulate(levelCounts.begin() + pos, levelCounts.begin() + pos + count, 0));
+            pos += count;
+        }
+        bufMgr->unPinPage(file, prevPageId, true);
+
+        level.swap(parents);
+        levelCounts.swap(parentCounts);
+        nodeLevel = 0;
+        stats.height++;
+    }
+
+    /* The top level goes into the root page allocated by the constructor */
+    bufMgr->readPage(file, rootPageNum, page);
+    fillNonLeafNode((NonLeafNode<T>*)page, level, levelCounts, 0, level.size(), nodeLevel);
+    bufMgr->unPinPage(file, rootPageNum, true);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::fillNonLeafNode
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::fillNonLeafNode(NonLeafNode<T>* node, const std::vector<PageKeyPair<T> >& children,
+                                 const std::vector<int>& childCounts, size_t begin, size_t count, int level)
+{
+    node->version = 0;
+    node->level = level;
+    node->numKeys = count - 1;
+    node->rightSibPageNo = Page::INVALID_NUMBER;
+
+    /* The lowest key of each child but the first separates it from its left neighbour */
+    node->pageNoArray[0] = children[begin].pageNo;
+    node->countArray[0] = childCounts[begin];
+    for (size_t i = 1; i < count; i++) {
+        node->keyArray[i - 1] = children[begin + i].key;
+        node->pageNoArray[i] = children[begin + i].pageNo;
+        node->countArray[i] = childCounts[begin + i];
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::packCompressedLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+size_t BTreeIndex::packCompressedLeaf(Page* page, const std::vector<RIDKeyPair<T> >& entries, size_t pos, double fillFactor)
+{
+    size_t maxCount = std::min(entries.size() - pos, (size_t)COMPRESSEDLEAFSIZE);
+    std::vector<T> keys(maxCount);
+    std::vector<RecordId> rids(maxCount);
+    for (size_t i = 0; i < maxCount; i++) {
+        keys[i] = entries[pos + i].key;
+        rids[i] = entries[pos + i].rid;
+    }
+
+    /* Bisect the most entries that fit, more entries never take fewer bits. A single entry always fits. */
+    auto node = (CompressedLeafNode*)page;
+    size_t low = 1, high = maxCount;
+    while (low < high) {
+        size_t mid = (low + high + 1) / 2;
+        if (LeafCodec<T>::encode(node, keys.data(), rids.data(), mid))
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    size_t count = std::max((size_t)1, (size_t)(fillFactor * low));
+    LeafCodec<T>::encode(node, keys.data(), rids.data(), count);
+    return count;
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::~BTreeIndex -- destructor
 // -----------------------------------------------------------------------------
 BTreeIndex::~BTreeIndex()
 {
-    /* stop scan */
-    scanExecuting = false;
-
-    /* Unpin pages not being used */
+    /* stop scan and unpin the page it was on */
     try {
-        bufMgr->unPinPage(file, currentPageNum, false);
+        scan.endScan();
+    }
+    catch (ScanNotInitializedException& e) {
+    }
+
+    /* Count the pending appends in the right edge before its nodes are written out */
+    switch (attributeType) {
+    case INTEGER:
+        countAppends<int>();
+        break;
+    case DOUBLE:
+        countAppends<double>();
+        break;
+    case STRING:
+        countAppends<StringKey>();
+        break;
     }
-    catch (PageNotPinnedException& e) {
+
+    /* Bring the statistics in the meta page up to date */
+    {
+        std::lock_guard<std::mutex> guard(statsMutex);
+        writeMetaInfo();
     }
 
     /* Release buffer and delete file  */
     bufMgr->flushFile(file);
     delete file;
-    
+    pthread_rwlock_destroy(&treeLatch);
 }
 
 // -----------------------------------------------------------------------------
@@ -178,233 +825,489 @@ void BTreeIndex::insertEntry(const void* key, const RecordId rid)
     if (key == nullptr)
         return;
 
-    /* Get the root node */
+    TreeLatchGuard guard(&treeLatch, false);
+    switch (attributeType) {
+    case INTEGER:
+        insertEntryTyped(readKey<int>(key), rid);
+        break;
+    case DOUBLE:
+        insertEntryTyped(readKey<double>(key), rid);
+        break;
+    case STRING:
+        insertEntryTyped(readKey<StringKey>(key), rid);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertEntryTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::insertEntryTyped(T key, const RecordId rid)
+{
+    /* In append mode the insert holds appendMutex until it is done, so no append lands in a leaf it splits before
+       the nodes above count it */
+    std::unique_lock<std::mutex> appendLock;
+    if (appendMode) {
+        appendLock = std::unique_lock<std::mutex>(appendMutex);
+        if (appendToLastLeaf<T>(key, rid)) {
+            countInsert(key);
+            return;
+        }
+        countAppends<T>();
+    }
+    insertFromRoot(key, rid);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertFromRoot
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::insertFromRoot(T key, const RecordId rid)
+{
+    int newLeaves = 0, newLevels = 0;
+
+    /* Get the root node, latched exclusive like every node on the way down */
     Page* currPage;
-    bufMgr->readPage(file, rootPageNum, currPage);
-    auto currNode = (NonLeafNodeInt*)currPage;
+    PageId currPageNum = latchRoot(currPage, true);
+    auto currNode = (NonLeafNode<T>*)currPage;
 
-    LeafNodeInt* dataNode;
-    int idx, intKey = *((int *)key);
+    LeafNode<T>* dataNode;
+    int idx;
 
-    /* Store nodes in path to */
-    std::stack<PageId> path;
-    path.push(rootPageNum);
+    /* Store nodes in path to the leaf that a split may still reach, with the index of the child taken in each,
+       they stay pinned and latched until the insert is done. Once a child has room for one more entry its
+       ancestors are released. Each node counts the new entry under the child taken before it is let go. */
+    std::stack<std::pair<PageId, int> > path;
+    path.push(std::make_pair(currPageNum, 0));
 
     /* iterate through the tree to find the right place for node insertion */
     while (true) {
 
-        /* Iterate to get next pages */
-        for (idx = 0;
-             idx < INTARRAYNONLEAFSIZE && currNode->pageNoArray[idx + 1] != Page::INVALID_NUMBER && currNode->keyArray[idx] < intKey;
-             idx++)
-            ;
+        /* Binary search the first child whose separator is not below the key */
+        idx = nodeLowerBound(currNode->keyArray, currNode->numKeys, key);
+        path.top().second = idx;
 
         /* check if index is new (new tree) */
-        if (idx == 0 && currNode->pageNoArray[0] == Page::INVALID_NUMBER) {
+        if (currNode->pageNoArray[0] == Page::INVALID_NUMBER) {
 
             /* buffer allocate page */
             Page *pageRight, *pageLeft;
             PageId pageIdLeft, pageIdRight;
-            bufMgr->allocPage(file, pageIdLeft, pageLeft);
-            bufMgr->allocPage(file, pageIdRight, pageRight);
-
-            /* set currnode as root */
-            currNode->keyArray[0] = intKey;
-            currNode->pageNoArray[0] = pageIdLeft;
-            currNode->pageNoArray[1] = pageIdRight;
+            allocNodePage(pageIdLeft, pageLeft);
+            allocNodePage(pageIdRight, pageRight);
 
             /* init data */
-            dataNode = (LeafNodeInt*)pageRight;
-            auto leftDataNode = (LeafNodeInt*)pageLeft;
+            dataNode = (LeafNode<T>*)pageRight;
+            auto leftDataNode = (LeafNode<T>*)pageLeft;
+            leftDataNode->version = 0;
+            leftDataNode->numEntries = 0;
             leftDataNode->rightSibPageNo = pageIdRight;
-
-            for (int i = 0; i < INTARRAYLEAFSIZE; ++i) {
-                clearLeafNodeAtIdx(dataNode, i);
-                clearLeafNodeAtIdx(leftDataNode, i);
+            leftDataNode->leftSibPageNo = Page::INVALID_NUMBER;
+            leftDataNode->highKey = key;
+            dataNode->version = 0;
+            dataNode->numEntries = 0;
+            dataNode->rightSibPageNo = Page::INVALID_NUMBER;
+            dataNode->leftSibPageNo = pageIdLeft;
+            if (leafFormat == COMPRESSED_LEAVES) {
+                LeafCodec<T>::encode((CompressedLeafNode*)pageLeft, &key, &rid, 0);
+                LeafCodec<T>::encode((CompressedLeafNode*)pageRight, &key, &rid, 0);
             }
 
             /* Unpin page */
-            try {
-                bufMgr->unPinPage(file, pageIdLeft, true);
-            }
-            catch (PageNotPinnedException& e) {
+            bufMgr->unPinPage(file, pageIdLeft, true);
+
+            /* set currnode as root, the leaves are complete before it points to them */
+            {
+                NodeWriteGuard guard(currNode->version);
+                currNode->keyArray[0] = key;
+                currNode->pageNoArray[0] = pageIdLeft;
+                currNode->pageNoArray[1] = pageIdRight;
+                currNode->countArray[0] = 0;
+                currNode->countArray[1] = 1;
+                currNode->numKeys = 1;
             }
 
-            path.push(pageIdRight);
+            bufMgr->latchPage(file, pageIdRight, true);
+            path.top().second = 1;
+            path.push(std::make_pair(pageIdRight, 0));
+            newLeaves = 2;
+            newLevels = 1;
             break;
         }
 
-        /* Get next page in buffer*/
-        bufMgr->readPage(file, currNode->pageNoArray[idx], currPage);
-        path.push(currNode->pageNoArray[idx]);
+        /* Get next page in buffer, latching it before the parent can be let go */
+        currNode->countArray[idx]++;
+        PageId childPageNum = currNode->pageNoArray[idx];
+        bool leafNext = currNode->level == 1;
+        bufMgr->readPage(file, childPageNum, currPage);
+        bufMgr->latchPage(file, childPageNum, true);
+
+        /* A child with room absorbs any split below it, so nothing above it changes */
+        bool safe = leafNext ? leafHasRoom(currPage, key, rid)
+                             : ((NonLeafNode<T>*)currPage)->numKeys < NodeSize<T>::NONLEAF;
+        if (safe) {
+            while (!path.empty()) {
+                releasePage(path.top().first, true);
+                path.pop();
+            }
+        }
+        path.push(std::make_pair(childPageNum, 0));
 
         /* Set data node if its a leaf, otherwise cotinue iteration through the tree */
-        if (currNode->level == 1) {
-            dataNode = (LeafNodeInt*)currPage;
+        if (leafNext) {
+            dataNode = (LeafNode<T>*)currPage;
             break;
         }
         else {
-            currNode = (NonLeafNodeInt*)currPage;
+            currNode = (NonLeafNode<T>*)currPage;
         }
     }
 
-    /* check if it will split or insert directly */
-    if (!insertKeyInLeafNode(dataNode, intKey, rid)) {
-
-        /* Split the leaf node and copy the middle key up in the tree */
-        PageId newPageId = splitLeafNode(dataNode, intKey, rid);
-
-        try {
-            bufMgr->unPinPage(file, path.top(), true);
-        }
-        catch (PageNotPinnedException& e) {
-        }
-        path.pop();
+    finishInsert(path, dataNode, key, rid, newLeaves, newLevels);
+}
 
-        PageId currPageId = path.top();
+// -----------------------------------------------------------------------------
+// BTreeIndex::finishInsert
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::finishInsert(std::stack<std::pair<PageId, int> >& path, LeafNode<T>* dataNode, T key, const RecordId rid,
+                              int newLeaves, int newLevels)
+{
+    /* The key is moved up by splits, the statistics need the inserted one */
+    const T insertedKey = key;
+    Page* currPage;
+    NonLeafNode<T>* currNode;
 
-        /* Read the parent non-leaf node*/
-        bufMgr->readPage(file, currPageId, currPage);
-        try {
-            bufMgr->unPinPage(file, currPageId, true);
-        }
-        catch (PageNotPinnedException& e) {
-        }
+    /* check if it will split or insert directly, split the leaf node and copy the middle key up in the tree if full */
+    PageId newPageId = Page::INVALID_NUMBER;
+    bool lastLeaf = dataNode->rightSibPageNo == Page::INVALID_NUMBER;
+    {
+        NodeWriteGuard guard(dataNode->version);
+        if (leafFormat == COMPRESSED_LEAVES)
+            newPageId = insertIntoCompressedLeaf(path.top().first, (Page*)dataNode, key, rid);
+        else if (!addToPostingList(dataNode, key, rid) && !insertKeyInLeafNode(dataNode, key, rid))
+            newPageId = splitLeafNode(path.top().first, dataNode, key, rid);
+    }
 
-        currNode = (NonLeafNodeInt*)currPage;
+    /* Later appends go to the right-most leaf, the new one if the last leaf was split */
+    if (appendMode && lastLeaf)
+        appendLeafPageNum = newPageId != Page::INVALID_NUMBER ? newPageId : path.top().first;
 
-        /* Keep splitting until has space */
-        while (!insertKeyInNonLeafNode(currNode, intKey, newPageId)) {
+    if (newPageId != Page::INVALID_NUMBER) {
+        /* The new node is reached from no parent yet, so no other insert changes its entries before they are counted */
+        int newCount = subtreeCount<T>(newPageId, true);
+        releasePage(path.top().first, true);
+        path.pop();
+        newLeaves++;
 
-            newPageId = splitNonLeafNode(currNode, intKey, newPageId);
+        /* Insert the new child into the parent, splitting ancestors until one has space. The bottom of the
+           path is either a node with space or the root. */
+        bool split = true;
+        while (split && !path.empty()) {
+            PageId currPageId = path.top().first;
+            int childIdx = path.top().second;
 
-            try {
-                bufMgr->unPinPage(file, currPageId, true);
-            }
-            catch (PageNotPinnedException& e) {
-            }
-            /* Unpin page and remove from path stack */
-            path.pop();
+            /* The parent is still pinned from the descent, this read just gets its frame */
+            bufMgr->readPage(file, currPageId, currPage);
+            currNode = (NonLeafNode<T>*)currPage;
 
-            if (!path.empty()) {
-                currPageId = path.top();
-                bufMgr->readPage(file, currPageId, currPage);
-                currNode = (NonLeafNodeInt*)currPage;
+            {
+                NodeWriteGuard guard(currNode->version);
+                currNode->countArray[childIdx] -= newCount;
+                if (insertKeyInNonLeafNode(currNode, key, newPageId, childIdx, newCount))
+                    split = false;
+                else
+                    newPageId = splitNonLeafNode(currNode, key, newPageId, childIdx, newCount);
             }
-            else {
-                break;
-            }
-        }
+            if (split)
+                newCount = subtreeCount<T>(newPageId, false);
 
-        try {
-            bufMgr->unPinPage(file, currPageId, true);
-        }
-        catch (PageNotPinnedException& e) {
+            /* The root itself was split, so create a new root above it. The old root stays latched until
+               the root page number moves, so no reader can take it for the root any more. */
+            if (split && currPageId == rootPageNum) {
+                Page* rootPage;
+                PageId pageId;
 
-        }
+                /* buffer allocate a new page for the root */
+                allocNodePage(pageId, rootPage);
 
-        /* No empty non-leaf node found, so create a new root */
-        if (path.empty()) {
-            Page* rootPage;
-            PageId pageId;
+                /* Create the new root node */
+                auto root = (NonLeafNode<T>*)rootPage;
+                root->version = 0;
+                root->level = 0;
+                root->numKeys = 1;
+                root->rightSibPageNo = Page::INVALID_NUMBER;
 
-            /* buffer allocate a new page for the root */
-            bufMgr->allocPage(file, pageId, rootPage);
+                /* Copy the middle key and the page numbers of child nodes */
+                root->keyArray[0] = key;
+                root->pageNoArray[0] = currPageId;
+                root->pageNoArray[1] = newPageId;
+                root->countArray[0] = subtreeCount<T>(currPageId, false);
+                root->countArray[1] = newCount;
 
-            /* Create the new root node */
-            auto root = (NonLeafNodeInt*)rootPage;
-            root->level = 0;
+                /* Update the root page, the meta page gets it once the insert is done */
+                rootPageNum = pageId;
+                newLevels++;
 
-            for (int i = 1; i < INTARRAYNONLEAFSIZE; i++) {
-                clearNonLeafNodeAtIdx(root, i);
+                bufMgr->unPinPage(file, pageId, true);
+                split = false;
             }
-            root->pageNoArray[INTARRAYNONLEAFSIZE] = Page::INVALID_NUMBER;
-
-            /* Copy the middle key and the page numbers of child nodes */
-            root->keyArray[0] = intKey;
-            root->pageNoArray[0] = currPageId;
-            root->pageNoArray[1] = newPageId;
-
-            /* Update the root page */
-            rootPageNum = pageId;
 
-            /* Unpin the new root page and the newly split child node */
-            try {
-                bufMgr->unPinPage(file, newPageId, true);
-            }
-            catch (PageNotPinnedException& e) {
-            }
-            try {
-                bufMgr->unPinPage(file, pageId, true);
-            }
-            catch (PageNotPinnedException& e) {
-            }
-        }
-        while (!path.empty()) {
-            try {
-                bufMgr->unPinPage(file, path.top(), true);
-            }
-            catch (PageNotPinnedException& e) {
-            }
+            bufMgr->unPinPage(file, currPageId, true);
+            releasePage(currPageId, true);
             path.pop();
         }
     }
     else {
-        while (!path.empty()) {
-            try {
-                bufMgr->unPinPage(file, path.top(), true);
+        releasePage(path.top().first, true);
+        path.pop();
+    }
+
+    /* Release the ancestors the split did not reach, which only counted the entry */
+    while (!path.empty()) {
+        releasePage(path.top().first, true);
+        path.pop();
+    }
+
+    if (newLeaves > 0 || newLevels > 0)
+        countShapeChange(newLeaves, newLevels);
+    countInsert(insertedKey);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertBatch
+// -----------------------------------------------------------------------------
+void BTreeIndex::insertBatch(const KeyRid* entries, size_t n)
+{
+    TreeLatchGuard guard(&treeLatch, false);
+    switch (attributeType) {
+    case INTEGER:
+        insertBatchTyped<int>(entries, n);
+        break;
+    case DOUBLE:
+        insertBatchTyped<double>(entries, n);
+        break;
+    case STRING:
+        insertBatchTyped<StringKey>(entries, n);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertBatchTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::insertBatchTyped(const KeyRid* batch, size_t n)
+{
+    std::vector<RIDKeyPair<T> > entries;
+    entries.reserve(n);
+    RIDKeyPair<T> entry;
+    for (size_t i = 0; i < n; i++) {
+        if (batch[i].key == nullptr)
+            continue;
+        entry.set(batch[i].rid, readKey<T>(batch[i].key));
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end());
+    std::unique_lock<std::mutex> appendLock = settleAppends<T>();
+
+    /* A node latched on the way down, with the child taken and the end of the entries in the range of the node */
+    struct BatchLevel {
+        PageId pageNum;
+        Page* page;
+        int idx;
+        size_t end;
+    };
+    std::vector<BatchLevel> path;
+    auto keyLess = [](const T& key, const RIDKeyPair<T>& e) { return key < e.key; };
+
+    size_t pos = 0;
+    while (pos < entries.size()) {
+        /* The first insert into an empty tree sets up its leaves */
+        Page* page;
+        PageId pageNum = latchRoot(page, true);
+        if (((NonLeafNode<T>*)page)->pageNoArray[0] == Page::INVALID_NUMBER) {
+            releasePage(pageNum, false);
+            insertFromRoot(entries[pos].key, entries[pos].rid);
+            pos++;
+            continue;
+        }
+        path.push_back(BatchLevel{pageNum, page, 0, entries.size()});
+
+        /* The path stays latched while the batch moves from leaf to leaf, so that each node counts the entries
+           placed below it. A full leaf ends the walk. */
+        while (pos < entries.size()) {
+            /* Descend to the leaf of the next entry, narrowing the entries to the range of each child taken. The
+               children are taken like in insertEntry, so equal keys go to the first child they may be in. */
+            while (true) {
+                BatchLevel& top = path.back();
+                auto node = (NonLeafNode<T>*)top.page;
+                top.idx = nodeLowerBound(node->keyArray, node->numKeys, entries[pos].key);
+                size_t end = top.end;
+                if (top.idx < node->numKeys)
+                    end = std::upper_bound(entries.begin() + pos, entries.begin() + end, node->keyArray[top.idx], keyLess)
+                        - entries.begin();
+
+                PageId childPageNum = node->pageNoArray[top.idx];
+                bool leafNext = node->level == 1;
+                Page* childPage;
+                bufMgr->readPage(file, childPageNum, childPage);
+                bufMgr->latchPage(file, childPageNum, true);
+                path.push_back(BatchLevel{childPageNum, childPage, 0, end});
+                if (leafNext)
+                    break;
             }
-            catch (PageNotPinnedException& e) {
+
+            /* Place the entries of the leaf's range that fit into it and count them on the path */
+            BatchLevel& leafLevel = path.back();
+            size_t placed;
+            {
+                NodeWriteGuard guard(((LeafNode<T>*)leafLevel.page)->version);
+                placed = fillLeaf(leafLevel.page, entries, pos, leafLevel.end);
             }
-            catch (HashNotFoundException& e) {
+            for (size_t i = 0; i + 1 < path.size(); i++)
+                ((NonLeafNode<T>*)path[i].page)->countArray[path[i].idx] += placed;
+            for (size_t i = pos; i < pos + placed; i++)
+                countInsert(entries[i].key);
+            pos += placed;
+
+            /* A full leaf takes the next entry through a split, like in insertEntry. The split may reach every node on
+               the path, so the batch goes on from the root. */
+            if (placed == 0) {
+                std::stack<std::pair<PageId, int> > splitPath;
+                for (size_t i = 0; i + 1 < path.size(); i++) {
+                    ((NonLeafNode<T>*)path[i].page)->countArray[path[i].idx]++;
+                    splitPath.push(std::make_pair(path[i].pageNum, path[i].idx));
+                }
+                splitPath.push(std::make_pair(leafLevel.pageNum, 0));
+                finishInsert(splitPath, (LeafNode<T>*)leafLevel.page, entries[pos].key, entries[pos].rid, 0, 0);
+                path.clear();
+                pos++;
+                break;
             }
-            path.pop();
+
+            /* Walk back up to the lowest node whose range holds the next entry */
+            releasePage(leafLevel.pageNum, true);
+            path.pop_back();
+            while (path.size() > 1 && path.back().end <= pos) {
+                releasePage(path.back().pageNum, true);
+                path.pop_back();
+            }
+        }
+
+        while (!path.empty()) {
+            releasePage(path.back().pageNum, true);
+            path.pop_back();
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::fillLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+size_t BTreeIndex::fillLeaf(Page* page, const std::vector<RIDKeyPair<T> >& entries, size_t begin, size_t end)
+{
+    /* A posting list absorbs any number of entries, so they go in one at a time */
+    if (leafFormat == POSTING_LIST_LEAVES) {
+        auto leaf = (LeafNode<T>*)page;
+        size_t i = begin;
+        for (; i < end; i++) {
+            if (!addToPostingList(leaf, entries[i].key, entries[i].rid) && !insertKeyInLeafNode(leaf, entries[i].key, entries[i].rid))
+                break;
+        }
+        return i - begin;
+    }
+
+    /* The entries of the leaf, the new ones are merged in ahead of equal keys like in insertKeyInLeafNode */
+    LeafEntries<T> leaf;
+    readLeafEntries(page, leaf, true);
+    int count = leaf.numEntries;
+    std::vector<RIDKeyPair<T> > leafPairs(count), merged;
+    for (int i = 0; i < count; i++)
+        leafPairs[i].set(leaf.ridArray[i], leaf.keyArray[i]);
+    std::vector<T> keys;
+    std::vector<RecordId> rids;
+    auto merge = [&](size_t numNew) {
+        merged.resize(count + numNew);
+        std::merge(entries.begin() + begin, entries.begin() + begin + numNew, leafPairs.begin(), leafPairs.end(), merged.begin());
+        keys.resize(merged.size());
+        rids.resize(merged.size());
+        for (size_t i = 0; i < merged.size(); i++) {
+            keys[i] = merged[i].key;
+            rids[i] = merged[i].rid;
         }
+    };
+
+    if (leafFormat == COMPRESSED_LEAVES) {
+        /* Bisect the most entries that fit, more entries never take fewer bits. A failed coding changes nothing,
+           so the leaf is left coded with the last that fit. */
+        auto node = (CompressedLeafNode*)page;
+        size_t low = 0, high = std::min(end - begin, (size_t)(COMPRESSEDLEAFSIZE - count));
+        while (low < high) {
+            size_t mid = (low + high + 1) / 2;
+            merge(mid);
+            if (LeafCodec<T>::encode(node, keys.data(), rids.data(), merged.size()))
+                low = mid;
+            else
+                high = mid - 1;
+        }
+        return low;
     }
+
+    auto node = (LeafNode<T>*)page;
+    size_t numNew = std::min(end - begin, (size_t)(NodeSize<T>::LEAF - count));
+    merge(numNew);
+    std::copy(keys.begin(), keys.end(), node->keyArray);
+    std::copy(rids.begin(), rids.end(), node->ridArray);
+    node->numEntries = merged.size();
+    return numNew;
 }
 
 // -----------------------------------------------------------------------------
 // BTreeIndex::splitLeafNode
 // -----------------------------------------------------------------------------
-PageId BTreeIndex::splitLeafNode(LeafNodeInt* dataNode, int& intKey, const RecordId rid)
+template <class T>
+PageId BTreeIndex::splitLeafNode(PageId pageNum, LeafNode<T>* dataNode, T& key, const RecordId rid)
 {
     /* Create and allocate leaf page */
     Page* page;
     PageId pageId;
-    bufMgr->allocPage(file, pageId, page);
-    auto newLeafNode = (LeafNodeInt*)page;
+    allocNodePage(pageId, page);
+    auto newLeafNode = (LeafNode<T>*)page;
+    newLeafNode->version = 0;
 
-    /* Initialize the node with default values int */
-    for (int i = 0; i < INTARRAYLEAFSIZE; i++)
-        clearLeafNodeAtIdx(newLeafNode, i);
+    /* get the split point from the policy, in append mode a key past the end of the right-most leaf goes to the new leaf alone */
+    int midIdx = splitPolicy.splitPoint(NodeSize<T>::LEAF, nodeLowerBound(dataNode->keyArray, NodeSize<T>::LEAF, key));
+    if (appendMode && dataNode->rightSibPageNo == Page::INVALID_NUMBER && key > dataNode->keyArray[NodeSize<T>::LEAF - 1])
+        midIdx = NodeSize<T>::LEAF;
 
-    /* get middle index */
-    int midIdx = (INTARRAYLEAFSIZE + 1) / 2;
+    /* Move second half of data node to new leaf node */
+    std::copy(dataNode->keyArray + midIdx, dataNode->keyArray + NodeSize<T>::LEAF, newLeafNode->keyArray);
+    std::copy(dataNode->ridArray + midIdx, dataNode->ridArray + NodeSize<T>::LEAF, newLeafNode->ridArray);
+    newLeafNode->numEntries = NodeSize<T>::LEAF - midIdx;
+    dataNode->numEntries = midIdx;
 
-    /* Copy second half of data node to new leaf node and invalidate it in data node */
-    for (int i = midIdx; i < INTARRAYLEAFSIZE; ++i) {
-        newLeafNode->keyArray[i - midIdx] = dataNode->keyArray[i];
-        newLeafNode->ridArray[i - midIdx] = dataNode->ridArray[i];
-        clearLeafNodeAtIdx(dataNode, i);
-    }
-
-    if (intKey < newLeafNode->keyArray[0])
-        insertKeyInLeafNode(dataNode, intKey, rid);
+    if (newLeafNode->numEntries > 0 && key < newLeafNode->keyArray[0])
+        insertKeyInLeafNode(dataNode, key, rid);
     else
-        insertKeyInLeafNode(newLeafNode, intKey, rid);
+        insertKeyInLeafNode(newLeafNode, key, rid);
 
-    /* Update page IDs with right sib */
+    /* Update page IDs with right sib, the new leaf takes over the high key and the old one ends where it starts.
+       The leaf on the right is latched after this one, in the order scans take them. */
     newLeafNode->rightSibPageNo = dataNode->rightSibPageNo;
+    newLeafNode->leftSibPageNo = pageNum;
+    newLeafNode->highKey = dataNode->highKey;
+    if (dataNode->rightSibPageNo != Page::INVALID_NUMBER)
+        setLeftSibling<T>(dataNode->rightSibPageNo, pageId);
     dataNode->rightSibPageNo = pageId;
+    dataNode->highKey = newLeafNode->keyArray[0];
 
-    intKey = newLeafNode->keyArray[0];
+    key = newLeafNode->keyArray[0];
 
     /* Unpin the newly split child node */
-    try {
-        bufMgr->unPinPage(file, pageId, true);
-    }
-    catch (PageNotPinnedException& e) {
-    }
+    bufMgr->unPinPage(file, pageId, true);
 
     return pageId;
 }
@@ -412,74 +1315,82 @@ PageId BTreeIndex::splitLeafNode(LeafNodeInt* dataNode, int& intKey, const Recor
 // -----------------------------------------------------------------------------
 // BTreeIndex::splitNonLeafNode
 // -----------------------------------------------------------------------------
-PageId BTreeIndex::splitNonLeafNode(NonLeafNodeInt* node, int& intKey, const PageId pageId)
+template <class T>
+PageId BTreeIndex::splitNonLeafNode(NonLeafNode<T>* node, T& key, const PageId pageId, const int childIdx, const int count)
 {
+    const int size = NodeSize<T>::NONLEAF;
+
     /* Create and allocate the page */
     Page* page;
     PageId pageId_;
-    bufMgr->allocPage(file, pageId_, page);
-    auto newNode = (NonLeafNodeInt*)page;
+    allocNodePage(pageId_, page);
+    auto newNode = (NonLeafNode<T>*)page;
 
-    /* Initialize the node with default values */
-    for (int i = 0; i < INTARRAYNONLEAFSIZE; i++) {
-        clearNonLeafNodeAtIdx(newNode, i);
-    }
-    newNode->pageNoArray[INTARRAYNONLEAFSIZE] = Page::INVALID_NUMBER;
+    T keyArr[size + 1];
+    PageId pageNoArr[size + 2];
+    int countArr[size + 2];
+    int i;
 
-    /* Get the middle index value */
-    int midIdx = (INTARRAYNONLEAFSIZE + 1) / 2, prevKey = INT_MIN, i, j;
-    int keyArr[INTARRAYNONLEAFSIZE + 1];
-    PageId pageNoArr[INTARRAYNONLEAFSIZE + 2];
+    /* The new key and page go right after the split child. Searching for the key instead could land on
+       the wrong side of separators equal to it, which duplicates leave on both sides of a child. */
+    int pos = childIdx;
 
-    /* first page remains the same as split occrus to the right side of onde */
-    pageNoArr[0] = node->pageNoArray[0];
+    /* Get the split point, the key at it moves up */
+    int midIdx = splitPolicy.splitPoint(size, pos);
 
-    /* Create a sorted array of all keys with new key in its position */
-    for (i = 0, j = 0; j < INTARRAYNONLEAFSIZE; i++) {
-        if (prevKey <= intKey && intKey < node->keyArray[j]) {
-            keyArr[i] = intKey;
-            pageNoArr[i + 1] = pageId;
-            prevKey = node->keyArray[j];
-            continue;
-        }
-        prevKey = keyArr[i] = node->keyArray[j];
-        pageNoArr[i + 1] = node->pageNoArray[j + 1];
-        j++;
+    /* In append mode the right-most node keeps all its keys but the last, which moves up, when the new
+       key goes last, so the new node starts with just the new key */
+    if (appendMode && node->rightSibPageNo == Page::INVALID_NUMBER && pos == size)
+        midIdx = size - 1;
+
+    /* Create a sorted array of all keys with new key in its position,
+       first page remains the same as split occurs to the right side of node */
+    pageNoArr[0] = node->pageNoArray[0];
+    countArr[0] = node->countArray[0];
+    for (i = 0; i < pos; i++) {
+        keyArr[i] = node->keyArray[i];
+        pageNoArr[i + 1] = node->pageNoArray[i + 1];
+        countArr[i + 1] = node->countArray[i + 1];
     }
-    /* Special case where the key is the last key in the sorted key list */
-    if (i == j) {
-        keyArr[i] = intKey;
-        pageNoArr[i + 1] = pageId;
+    keyArr[pos] = key;
+    pageNoArr[pos + 1] = pageId;
+    countArr[pos + 1] = count;
+    for (i = pos; i < size; i++) {
+        keyArr[i + 1] = node->keyArray[i];
+        pageNoArr[i + 2] = node->pageNoArray[i + 1];
+        countArr[i + 2] = node->countArray[i + 1];
     }
 
-    node->pageNoArray[0] = pageNoArr[0];
-
-    /* Update keys of dataNode (left split) to the first half of keys */
+    /* Update keys of node (left split) to the first half of keys */
     for (i = 0; i < midIdx; ++i) {
         node->keyArray[i] = keyArr[i];
         node->pageNoArray[i + 1] = pageNoArr[i + 1];
+        node->countArray[i + 1] = countArr[i + 1];
     }
+    node->numKeys = midIdx;
 
+    /* The middle key moves up, newNode (right split) gets the keys after it */
     newNode->pageNoArray[0] = pageNoArr[midIdx + 1];
-    /* Update keys of newNode (right split) with second half of keys */
-    for (i = midIdx; i < INTARRAYNONLEAFSIZE; ++i) {
-        newNode->keyArray[i - midIdx] = keyArr[i + 1];
-        newNode->pageNoArray[i - midIdx + 1] = pageNoArr[i + 2];
-        /* clear empty nodes in array */
-        clearNonLeafNodeAtIdx(node, i);
-        clearNonLeafNodeAtIdx(newNode, i - 1);
+    newNode->countArray[0] = countArr[midIdx + 1];
+    for (i = midIdx + 1; i <= size; ++i) {
+        newNode->keyArray[i - midIdx - 1] = keyArr[i];
+        newNode->pageNoArray[i - midIdx] = pageNoArr[i + 1];
+        newNode->countArray[i - midIdx] = countArr[i + 1];
     }
-    node->pageNoArray[INTARRAYNONLEAFSIZE] = Page::INVALID_NUMBER;
+    newNode->numKeys = size - midIdx;
 
+    newNode->version = 0;
     newNode->level = node->level;
 
-    intKey = keyArr[midIdx];
+    /* Link the new node in on the right, the middle key ends the range of the old one */
+    newNode->rightSibPageNo = node->rightSibPageNo;
+    newNode->highKey = node->highKey;
+    node->rightSibPageNo = pageId_;
+    node->highKey = keyArr[midIdx];
 
-    try {
-        bufMgr->unPinPage(file, pageId_, true);
-    }
-    catch (PageNotPinnedException& e) {
-    }
+    key = keyArr[midIdx];
+
+    bufMgr->unPinPage(file, pageId_, true);
 
     return pageId_;
 }
@@ -487,32 +1398,23 @@ PageId BTreeIndex::splitNonLeafNode(NonLeafNodeInt* node, int& intKey, const Pag
 // -----------------------------------------------------------------------------
 // BTreeIndex::insertKeyInLeafNode
 // -----------------------------------------------------------------------------
-bool BTreeIndex::insertKeyInLeafNode(LeafNodeInt* node, int key, RecordId rid)
+template <class T>
+bool BTreeIndex::insertKeyInLeafNode(LeafNode<T>* node, const T& key, RecordId rid)
 {
     /* Checks if the node contains any empty space for insertion */
-    if (node->ridArray[INTARRAYLEAFSIZE - 1].page_number != Page::INVALID_NUMBER)
+    int count = node->numEntries;
+    if (count == NodeSize<T>::LEAF)
         return false;
 
-    int idx, newKey = key;
-    RecordId newRid = rid;
-
-    /* Find the index to insert the key rid pair */
-    for (idx = 0;
-         idx < INTARRAYLEAFSIZE && node->ridArray[idx].page_number != Page::INVALID_NUMBER && node->keyArray[idx] < key;
-         idx++)
-        ;
+    /* Find the index to insert the key rid pair, ahead of any equal keys */
+    int idx = nodeLowerBound(node->keyArray, count, key);
 
     /* Insert the key at position idx and shift everything else right */
-    for (; node->ridArray[idx].page_number != Page::INVALID_NUMBER; idx++) {
-        int oldKey = node->keyArray[idx];
-        RecordId oldRid = node->ridArray[idx];
-        node->keyArray[idx] = newKey;
-        node->ridArray[idx] = newRid;
-        newKey = oldKey;
-        newRid = oldRid;
-    }
-    node->keyArray[idx] = newKey;
-    node->ridArray[idx] = newRid;
+    std::copy_backward(node->keyArray + idx, node->keyArray + count, node->keyArray + count + 1);
+    std::copy_backward(node->ridArray + idx, node->ridArray + count, node->ridArray + count + 1);
+    node->keyArray[idx] = key;
+    node->ridArray[idx] = rid;
+    node->numEntries = count + 1;
 
     return true;
 }
@@ -520,231 +1422,3097 @@ bool BTreeIndex::insertKeyInLeafNode(LeafNodeInt* node, int key, RecordId rid)
 // -----------------------------------------------------------------------------
 // BTreeIndex::insertKeyInNonLeafNode
 // -----------------------------------------------------------------------------
-bool BTreeIndex::insertKeyInNonLeafNode(NonLeafNodeInt* node, int key, PageId pageId)
+template <class T>
+bool BTreeIndex::insertKeyInNonLeafNode(NonLeafNode<T>* node, const T& key, PageId pageId, int childIdx, int count)
 {
     /* Checks if the node contains any empty space for insertion */
-    if (node->pageNoArray[INTARRAYNONLEAFSIZE] != Page::INVALID_NUMBER)
+    int numKeys = node->numKeys;
+    if (numKeys == NodeSize<T>::NONLEAF)
         return false;
 
-    int idx, newKey = key;
-    PageId newPageId = pageId;
-
-    /* Find the index to insert the key-pageId pair */
-    for (idx = 0;
-         idx < INTARRAYNONLEAFSIZE && node->pageNoArray[idx + 1] != Page::INVALID_NUMBER && node->keyArray[idx] < key;
-         idx++)
-        ;
+    /* The key-pageId pair goes right after the split child, see splitNonLeafNode */
+    int idx = childIdx;
 
     /* Insert the key at position idx and shift everything else right */
-    for (; node->pageNoArray[idx + 1] != Page::INVALID_NUMBER; idx++) {
-        int oldKey = node->keyArray[idx];
-        PageId oldPageId = node->pageNoArray[idx + 1];
-        node->keyArray[idx] = newKey;
-        node->pageNoArray[idx + 1] = newPageId;
-        newKey = oldKey;
-        newPageId = oldPageId;
-    }
-    node->keyArray[idx] = newKey;
-    node->pageNoArray[idx + 1] = newPageId;
+    std::copy_backward(node->keyArray + idx, node->keyArray + numKeys, node->keyArray + numKeys + 1);
+    std::copy_backward(node->pageNoArray + idx + 1, node->pageNoArray + numKeys + 1, node->pageNoArray + numKeys + 2);
+    std::copy_backward(node->countArray + idx + 1, node->countArray + numKeys + 1, node->countArray + numKeys + 2);
+    node->keyArray[idx] = key;
+    node->pageNoArray[idx + 1] = pageId;
+    node->countArray[idx + 1] = count;
+    node->numKeys = numKeys + 1;
 
     return true;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::clearLeafNodeAtIdx
+// BTreeIndex::appendToLastLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::appendToLastLeaf(const T& key, const RecordId rid)
+{
+    /* A compressed leaf is coded again on every insert anyway, appends to it take the normal path */
+    if (leafFormat == COMPRESSED_LEAVES || appendLeafPageNum == Page::INVALID_NUMBER)
+        return false;
+
+    /* Only inserts in append mode split the last leaf and only deletes free it, neither runs meanwhile, so the page
+       is still the leaf last reached. It takes the key if it is still right-most and the key is above its last key. */
+    Page* page;
+    bufMgr->readPage(file, appendLeafPageNum, page);
+    bufMgr->latchPage(file, appendLeafPageNum, true);
+    auto leaf = (LeafNode<T>*)page;
+    int count = leaf->numEntries;
+    bool appended = leaf->rightSibPageNo == Page::INVALID_NUMBER && count > 0 && count < NodeSize<T>::LEAF
+        && key > leaf->keyArray[count - 1];
+    if (appended) {
+        NodeWriteGuard guard(leaf->version);
+        leaf->keyArray[count] = key;
+        leaf->ridArray[count] = rid;
+        leaf->numEntries = count + 1;
+        appendsUncounted++;
+    }
+    releasePage(appendLeafPageNum, appended);
+    return appended;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::countAppends
 // -----------------------------------------------------------------------------
-void BTreeIndex::clearLeafNodeAtIdx(LeafNodeInt* node, int idx)
+template <class T>
+void BTreeIndex::countAppends()
 {
-    node->keyArray[idx] = -1;
-    node->ridArray[idx].page_number = Page::INVALID_NUMBER;
-    node->ridArray[idx].slot_number = Page::INVALID_SLOT;
+    if (appendsUncounted == 0)
+        return;
+
+    /* The appends are all in the last leaf, below the last child of every node of the right edge */
+    Page* page;
+    PageId pageNum = latchRoot(page, true);
+    while (true) {
+        auto node = (NonLeafNode<T>*)page;
+        {
+            NodeWriteGuard guard(node->version);
+            node->countArray[node->numKeys] += appendsUncounted;
+        }
+        if (node->level == 1) {
+            releasePage(pageNum, true);
+            break;
+        }
+        PageId childPageNum = node->pageNoArray[node->numKeys];
+        bufMgr->readPage(file, childPageNum, page);
+        bufMgr->latchPage(file, childPageNum, true);
+        releasePage(pageNum, true);
+        pageNum = childPageNum;
+    }
+    appendsUncounted = 0;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::clearNonLeafNodeAtIdx
+// BTreeIndex::settleAppends
 // -----------------------------------------------------------------------------
-void BTreeIndex::clearNonLeafNodeAtIdx(NonLeafNodeInt* node, int idx)
+template <class T>
+std::unique_lock<std::mutex> BTreeIndex::settleAppends()
 {
-    node->keyArray[idx] = -1;
-    node->pageNoArray[idx] = Page::INVALID_NUMBER;
+    if (!appendMode)
+        return std::unique_lock<std::mutex>();
+    std::unique_lock<std::mutex> lock(appendMutex);
+    countAppends<T>();
+    return lock;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::startScan
+// BTreeIndex::latchRoot
 // -----------------------------------------------------------------------------
-void BTreeIndex::startScan(const void* lowValParm,
-    const Operator lowOpParm,
-    const void* highValParm,
-    const Operator highOpParm)
+PageId BTreeIndex::latchRoot(Page*& page, bool exclusive)
 {
-    /* Check aprameters values */
-    if ((lowOpParm != GT && lowOpParm != GTE) || (highOpParm != LT && highOpParm != LTE)) {
-        throw BadOpcodesException();
+    while (true) {
+        PageId pageNum = rootPageNum;
+        bufMgr->readPage(file, pageNum, page);
+        bufMgr->latchPage(file, pageNum, exclusive);
+
+        /* A root split while waiting for the latch put a new root above this page */
+        if (pageNum == rootPageNum)
+            return pageNum;
+        releasePage(pageNum, false);
     }
+}
 
-    lowValInt = *(int*)lowValParm;
-    highValInt = *(int*)highValParm;
+// -----------------------------------------------------------------------------
+// BTreeIndex::releasePage
+// -----------------------------------------------------------------------------
+void BTreeIndex::releasePage(PageId pageNum, bool dirty)
+{
+    bufMgr->unlatchPage(file, pageNum);
+    bufMgr->unPinPage(file, pageNum, dirty);
+}
 
-    /* check bounds */
-    if (lowValInt > highValInt)
-        throw BadScanrangeException();
+// -----------------------------------------------------------------------------
+// BTreeIndex::setLeftSibling
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::setLeftSibling(PageId pageNum, PageId leftSibPageNum)
+{
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    bufMgr->latchPage(file, pageNum, true);
+    auto leaf = (LeafNode<T>*)page;
+    {
+        NodeWriteGuard guard(leaf->version);
+        leaf->leftSibPageNo = leftSibPageNum;
+    }
+    releasePage(pageNum, true);
+}
 
-    if (scanExecuting) {
-        endScan();
+// -----------------------------------------------------------------------------
+// BTreeIndex::allocNodePage
+// -----------------------------------------------------------------------------
+void BTreeIndex::allocNodePage(PageId& pageNum, Page*& page)
+{
+    std::lock_guard<std::mutex> guard(allocMutex);
+    if (freePageNum == Page::INVALID_NUMBER) {
+        bufMgr->allocPage(file, pageNum, page);
+        return;
     }
 
-    /* set scan */
-    scanExecuting = true;
-    lowOp = lowOpParm;
-    highOp = highOpParm;
+    /* Take the first freed page off the chain and hand it out as a fresh page */
+    pageNum = freePageNum;
+    bufMgr->readPage(file, pageNum, page);
+    freePageNum = ((FreeNode*)page)->nextFreePageNo;
+    *page = Page();
+    writeFreePageNum();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::freeNodePage
+// -----------------------------------------------------------------------------
+void BTreeIndex::freeNodePage(PageId pageNum)
+{
+    std::lock_guard<std::mutex> guard(allocMutex);
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    ((FreeNode*)page)->nextFreePageNo = freePageNum;
+    bufMgr->unPinPage(file, pageNum, true);
 
-    /* Scan the tree from root to find the parent of the first leaf node to be scanned */
-    getFirstParent(rootPageNum);
+    freePageNum = pageNum;
+    writeFreePageNum();
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::getFirstParent
+// BTreeIndex::writeFreePageNum
 // -----------------------------------------------------------------------------
-void BTreeIndex::getFirstParent(PageId pageNum)
+void BTreeIndex::writeFreePageNum()
 {
-    currentPageNum = pageNum;
-    bufMgr->readPage(file, currentPageNum, currentPageData);
-    auto nonLeafNode = (NonLeafNodeInt*)currentPageData;
+    Page* headerPage;
+    bufMgr->readPage(file, headerPageNum, headerPage);
+    ((IndexMetaInfo*)headerPage)->freePageNo = freePageNum;
+    bufMgr->unPinPage(file, headerPageNum, true);
+}
 
-    int i = 0;
-    while (i < INTARRAYNONLEAFSIZE
-        && lowValInt >= nonLeafNode->keyArray[i]
-        && nonLeafNode->pageNoArray[i + 1] != Page::INVALID_NUMBER)
-        i++;
+// -----------------------------------------------------------------------------
+// BTreeIndex::writeMetaInfo
+// -----------------------------------------------------------------------------
+void BTreeIndex::writeMetaInfo()
+{
+    Page* headerPage;
+    bufMgr->readPage(file, headerPageNum, headerPage);
+    auto metadata = (IndexMetaInfo*)headerPage;
+    metadata->rootPageNo = rootPageNum;
+    metadata->stats = stats;
+    bufMgr->unPinPage(file, headerPageNum, true);
+}
 
-    /* non leaf above leaf node */
-    if (nonLeafNode->level == 1) {
-        try {
-            bufMgr->unPinPage(file, currentPageNum, false);
-        }
-        catch (PageNotPinnedException& e) {
-        }
+// -----------------------------------------------------------------------------
+// BTreeIndex::countShapeChange
+// -----------------------------------------------------------------------------
+void BTreeIndex::countShapeChange(int leafDelta, int heightDelta)
+{
+    std::lock_guard<std::mutex> guard(statsMutex);
+    stats.numLeaves += leafDelta;
+    stats.height += heightDelta;
+    writeMetaInfo();
+}
 
-        /* Search for the key in leaf node */
-        currentPageNum = nonLeafNode->pageNoArray[i];
-        bufMgr->readPage(file, currentPageNum, currentPageData);
+// -----------------------------------------------------------------------------
+// BTreeIndex::countInsert
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::countInsert(const T& key)
+{
+    std::lock_guard<std::mutex> guard(statsMutex);
+    if (stats.numEntries == 0 || key < readKey<T>(stats.minKey))
+        memcpy(stats.minKey, &key, sizeof(T));
+    if (stats.numEntries == 0 || key > readKey<T>(stats.maxKey))
+        memcpy(stats.maxKey, &key, sizeof(T));
+    stats.numEntries++;
+}
 
-        /* binary search to set the value of nextEntry to read the first record that is in the scan range */
-        auto currentNode = (LeafNodeInt*)currentPageData;
-        int low = 0, high = INTARRAYLEAFSIZE - 1;
-        int mid;
-        while (low <= high) {
-            mid = (low + high) / 2;
+// -----------------------------------------------------------------------------
+// BTreeIndex::countDelete
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::countDelete(const T& key)
+{
+    std::lock_guard<std::mutex> guard(statsMutex);
+    if (--stats.numEntries == 0)
+        return;
+    readEdgeKeys<T>(key == readKey<T>(stats.minKey), key == readKey<T>(stats.maxKey));
+}
 
-            if (currentNode->ridArray[mid].page_number == Page::INVALID_NUMBER) {
-                high = mid - 1;
-            }
-            else if ((lowOp == GT && currentNode->keyArray[mid] == lowValInt + 1) || (lowOp == GTE && currentNode->keyArray[mid] == lowValInt)) {
-                break;
-            }
-            else if ((lowOp == GT && currentNode->keyArray[mid] <= lowValInt) || (lowOp == GTE && currentNode->keyArray[mid] < lowValInt)) {
-                low = mid + 1;
-            }
-            else {
-                high = mid - 1;
-            }
+// -----------------------------------------------------------------------------
+// BTreeIndex::countDeleteRange
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::countDeleteRange(const T& lowVal, Operator lowOp, const T& highVal, Operator highOp, long long removed)
+{
+    std::lock_guard<std::mutex> guard(statsMutex);
+    if (removed == 0)
+        return;
+    T minKey = readKey<T>(stats.minKey), maxKey = readKey<T>(stats.maxKey);
+    bool minGone = (lowOp == GTE ? minKey >= lowVal : minKey > lowVal) && (highOp == LTE ? minKey <= highVal : minKey < highVal);
+    bool maxGone = (lowOp == GTE ? maxKey >= lowVal : maxKey > lowVal) && (highOp == LTE ? maxKey <= highVal : maxKey < highVal);
+    stats.numEntries -= removed;
+    if (stats.numEntries > 0)
+        readEdgeKeys<T>(minGone, maxGone);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readEdgeKeys
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::readEdgeKeys(bool lowest, bool highest)
+{
+    /* Deletes run alone, so the edge leaves can be read without latches. Leaves left empty are merged away
+       except for the first leaf of a tree, which the first insert into it leaves empty until a lower key comes. */
+    LeafEntries<T> leaf;
+    Page* page;
+    if (lowest) {
+        PageId pageNum = findEdgeLeaf<T>(false);
+        while (pageNum != Page::INVALID_NUMBER) {
+            bufMgr->readPage(file, pageNum, page);
+            readLeafEntries(page, leaf, false);
+            if (leaf.numEntries > 0)
+                memcpy(stats.minKey, &leaf.keyArray[0], sizeof(T));
+            bufMgr->unPinPage(file, pageNum, false);
+            pageNum = leaf.numEntries > 0 ? Page::INVALID_NUMBER : leaf.rightSibPageNo;
         }
-        nextEntry = mid;
     }
-    else {
-        /* unpin page and move on to the next page, no recrod */
-        try {
-            bufMgr->unPinPage(file, currentPageNum, false);
-        }
-        catch (PageNotPinnedException& e) {
-        }
-        getFirstParent(nonLeafNode->pageNoArray[i]);
+    if (highest) {
+        PageId pageNum = findEdgeLeaf<T>(true);
+        bufMgr->readPage(file, pageNum, page);
+        readLeafEntries(page, leaf, false);
+        if (leaf.numEntries > 0)
+            memcpy(stats.maxKey, &leaf.keyArray[leaf.numEntries - 1], sizeof(T));
+        bufMgr->unPinPage(file, pageNum, false);
     }
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::scanNext
+// BTreeIndex::readLeafEntries
 // -----------------------------------------------------------------------------
-void BTreeIndex::scanNext(RecordId& outRid)
+template <class T>
+bool BTreeIndex::readLeafEntries(const Page* page, LeafEntries<T>& entries, bool copy)
 {
-    /* Check if scan has started */
-    if (!scanExecuting)
-        throw ScanNotInitializedException();
-
-    /* Keep track of node */
-    auto currentNode = (LeafNodeInt*)currentPageData;
+    auto leaf = (const LeafNode<T>*)page;
+    entries.rightSibPageNo = leaf->rightSibPageNo;
+    entries.leftSibPageNo = leaf->leftSibPageNo;
+    entries.highKey = leaf->highKey;
 
-    /* Look for rid of next matching tuple */
-    while (true) {
-        /* Validate index of entry */
-        if (nextEntry == INTARRAYLEAFSIZE) {
-            /* Unpin page since no more entries to be scanned on this leaf page */
-            try {
-                bufMgr->unPinPage(file, currentPageNum, false);
-            }
-            catch (PageNotPinnedException& e) {
-            }
+    if (leafFormat == COMPRESSED_LEAVES) {
+        entries.keyBuffer.resize(COMPRESSEDLEAFSIZE);
+        entries.ridBuffer.resize(COMPRESSEDLEAFSIZE);
+        if (!LeafCodec<T>::decode((const CompressedLeafNode*)page, entries.keyBuffer.data(), entries.ridBuffer.data(),
+                                  entries.numEntries))
+            return false;
+        entries.keyArray = entries.keyBuffer.data();
+        entries.ridArray = entries.ridBuffer.data();
+        return true;
+    }
 
-            PageId rightSibPageNo = currentNode->rightSibPageNo;
+    int count = leaf->numEntries;
+    entries.numEntries = count;
+    if (copy) {
+        entries.keyBuffer.assign(leaf->keyArray, leaf->keyArray + count);
+        entries.ridBuffer.assign(leaf->ridArray, leaf->ridArray + count);
+        entries.keyArray = entries.keyBuffer.data();
+        entries.ridArray = entries.ridBuffer.data();
+    }
+    else {
+        entries.keyArray = leaf->keyArray;
+        entries.ridArray = leaf->ridArray;
+    }
+    return true;
+}
 
-            /* Check that the right sibling is a valid leaf page */
-            if (rightSibPageNo == Page::INVALID_NUMBER)
-                /* trhow new completed */
-                throw IndexScanCompletedException();
+// -----------------------------------------------------------------------------
+// BTreeIndex::leafHasRoom
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::leafHasRoom(const Page* page, const T& key, const RecordId& rid)
+{
+    if (leafFormat == COMPRESSED_LEAVES)
+        return LeafCodec<T>::hasRoom((const CompressedLeafNode*)page, key, rid);
+    return ((const LeafNode<T>*)page)->numEntries < NodeSize<T>::LEAF;
+}
 
-            /* Update the parameters for the index since page is invalid */
-            nextEntry = 0;
-            currentPageNum = rightSibPageNo;
-            bufMgr->readPage(file, currentPageNum, currentPageData);
-            currentNode = (LeafNodeInt*)currentPageData;
-        }
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertIntoCompressedLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+PageId BTreeIndex::insertIntoCompressedLeaf(PageId pageNum, Page* page, T& key, const RecordId rid)
+{
+    auto leaf = (CompressedLeafNode*)page;
+    std::vector<T> keys(COMPRESSEDLEAFSIZE + 1);
+    std::vector<RecordId> rids(COMPRESSEDLEAFSIZE + 1);
+    int count;
+    LeafCodec<T>::decode(leaf, keys.data(), rids.data(), count);
 
-        if (currentNode->ridArray[nextEntry].page_number == Page::INVALID_NUMBER) {
-            nextEntry = INTARRAYLEAFSIZE;
-            continue;
-        }
+    /* The pair goes ahead of any equal keys, like in insertKeyInLeafNode */
+    int idx = nodeLowerBound(keys.data(), count, key);
+    std::copy_backward(keys.begin() + idx, keys.begin() + count, keys.begin() + count + 1);
+    std::copy_backward(rids.begin() + idx, rids.begin() + count, rids.begin() + count + 1);
+    keys[idx] = key;
+    rids[idx] = rid;
+    count++;
 
-        /* Check lower limit of scan with entry key */
-        if ((lowOp == GT && currentNode->keyArray[nextEntry] <= lowValInt) || (lowOp == GTE && currentNode->keyArray[nextEntry] < lowValInt)) {
-            nextEntry++;
-            continue;
-        }
+    if (LeafCodec<T>::encode(leaf, keys.data(), rids.data(), count))
+        return Page::INVALID_NUMBER;
 
-        /* Check upper limit of scan with entry key */
-        if ((highOp == LT && currentNode->keyArray[nextEntry] >= highValInt)
-            || (highOp == LTE && currentNode->keyArray[nextEntry] > highValInt))
-            throw IndexScanCompletedException();
+    Page* newPage;
+    PageId newPageNum;
+    allocNodePage(newPageNum, newPage);
+    auto newLeaf = (CompressedLeafNode*)newPage;
+    newLeaf->version = 0;
 
-        break;
+    /* Split where the policy says, in append mode a key past the end of the right-most leaf goes to the new leaf alone.
+       A split point that leaves either half too wide to fit falls back to an even split, whose halves always fit. */
+    int midIdx = splitPolicy.splitPoint(count, idx);
+    if (appendMode && leaf->rightSibPageNo == Page::INVALID_NUMBER && idx == count - 1)
+        midIdx = count - 1;
+    if (!LeafCodec<T>::encode(newLeaf, keys.data() + midIdx, rids.data() + midIdx, count - midIdx)
+        || !LeafCodec<T>::encode(leaf, keys.data(), rids.data(), midIdx)) {
+        midIdx = count / 2;
+        LeafCodec<T>::encode(newLeaf, keys.data() + midIdx, rids.data() + midIdx, count - midIdx);
+        LeafCodec<T>::encode(leaf, keys.data(), rids.data(), midIdx);
     }
 
-    /* Return  entry rid */
-    outRid = currentNode->ridArray[nextEntry];
+    /* Link the new leaf in on the right, as in splitLeafNode */
+    newLeaf->rightSibPageNo = leaf->rightSibPageNo;
+    newLeaf->leftSibPageNo = pageNum;
+    newLeaf->highKey = leaf->highKey;
+    if (leaf->rightSibPageNo != Page::INVALID_NUMBER)
+        setLeftSibling<T>(leaf->rightSibPageNo, newPageNum);
+    leaf->rightSibPageNo = newPageNum;
+    ((LeafNode<T>*)page)->highKey = keys[midIdx];
 
-    /* update index of next entry */
-    nextEntry++;
+    key = keys[midIdx];
+    bufMgr->unPinPage(file, newPageNum, true);
+    return newPageNum;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::endScan
+// BTreeIndex::removeFromCompressedLeaf
 // -----------------------------------------------------------------------------
-//
-void BTreeIndex::endScan()
+template <class T>
+void BTreeIndex::removeFromCompressedLeaf(Page* page, int entryIdx)
 {
-    /* check scan */
-    if (!scanExecuting)
-        throw ScanNotInitializedException();
+    auto leaf = (CompressedLeafNode*)page;
+    std::vector<T> keys(COMPRESSEDLEAFSIZE);
+    std::vector<RecordId> rids(COMPRESSEDLEAFSIZE);
+    int count;
+    LeafCodec<T>::decode(leaf, keys.data(), rids.data(), count);
 
-    /* End scan */
-    scanExecuting = false;
+    /* Fewer entries never need more bits, so the rest always fits */
+    keys.erase(keys.begin() + entryIdx);
+    rids.erase(rids.begin() + entryIdx);
+    LeafCodec<T>::encode(leaf, keys.data(), rids.data(), count - 1);
+}
 
-    /* Unpin the pages that are currently pinned */
-    try {
-        bufMgr->unPinPage(file, currentPageNum, false);
-    }
-    catch (PageNotPinnedException& e) {
-    }
-    catch (HashNotFoundException& e) {
-    }
+// -----------------------------------------------------------------------------
+// BTreeIndex::mergeCompressedLeaves
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::mergeCompressedLeaves(Page* leftPage, Page* rightPage)
+{
+    auto left = (CompressedLeafNode*)leftPage;
+    auto right = (CompressedLeafNode*)rightPage;
+    std::vector<T> keys(2 * COMPRESSEDLEAFSIZE);
+    std::vector<RecordId> rids(2 * COMPRESSEDLEAFSIZE);
+    int leftCount, rightCount;
+    LeafCodec<T>::decode(left, keys.data(), rids.data(), leftCount);
+    LeafCodec<T>::decode(right, keys.data() + leftCount, rids.data() + leftCount, rightCount);
+
+    if (!LeafCodec<T>::encode(left, keys.data(), rids.data(), leftCount + rightCount))
+        return false;
+    left->rightSibPageNo = right->rightSibPageNo;
+    left->highKey = right->highKey;
+    return true;
 }
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::addToPostingList
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::addToPostingList(LeafNode<T>* leaf, const T& key, const RecordId rid)
+{
+    if (leafFormat != POSTING_LIST_LEAVES)
+        return false;
+
+    /* The record id joins the posting list of the key if the run of the key in this leaf has one */
+    int count = leaf->numEntries;
+    int first = nodeLowerBound(leaf->keyArray, count, key);
+    int last = first;
+    for (; last < count && leaf->keyArray[last] == key; last++) {
+        if (isPostingList(leaf->ridArray[last])) {
+            insertIntoPostingList(leaf->ridArray[last].page_number, rid);
+            return true;
+        }
+    }
+
+    /* Otherwise a run that would fill half a leaf becomes a posting list */
+    int runLength = last - first;
+    if (runLength + 1 < NodeSize<T>::LEAF / 2)
+        return false;
+
+    std::vector<RecordId> rids(leaf->ridArray + first, leaf->ridArray + last);
+    rids.push_back(rid);
+    std::sort(rids.begin(), rids.end(), ridLess);
+    RecordId postingRid;
+    postingRid.page_number = createPostingList(rids.data(), rids.size());
+    postingRid.slot_number = Page::INVALID_SLOT;
+
+    /* The list is complete before the leaf refers to it, the run shrinks to its first entry */
+    leaf->ridArray[first] = postingRid;
+    std::copy(leaf->keyArray + last, leaf->keyArray + count, leaf->keyArray + first + 1);
+    std::copy(leaf->ridArray + last, leaf->ridArray + count, leaf->ridArray + first + 1);
+    leaf->numEntries = count - runLength + 1;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::packPostingLists
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::packPostingLists(std::vector<RIDKeyPair<T> >& entries)
+{
+    if (leafFormat != POSTING_LIST_LEAVES)
+        return;
+
+    /* Same threshold as addToPostingList, runs of the sorted entries are compacted in place */
+    const size_t minRun = NodeSize<T>::LEAF / 2;
+    std::vector<RecordId> rids;
+    size_t numEntries = 0;
+    size_t end;
+    for (size_t begin = 0; begin < entries.size(); begin = end) {
+        for (end = begin + 1; end < entries.size() && entries[end].key == entries[begin].key; end++)
+            ;
+
+        if (end - begin < minRun) {
+            for (size_t i = begin; i < end; i++)
+                entries[numEntries++] = entries[i];
+            continue;
+        }
+
+        rids.clear();
+        for (size_t i = begin; i < end; i++)
+            rids.push_back(entries[i].rid);
+        std::sort(rids.begin(), rids.end(), ridLess);
+
+        RecordId postingRid;
+        postingRid.page_number = createPostingList(rids.data(), rids.size());
+        postingRid.slot_number = Page::INVALID_SLOT;
+        entries[numEntries++].set(postingRid, entries[begin].key);
+    }
+    entries.resize(numEntries);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::createPostingList
+// -----------------------------------------------------------------------------
+PageId BTreeIndex::createPostingList(const RecordId* rids, int count)
+{
+    PageId headPageNum = Page::INVALID_NUMBER, prevPageNum = Page::INVALID_NUMBER;
+    PostingNode* prev = nullptr;
+
+    /* Fill the pages in order, each is linked from the one before once allocated */
+    for (int pos = 0; pos < count; pos += POSTINGARRAYSIZE) {
+        int numRids = std::min(count - pos, POSTINGARRAYSIZE);
+        Page* page;
+        PageId pageNum;
+        allocNodePage(pageNum, page);
+        auto posting = (PostingNode*)page;
+        posting->version = 0;
+        posting->numRids = numRids;
+        posting->nextPageNo = Page::INVALID_NUMBER;
+        std::copy(rids + pos, rids + pos + numRids, posting->ridArray);
+
+        if (prev != nullptr) {
+            prev->nextPageNo = pageNum;
+            bufMgr->unPinPage(file, prevPageNum, true);
+        }
+        else {
+            headPageNum = pageNum;
+        }
+        prev = posting;
+        prevPageNum = pageNum;
+    }
+    bufMgr->unPinPage(file, prevPageNum, true);
+
+    return headPageNum;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertIntoPostingList
+// -----------------------------------------------------------------------------
+void BTreeIndex::insertIntoPostingList(PageId headPageNum, const RecordId& rid)
+{
+    /* The record id goes into the last page whose first record id is not above it */
+    PageId pageNum = headPageNum;
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    auto posting = (PostingNode*)page;
+    while (posting->nextPageNo != Page::INVALID_NUMBER) {
+        PageId nextPageNum = posting->nextPageNo;
+        Page* nextPage;
+        bufMgr->readPage(file, nextPageNum, nextPage);
+        auto next = (PostingNode*)nextPage;
+        if (ridLess(rid, next->ridArray[0])) {
+            bufMgr->unPinPage(file, nextPageNum, false);
+            break;
+        }
+        bufMgr->unPinPage(file, pageNum, false);
+        pageNum = nextPageNum;
+        posting = next;
+    }
+
+    int count = posting->numRids;
+    int pos = std::upper_bound(posting->ridArray, posting->ridArray + count, rid, ridLess) - posting->ridArray;
+    if (count < POSTINGARRAYSIZE) {
+        NodeWriteGuard guard(posting->version);
+        std::copy_backward(posting->ridArray + pos, posting->ridArray + count, posting->ridArray + count + 1);
+        posting->ridArray[pos] = rid;
+        posting->numRids = count + 1;
+        bufMgr->unPinPage(file, pageNum, true);
+        return;
+    }
+
+    /* Split a full page, the upper half moves to a new page linked after it once that is complete */
+    Page* newPage;
+    PageId newPageNum;
+    allocNodePage(newPageNum, newPage);
+    auto newPosting = (PostingNode*)newPage;
+    int half = (count + 1) / 2;
+    newPosting->version = 0;
+    newPosting->numRids = count - half;
+    newPosting->nextPageNo = posting->nextPageNo;
+    std::copy(posting->ridArray + half, posting->ridArray + count, newPosting->ridArray);
+    if (pos > half) {
+        int newPos = pos - half;
+        std::copy_backward(newPosting->ridArray + newPos, newPosting->ridArray + newPosting->numRids,
+                           newPosting->ridArray + newPosting->numRids + 1);
+        newPosting->ridArray[newPos] = rid;
+        newPosting->numRids++;
+    }
+
+    {
+        NodeWriteGuard guard(posting->version);
+        posting->numRids = half;
+        if (pos <= half) {
+            std::copy_backward(posting->ridArray + pos, posting->ridArray + half, posting->ridArray + half + 1);
+            posting->ridArray[pos] = rid;
+            posting->numRids = half + 1;
+        }
+        posting->nextPageNo = newPageNum;
+    }
+    bufMgr->unPinPage(file, newPageNum, true);
+    bufMgr->unPinPage(file, pageNum, true);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::removeFromPostingList
+// -----------------------------------------------------------------------------
+bool BTreeIndex::removeFromPostingList(PageId headPageNum, const RecordId& rid)
+{
+    PageId prevPageNum = Page::INVALID_NUMBER, pageNum = headPageNum;
+    while (pageNum != Page::INVALID_NUMBER) {
+        Page* page;
+        bufMgr->readPage(file, pageNum, page);
+        auto posting = (PostingNode*)page;
+        int count = posting->numRids;
+        int i = std::lower_bound(posting->ridArray, posting->ridArray + count, rid, ridLess) - posting->ridArray;
+        if (i == count || posting->ridArray[i] != rid) {
+            PageId nextPageNum = posting->nextPageNo;
+            bufMgr->unPinPage(file, pageNum, false);
+            prevPageNum = pageNum;
+            pageNum = nextPageNum;
+            continue;
+        }
+
+        std::copy(posting->ridArray + i + 1, posting->ridArray + count, posting->ridArray + i);
+        posting->numRids = count - 1;
+        if (count > 1) {
+            bufMgr->unPinPage(file, pageNum, true);
+            return true;
+        }
+
+        /* The page is left empty. A later page is unlinked, the first one takes over the page after it, which
+           keeps the page number the leaf refers to. */
+        PageId nextPageNum = posting->nextPageNo;
+        if (prevPageNum != Page::INVALID_NUMBER) {
+            bufMgr->unPinPage(file, pageNum, true);
+            Page* prevPage;
+            bufMgr->readPage(file, prevPageNum, prevPage);
+            ((PostingNode*)prevPage)->nextPageNo = nextPageNum;
+            bufMgr->unPinPage(file, prevPageNum, true);
+            freeNodePage(pageNum);
+            return true;
+        }
+        if (nextPageNum != Page::INVALID_NUMBER) {
+            Page* nextPage;
+            bufMgr->readPage(file, nextPageNum, nextPage);
+            auto next = (PostingNode*)nextPage;
+            posting->numRids = next->numRids;
+            posting->nextPageNo = next->nextPageNo;
+            std::copy(next->ridArray, next->ridArray + next->numRids, posting->ridArray);
+            bufMgr->unPinPage(file, nextPageNum, false);
+            bufMgr->unPinPage(file, pageNum, true);
+            freeNodePage(nextPageNum);
+            return true;
+        }
+        bufMgr->unPinPage(file, pageNum, true);
+        freeNodePage(pageNum);
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::postingListContains
+// -----------------------------------------------------------------------------
+bool BTreeIndex::postingListContains(PageId headPageNum, const RecordId& rid)
+{
+    PageId pageNum = headPageNum;
+    while (pageNum != Page::INVALID_NUMBER) {
+        Page* page;
+        bufMgr->readPage(file, pageNum, page);
+        auto posting = (PostingNode*)page;
+        bool found = std::binary_search(posting->ridArray, posting->ridArray + posting->numRids, rid, ridLess);
+        PageId nextPageNum = posting->nextPageNo;
+        bufMgr->unPinPage(file, pageNum, false);
+        if (found)
+            return true;
+        pageNum = nextPageNum;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readPostingList
+// -----------------------------------------------------------------------------
+void BTreeIndex::readPostingList(PageId headPageNum, std::vector<RecordId>& outRids)
+{
+    PageId pageNum = headPageNum;
+    while (pageNum != Page::INVALID_NUMBER) {
+        Page* page;
+        bufMgr->readPage(file, pageNum, page);
+        auto posting = (PostingNode*)page;
+
+        /* Readers without latches drop what they copied from a page a writer changed meanwhile */
+        size_t size = outRids.size();
+        unsigned int version = posting->version.load(std::memory_order_acquire);
+        outRids.insert(outRids.end(), posting->ridArray, posting->ridArray + posting->numRids);
+        PageId nextPageNum = posting->nextPageNo;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool consistent = (version & 1) == 0 && posting->version.load(std::memory_order_relaxed) == version;
+        bufMgr->unPinPage(file, pageNum, false);
+
+        if (!consistent) {
+            outRids.resize(size);
+            std::this_thread::yield();
+            continue;
+        }
+        pageNum = nextPageNum;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::expandPostingLists
+// -----------------------------------------------------------------------------
+void BTreeIndex::expandPostingLists(std::vector<RecordId>& rids, size_t from)
+{
+    size_t first = from;
+    while (first < rids.size() && !isPostingList(rids[first]))
+        first++;
+    if (first == rids.size())
+        return;
+
+    std::vector<RecordId> expanded;
+    for (size_t i = first; i < rids.size(); i++) {
+        if (isPostingList(rids[i]))
+            readPostingList(rids[i].page_number, expanded);
+        else
+            expanded.push_back(rids[i]);
+    }
+    rids.resize(first);
+    rids.insert(rids.end(), expanded.begin(), expanded.end());
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::findEdgeLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+PageId BTreeIndex::findEdgeLeaf(bool rightmost)
+{
+    PageId pageNum = rootPageNum;
+    Page* page;
+
+    while (true) {
+        bufMgr->readPage(file, pageNum, page);
+        auto node = (NonLeafNode<T>*)page;
+        PageId childPageNum = node->pageNoArray[rightmost ? node->numKeys : 0];
+        int level = node->level;
+        bufMgr->unPinPage(file, pageNum, false);
+
+        if (level == 1 || childPageNum == Page::INVALID_NUMBER)
+            return childPageNum;
+        pageNum = childPageNum;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::findLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+PageId BTreeIndex::findLeaf(const T& key)
+{
+    PageId pageNum = rootPageNum;
+    Page* page;
+
+    while (true) {
+        bufMgr->readPage(file, pageNum, page);
+        auto node = (NonLeafNode<T>*)page;
+
+        /* Same child choice as insertEntry, the first child whose separator is not below the key */
+        int idx = nodeLowerBound(node->keyArray, node->numKeys, key);
+
+        PageId childPageNum = node->pageNoArray[idx];
+        int level = node->level;
+        bufMgr->unPinPage(file, pageNum, false);
+
+        if (level == 1 || childPageNum == Page::INVALID_NUMBER)
+            return childPageNum;
+        pageNum = childPageNum;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::findEntryLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::findEntryLeaf(PageId pageNum, const T& key, const RecordId& rid,
+                               std::stack<std::pair<PageId, int> >& path, PageId& leafPageNum, int& entryIdx)
+{
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    auto node = (NonLeafNode<T>*)page;
+
+    if (node->pageNoArray[0] == Page::INVALID_NUMBER) {
+        bufMgr->unPinPage(file, pageNum, false);
+        return false;
+    }
+
+    /* Duplicates of the key may span every child from the first one whose separator is
+       not below the key up to the last one whose range starts at the key */
+    int numKeys = node->numKeys;
+    int first = nodeLowerBound(node->keyArray, numKeys, key);
+    int last = first + nodeUpperBound(node->keyArray + first, numKeys - first, key);
+
+    int level = node->level;
+    std::vector<PageId> children(node->pageNoArray + first, node->pageNoArray + last + 1);
+    bufMgr->unPinPage(file, pageNum, false);
+
+    for (int c = first; c <= last; c++) {
+        path.push(std::make_pair(pageNum, c));
+        PageId childPageNum = children[c - first];
+
+        if (level != 1) {
+            if (findEntryLeaf(childPageNum, key, rid, path, leafPageNum, entryIdx))
+                return true;
+        }
+        else {
+            bufMgr->readPage(file, childPageNum, page);
+            LeafEntries<T> leaf;
+            readLeafEntries(page, leaf, false);
+            int count = leaf.numEntries;
+            int i = nodeLowerBound(leaf.keyArray, count, key);
+            while (i < count && leaf.keyArray[i] == key && leaf.ridArray[i] != rid
+                && !(isPostingList(leaf.ridArray[i]) && postingListContains(leaf.ridArray[i].page_number, rid)))
+                i++;
+            bool found = i < count && leaf.keyArray[i] == key;
+            bufMgr->unPinPage(file, childPageNum, false);
+
+            if (found) {
+                leafPageNum = childPageNum;
+                entryIdx = i;
+                return true;
+            }
+        }
+        path.pop();
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteEntry
+// -----------------------------------------------------------------------------
+void BTreeIndex::deleteEntry(const void* key, const RecordId rid)
+{
+    try {
+        scan.endScan();
+    }
+    catch (ScanNotInitializedException& e) {
+    }
+
+    TreeLatchGuard guard(&treeLatch, true);
+    switch (attributeType) {
+    case INTEGER:
+        deleteEntryTyped(readKey<int>(key), rid);
+        break;
+    case DOUBLE:
+        deleteEntryTyped(readKey<double>(key), rid);
+        break;
+    case STRING:
+        deleteEntryTyped(readKey<StringKey>(key), rid);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteEntryTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::deleteEntryTyped(const T& key, const RecordId rid)
+{
+    std::stack<std::pair<PageId, int> > path;
+    PageId leafPageNum;
+    int entryIdx;
+    Page* page;
+
+    /* Merges may free the last leaf, the next insert reaching the right edge caches it again */
+    countAppends<T>();
+    appendLeafPageNum = Page::INVALID_NUMBER;
+
+    if (!findEntryLeaf(rootPageNum, key, rid, path, leafPageNum, entryIdx))
+        throw NoSuchKeyFoundException();
+
+    /* The entry leaves the counts of every node above it */
+    for (std::stack<std::pair<PageId, int> > nodes = path; !nodes.empty(); nodes.pop()) {
+        bufMgr->readPage(file, nodes.top().first, page);
+        ((NonLeafNode<T>*)page)->countArray[nodes.top().second]--;
+        bufMgr->unPinPage(file, nodes.top().first, true);
+    }
+
+    bufMgr->readPage(file, leafPageNum, page);
+    auto leaf = (LeafNode<T>*)page;
+    int count = leaf->numEntries;
+
+    if (leafFormat == COMPRESSED_LEAVES) {
+        removeFromCompressedLeaf<T>(page, entryIdx);
+    }
+    else {
+        /* A record id in a posting list leaves the list, the entry of the list goes only once the list is empty */
+        RecordId entryRid = leaf->ridArray[entryIdx];
+        if (isPostingList(entryRid) && removeFromPostingList(entryRid.page_number, rid)) {
+            bufMgr->unPinPage(file, leafPageNum, false);
+            countDelete(key);
+            return;
+        }
+
+        /* Remove the entry and shift the ones after it left */
+        std::copy(leaf->keyArray + entryIdx + 1, leaf->keyArray + count, leaf->keyArray + entryIdx);
+        std::copy(leaf->ridArray + entryIdx + 1, leaf->ridArray + count, leaf->ridArray + entryIdx);
+        leaf->numEntries = count - 1;
+    }
+    bufMgr->unPinPage(file, leafPageNum, true);
+
+    /* Rebalance upwards while nodes are left underfull, a compressed leaf below a quarter of the entries it can hold */
+    int minEntries = leafFormat == COMPRESSED_LEAVES ? COMPRESSEDLEAFSIZE / 4 : NodeSize<T>::LEAF / 2;
+    bool underfull = count - 1 < minEntries;
+    bool isLeaf = true;
+    while (underfull && !path.empty()) {
+        PageId parentPageNum = path.top().first;
+        int childIdx = path.top().second;
+        path.pop();
+
+        if (isLeaf)
+            underfull = rebalanceLeaf<T>(parentPageNum, childIdx);
+        else
+            underfull = rebalanceNonLeaf<T>(parentPageNum, childIdx);
+        isLeaf = false;
+    }
+
+    collapseRoot<T>();
+    countDelete(key);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::rebalanceLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::rebalanceLeaf(PageId parentPageNum, int childIdx)
+{
+    Page *parentPage, *leftPage, *rightPage;
+    bufMgr->readPage(file, parentPageNum, parentPage);
+    auto parent = (NonLeafNode<T>*)parentPage;
+
+    /* An only child has no sibling to balance against */
+    if (parent->numKeys == 0) {
+        bufMgr->unPinPage(file, parentPageNum, false);
+        return false;
+    }
+
+    /* Pair the child with its left sibling, or its right one if it is the first child */
+    int leftIdx = childIdx > 0 ? childIdx - 1 : childIdx;
+    PageId leftPageNum = parent->pageNoArray[leftIdx];
+    PageId rightPageNum = parent->pageNoArray[leftIdx + 1];
+    bufMgr->readPage(file, leftPageNum, leftPage);
+    bufMgr->readPage(file, rightPageNum, rightPage);
+    auto left = (LeafNode<T>*)leftPage;
+    auto right = (LeafNode<T>*)rightPage;
+    int leftCount = left->numEntries;
+    int rightCount = right->numEntries;
+
+    if (leafFormat == COMPRESSED_LEAVES) {
+        /* Compressed leaves are merged when their entries fit in one and left alone otherwise, since moving
+           entries between them may widen the coding of either until it no longer fits */
+        bool merged = mergeCompressedLeaves<T>(leftPage, rightPage);
+        PageId nextPageNum = left->rightSibPageNo;
+        bufMgr->unPinPage(file, leftPageNum, merged);
+        bufMgr->unPinPage(file, rightPageNum, false);
+        if (!merged) {
+            bufMgr->unPinPage(file, parentPageNum, false);
+            return false;
+        }
+        if (nextPageNum != Page::INVALID_NUMBER)
+            setLeftSibling<T>(nextPageNum, leftPageNum);
+        freeNodePage(rightPageNum);
+        removeNonLeafEntry(parent, leftIdx);
+        countShapeChange(-1, 0);
+    }
+    else if (leftCount + rightCount <= NodeSize<T>::LEAF) {
+        /* Merge the right leaf into the left one and drop it from the parent */
+        for (int i = 0; i < rightCount; i++) {
+            left->keyArray[leftCount + i] = right->keyArray[i];
+            left->ridArray[leftCount + i] = right->ridArray[i];
+        }
+        left->numEntries = leftCount + rightCount;
+        left->rightSibPageNo = right->rightSibPageNo;
+        left->highKey = right->highKey;
+        if (left->rightSibPageNo != Page::INVALID_NUMBER)
+            setLeftSibling<T>(left->rightSibPageNo, leftPageNum);
+
+        bufMgr->unPinPage(file, leftPageNum, true);
+        bufMgr->unPinPage(file, rightPageNum, false);
+        freeNodePage(rightPageNum);
+        removeNonLeafEntry(parent, leftIdx);
+        countShapeChange(-1, 0);
+    }
+    else {
+        /* Even out the entries of the two leaves */
+        int total = leftCount + rightCount, newLeftCount = total / 2;
+        if (leftCount > newLeftCount) {
+            int moved = leftCount - newLeftCount;
+            for (int i = rightCount - 1; i >= 0; i--) {
+                right->keyArray[i + moved] = right->keyArray[i];
+                right->ridArray[i + moved] = right->ridArray[i];
+            }
+            for (int i = 0; i < moved; i++) {
+                right->keyArray[i] = left->keyArray[newLeftCount + i];
+                right->ridArray[i] = left->ridArray[newLeftCount + i];
+            }
+        }
+        else {
+            int moved = newLeftCount - leftCount;
+            for (int i = 0; i < moved; i++) {
+                left->keyArray[leftCount + i] = right->keyArray[i];
+                left->ridArray[leftCount + i] = right->ridArray[i];
+            }
+            for (int i = moved; i < rightCount; i++) {
+                right->keyArray[i - moved] = right->keyArray[i];
+                right->ridArray[i - moved] = right->ridArray[i];
+            }
+        }
+        left->numEntries = newLeftCount;
+        right->numEntries = total - newLeftCount;
+        parent->keyArray[leftIdx] = right->keyArray[0];
+        left->highKey = right->keyArray[0];
+
+        int pairCount = parent->countArray[leftIdx] + parent->countArray[leftIdx + 1];
+        parent->countArray[leftIdx] = subtreeCount<T>(leftPageNum, true);
+        parent->countArray[leftIdx + 1] = pairCount - parent->countArray[leftIdx];
+
+        bufMgr->unPinPage(file, leftPageNum, true);
+        bufMgr->unPinPage(file, rightPageNum, true);
+    }
+
+    bool underfull = parentPageNum != rootPageNum && parent->numKeys < NodeSize<T>::NONLEAF / 2;
+    bufMgr->unPinPage(file, parentPageNum, true);
+    return underfull;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::rebalanceNonLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::rebalanceNonLeaf(PageId parentPageNum, int childIdx)
+{
+    const int size = NodeSize<T>::NONLEAF;
+
+    Page *parentPage, *leftPage, *rightPage;
+    bufMgr->readPage(file, parentPageNum, parentPage);
+    auto parent = (NonLeafNode<T>*)parentPage;
+
+    /* An only child has no sibling to balance against */
+    if (parent->numKeys == 0) {
+        bufMgr->unPinPage(file, parentPageNum, false);
+        return false;
+    }
+
+    /* Pair the child with its left sibling, or its right one if it is the first child */
+    int leftIdx = childIdx > 0 ? childIdx - 1 : childIdx;
+    PageId leftPageNum = parent->pageNoArray[leftIdx];
+    PageId rightPageNum = parent->pageNoArray[leftIdx + 1];
+    bufMgr->readPage(file, leftPageNum, leftPage);
+    bufMgr->readPage(file, rightPageNum, rightPage);
+    auto left = (NonLeafNode<T>*)leftPage;
+    auto right = (NonLeafNode<T>*)rightPage;
+    int leftKeys = left->numKeys;
+    int rightKeys = right->numKeys;
+
+    if (leftKeys + rightKeys + 1 <= size) {
+        /* Merge the separator and the right node into the left one and drop it from the parent */
+        left->keyArray[leftKeys] = parent->keyArray[leftIdx];
+        left->pageNoArray[leftKeys + 1] = right->pageNoArray[0];
+        left->countArray[leftKeys + 1] = right->countArray[0];
+        for (int i = 0; i < rightKeys; i++) {
+            left->keyArray[leftKeys + 1 + i] = right->keyArray[i];
+            left->pageNoArray[leftKeys + 2 + i] = right->pageNoArray[i + 1];
+            left->countArray[leftKeys + 2 + i] = right->countArray[i + 1];
+        }
+        left->numKeys = leftKeys + rightKeys + 1;
+        left->rightSibPageNo = right->rightSibPageNo;
+        left->highKey = right->highKey;
+
+        bufMgr->unPinPage(file, leftPageNum, true);
+        bufMgr->unPinPage(file, rightPageNum, false);
+        freeNodePage(rightPageNum);
+        removeNonLeafEntry(parent, leftIdx);
+    }
+    else {
+        /* Even out the keys through the parent: line up both nodes with the separator between them */
+        int total = leftKeys + rightKeys + 1, i;
+        std::vector<T> keyArr(total);
+        std::vector<PageId> pageNoArr(total + 1);
+        std::vector<int> countArr(total + 1);
+
+        for (i = 0; i <= leftKeys; i++) {
+            pageNoArr[i] = left->pageNoArray[i];
+            countArr[i] = left->countArray[i];
+        }
+        for (i = 0; i < leftKeys; i++)
+            keyArr[i] = left->keyArray[i];
+        keyArr[leftKeys] = parent->keyArray[leftIdx];
+        for (i = 0; i < rightKeys; i++)
+            keyArr[leftKeys + 1 + i] = right->keyArray[i];
+        for (i = 0; i <= rightKeys; i++) {
+            pageNoArr[leftKeys + 1 + i] = right->pageNoArray[i];
+            countArr[leftKeys + 1 + i] = right->countArray[i];
+        }
+
+        /* The key after the new left half moves up to the parent */
+        int newLeftKeys = (total - 1) / 2;
+        for (i = 0; i < newLeftKeys; i++)
+            left->keyArray[i] = keyArr[i];
+        std::copy(pageNoArr.begin(), pageNoArr.begin() + newLeftKeys + 1, left->pageNoArray);
+        std::copy(countArr.begin(), countArr.begin() + newLeftKeys + 1, left->countArray);
+        left->numKeys = newLeftKeys;
+
+        parent->keyArray[leftIdx] = keyArr[newLeftKeys];
+        left->highKey = keyArr[newLeftKeys];
+
+        int newRightKeys = total - 1 - newLeftKeys;
+        for (i = 0; i < newRightKeys; i++)
+            right->keyArray[i] = keyArr[newLeftKeys + 1 + i];
+        std::copy(pageNoArr.begin() + newLeftKeys + 1, pageNoArr.end(), right->pageNoArray);
+        std::copy(countArr.begin() + newLeftKeys + 1, countArr.end(), right->countArray);
+        right->numKeys = newRightKeys;
+
+        int pairCount = parent->countArray[leftIdx] + parent->countArray[leftIdx + 1];
+        parent->countArray[leftIdx] = std::accumulate(countArr.begin(), countArr.begin() + newLeftKeys + 1, 0);
+        parent->countArray[leftIdx + 1] = pairCount - parent->countArray[leftIdx];
+
+        bufMgr->unPinPage(file, leftPageNum, true);
+        bufMgr->unPinPage(file, rightPageNum, true);
+    }
+
+    bool underfull = parentPageNum != rootPageNum && parent->numKeys < size / 2;
+    bufMgr->unPinPage(file, parentPageNum, true);
+    return underfull;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::removeNonLeafEntry
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::removeNonLeafEntry(NonLeafNode<T>* node, int keyIdx)
+{
+    int numKeys = node->numKeys;
+
+    /* The child on the left of the key took over the entries of the one removed */
+    node->countArray[keyIdx] += node->countArray[keyIdx + 1];
+    for (int i = keyIdx; i < numKeys - 1; i++) {
+        node->keyArray[i] = node->keyArray[i + 1];
+        node->pageNoArray[i + 1] = node->pageNoArray[i + 2];
+        node->countArray[i + 1] = node->countArray[i + 2];
+    }
+    node->numKeys = numKeys - 1;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::collapseRoot
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::collapseRoot()
+{
+    Page *rootPage, *childPage;
+    bufMgr->readPage(file, rootPageNum, rootPage);
+    auto root = (NonLeafNode<T>*)rootPage;
+
+    /* A root above leaves keeps its last leaf, an empty tree is a root with a single empty leaf */
+    int removedLevels = 0;
+    while (root->level == 0 && root->numKeys == 0) {
+        PageId childPageNum = root->pageNoArray[0];
+        bufMgr->readPage(file, childPageNum, childPage);
+        *rootPage = *childPage;
+        bufMgr->unPinPage(file, childPageNum, false);
+        freeNodePage(childPageNum);
+        removedLevels++;
+    }
+
+    bufMgr->unPinPage(file, rootPageNum, true);
+    if (removedLevels > 0)
+        countShapeChange(0, -removedLevels);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteRange
+// -----------------------------------------------------------------------------
+int BTreeIndex::deleteRange(const void* lowValParm,
+    const Operator lowOpParm,
+    const void* highValParm,
+    const Operator highOpParm)
+{
+    if ((lowOpParm != GT && lowOpParm != GTE) || (highOpParm != LT && highOpParm != LTE)) {
+        throw BadOpcodesException();
+    }
+
+    try {
+        scan.endScan();
+    }
+    catch (ScanNotInitializedException& e) {
+    }
+
+    TreeLatchGuard guard(&treeLatch, true);
+    switch (attributeType) {
+    case INTEGER:
+        return deleteRangeTyped<int>(lowValParm, lowOpParm, highValParm, highOpParm);
+    case DOUBLE:
+        return deleteRangeTyped<double>(lowValParm, lowOpParm, highValParm, highOpParm);
+    case STRING:
+        return deleteRangeTyped<StringKey>(lowValParm, lowOpParm, highValParm, highOpParm);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteRangeTyped
+// -----------------------------------------------------------------------------
+template <class T>
+int BTreeIndex::deleteRangeTyped(const void* lowValParm, Operator lowOpParm, const void* highValParm, Operator highOpParm)
+{
+    T lowVal = readKey<T>(lowValParm);
+    T highVal = readKey<T>(highValParm);
+
+    if (lowVal > highVal)
+        throw BadScanrangeException();
+
+    /* Merges may free the last leaf, like in deleteEntryTyped() */
+    countAppends<T>();
+    appendLeafPageNum = Page::INVALID_NUMBER;
+
+    long long removed = deleteRangeInNode(rootPageNum, lowVal, lowOpParm, highVal, highOpParm);
+    collapseRoot<T>();
+    countDeleteRange(lowVal, lowOpParm, highVal, highOpParm, removed);
+    return (int)removed;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteRangeInNode
+// -----------------------------------------------------------------------------
+template <class T>
+long long BTreeIndex::deleteRangeInNode(PageId pageNum, const T& lowVal, Operator lowOp, const T& highVal, Operator highOp)
+{
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    auto node = (NonLeafNode<T>*)page;
+
+    if (node->pageNoArray[0] == Page::INVALID_NUMBER) {
+        bufMgr->unPinPage(file, pageNum, false);
+        return 0;
+    }
+
+    /* The children the range overlaps, bounded like a scan since duplicates of a bound may run over an equal separator */
+    int numKeys = node->numKeys;
+    int first = lowOp == GTE ? nodeLowerBound(node->keyArray, numKeys, lowVal) : nodeUpperBound(node->keyArray, numKeys, lowVal);
+    int last = highOp == LTE ? nodeUpperBound(node->keyArray, numKeys, highVal) : nodeLowerBound(node->keyArray, numKeys, highVal);
+    bool leafLevel = node->level == 1;
+
+    /* Each child is walked once, its count dropped once by all it lost */
+    long long removed = 0;
+    for (int c = first; c <= last; c++) {
+        PageId childPageNum = node->pageNoArray[c];
+        long long childRemoved = leafLevel ? deleteRangeInLeaf(childPageNum, lowVal, lowOp, highVal, highOp)
+                                           : deleteRangeInNode(childPageNum, lowVal, lowOp, highVal, highOp);
+        node->countArray[c] -= childRemoved;
+        removed += childRemoved;
+    }
+
+    /* Then the children left underfull are evened out with a sibling or merged into it, a child that took over a
+       sibling is looked at again since a run of emptied children merges one at a time */
+    int c = std::max(first - 1, 0);
+    last = std::min(last + 1, node->numKeys);
+    while (c <= last && node->numKeys > 0) {
+        int before = node->numKeys;
+        if (nodeUnderfull<T>(node->pageNoArray[c], leafLevel)) {
+            if (leafLevel)
+                rebalanceLeaf<T>(pageNum, c);
+            else
+                rebalanceNonLeaf<T>(pageNum, c);
+        }
+        if (node->numKeys < before) {
+            c = std::max(c - 1, 0);
+            last--;
+        }
+        else {
+            c++;
+        }
+    }
+
+    bufMgr->unPinPage(file, pageNum, true);
+    return removed;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteRangeInLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+long long BTreeIndex::deleteRangeInLeaf(PageId pageNum, const T& lowVal, Operator lowOp, const T& highVal, Operator highOp)
+{
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    LeafEntries<T> leaf;
+    readLeafEntries(page, leaf, false);
+    int count = leaf.numEntries;
+    int begin = lowOp == GTE ? nodeLowerBound(leaf.keyArray, count, lowVal) : nodeUpperBound(leaf.keyArray, count, lowVal);
+    int end = highOp == LTE ? nodeUpperBound(leaf.keyArray, count, highVal) : nodeLowerBound(leaf.keyArray, count, highVal);
+    if (begin >= end) {
+        bufMgr->unPinPage(file, pageNum, false);
+        return 0;
+    }
+
+    long long removed = 0;
+    for (int i = begin; i < end; i++)
+        removed += isPostingList(leaf.ridArray[i]) ? freePostingList(leaf.ridArray[i].page_number) : 1;
+
+    /* The entries after the run move left over it. Fewer entries of a compressed leaf never need more bits. */
+    if (leafFormat == COMPRESSED_LEAVES) {
+        std::copy(leaf.keyBuffer.begin() + end, leaf.keyBuffer.begin() + count, leaf.keyBuffer.begin() + begin);
+        std::copy(leaf.ridBuffer.begin() + end, leaf.ridBuffer.begin() + count, leaf.ridBuffer.begin() + begin);
+        LeafCodec<T>::encode((CompressedLeafNode*)page, leaf.keyBuffer.data(), leaf.ridBuffer.data(), count - (end - begin));
+    }
+    else {
+        auto node = (LeafNode<T>*)page;
+        std::copy(node->keyArray + end, node->keyArray + count, node->keyArray + begin);
+        std::copy(node->ridArray + end, node->ridArray + count, node->ridArray + begin);
+        node->numEntries = count - (end - begin);
+    }
+    bufMgr->unPinPage(file, pageNum, true);
+    return removed;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::nodeUnderfull
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::nodeUnderfull(PageId pageNum, bool leaf)
+{
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+    bool underfull;
+    if (leaf) {
+        LeafEntries<T> entries;
+        readLeafEntries(page, entries, false);
+        int minEntries = leafFormat == COMPRESSED_LEAVES ? COMPRESSEDLEAFSIZE / 4 : NodeSize<T>::LEAF / 2;
+        underfull = entries.numEntries < minEntries;
+    }
+    else {
+        underfull = ((NonLeafNode<T>*)page)->numKeys < NodeSize<T>::NONLEAF / 2;
+    }
+    bufMgr->unPinPage(file, pageNum, false);
+    return underfull;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::freePostingList
+// -----------------------------------------------------------------------------
+int BTreeIndex::freePostingList(PageId headPageNum)
+{
+    int count = 0;
+    PageId pageNum = headPageNum;
+    while (pageNum != Page::INVALID_NUMBER) {
+        Page* page;
+        bufMgr->readPage(file, pageNum, page);
+        auto posting = (PostingNode*)page;
+        count += posting->numRids;
+        PageId nextPageNum = posting->nextPageNo;
+        bufMgr->unPinPage(file, pageNum, false);
+        freeNodePage(pageNum);
+        pageNum = nextPageNum;
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookup
+// -----------------------------------------------------------------------------
+int BTreeIndex::lookup(const void* key, const std::function<void(const RecordId&)>& callback)
+{
+    std::vector<RecordId> rids;
+    int count = lookupAll(key, rids);
+    for (size_t i = 0; i < rids.size(); i++)
+        callback(rids[i]);
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupAll
+// -----------------------------------------------------------------------------
+int BTreeIndex::lookupAll(const void* key, std::vector<RecordId>& outRids)
+{
+    TreeLatchGuard guard(&treeLatch, false);
+    bool optimistic = concurrencyMode == BLINK;
+    switch (attributeType) {
+    case INTEGER: {
+        int intKey = readKey<int>(key);
+        return optimistic ? lookupOptimistic(intKey, outRids) : lookupTyped(intKey, outRids);
+    }
+    case DOUBLE: {
+        double doubleKey = readKey<double>(key);
+        return optimistic ? lookupOptimistic(doubleKey, outRids) : lookupTyped(doubleKey, outRids);
+    }
+    case STRING: {
+        StringKey stringKey = readKey<StringKey>(key);
+        return optimistic ? lookupOptimistic(stringKey, outRids) : lookupTyped(stringKey, outRids);
+    }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::multiLookup
+// -----------------------------------------------------------------------------
+size_t BTreeIndex::multiLookup(const void* const keys[], size_t n, std::vector<RecordId> outRids[])
+{
+    TreeLatchGuard guard(&treeLatch, false);
+    switch (attributeType) {
+    case INTEGER:
+        return multiLookupTyped<int>(keys, n, outRids);
+    case DOUBLE:
+        return multiLookupTyped<double>(keys, n, outRids);
+    case STRING:
+        return multiLookupTyped<StringKey>(keys, n, outRids);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::getStats
+// -----------------------------------------------------------------------------
+IndexStats BTreeIndex::getStats()
+{
+    std::lock_guard<std::mutex> guard(statsMutex);
+    return stats;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::exportSnapshot
+// -----------------------------------------------------------------------------
+void BTreeIndex::exportSnapshot(const std::string& snapshotName)
+{
+    TreeLatchGuard guard(&treeLatch, true);
+    switch (attributeType) {
+    case INTEGER:
+        exportSnapshotTyped<int>(snapshotName);
+        break;
+    case DOUBLE:
+        exportSnapshotTyped<double>(snapshotName);
+        break;
+    case STRING:
+        exportSnapshotTyped<StringKey>(snapshotName);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::exportSnapshotTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::exportSnapshotTyped(const std::string& snapshotName)
+{
+    std::vector<T> keys;
+    std::vector<RecordId> rids;
+    keys.reserve(stats.numEntries);
+    rids.reserve(stats.numEntries);
+
+    /* The tree latch is held exclusively, so the leaves are read without latches */
+    LeafEntries<T> leaf;
+    PageId pageNum = findEdgeLeaf<T>(false);
+    while (pageNum != Page::INVALID_NUMBER) {
+        Page* page;
+        bufMgr->readPage(file, pageNum, page);
+        readLeafEntries(page, leaf, false);
+        for (int i = 0; i < leaf.numEntries; i++) {
+            size_t from = rids.size();
+            rids.push_back(leaf.ridArray[i]);
+            expandPostingLists(rids, from);
+            keys.resize(rids.size(), leaf.keyArray[i]);
+        }
+        PageId rightSibPageNo = leaf.rightSibPageNo;
+        bufMgr->unPinPage(file, pageNum, false);
+        pageNum = rightSibPageNo;
+    }
+
+    StaticIndex::writeSnapshot(snapshotName, attributeType, attrByteOffset, keys, rids);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::countRange
+// -----------------------------------------------------------------------------
+long long BTreeIndex::countRange(const void* lowValParm,
+    const Operator lowOpParm,
+    const void* highValParm,
+    const Operator highOpParm)
+{
+    if ((lowOpParm != GT && lowOpParm != GTE) || (highOpParm != LT && highOpParm != LTE)) {
+        throw BadOpcodesException();
+    }
+
+    /* The entries in range are those not above the high bound but not below or at the low bound */
+    TreeLatchGuard guard(&treeLatch, false);
+    switch (attributeType) {
+    case INTEGER: {
+        int lowVal = readKey<int>(lowValParm), highVal = readKey<int>(highValParm);
+        if (lowVal > highVal)
+            throw BadScanrangeException();
+        std::unique_lock<std::mutex> appendLock = settleAppends<int>();
+        return rankTyped(highVal, highOpParm == LTE) - rankTyped(lowVal, lowOpParm == GT);
+    }
+    case DOUBLE: {
+        double lowVal = readKey<double>(lowValParm), highVal = readKey<double>(highValParm);
+        if (lowVal > highVal)
+            throw BadScanrangeException();
+        std::unique_lock<std::mutex> appendLock = settleAppends<double>();
+        return rankTyped(highVal, highOpParm == LTE) - rankTyped(lowVal, lowOpParm == GT);
+    }
+    case STRING: {
+        StringKey lowVal = readKey<StringKey>(lowValParm), highVal = readKey<StringKey>(highValParm);
+        if (lowVal > highVal)
+            throw BadScanrangeException();
+        std::unique_lock<std::mutex> appendLock = settleAppends<StringKey>();
+        return rankTyped(highVal, highOpParm == LTE) - rankTyped(lowVal, lowOpParm == GT);
+    }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::selectKth
+// -----------------------------------------------------------------------------
+void BTreeIndex::selectKth(long long k, void* outKey, RecordId& outRid)
+{
+    if (k < 0)
+        throw NoSuchKeyFoundException();
+
+    TreeLatchGuard guard(&treeLatch, false);
+    switch (attributeType) {
+    case INTEGER:
+        selectKthTyped<int>(k, outKey, outRid);
+        break;
+    case DOUBLE:
+        selectKthTyped<double>(k, outKey, outRid);
+        break;
+    case STRING:
+        selectKthTyped<StringKey>(k, outKey, outRid);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::rankTyped
+// -----------------------------------------------------------------------------
+template <class T>
+long long BTreeIndex::rankTyped(const T& key, bool orEqual)
+{
+    long long rank = 0;
+    int leafCount = 0;
+    Page* page;
+    PageId pageNum = latchRoot(page, false);
+
+    /* Every child left of the one taken holds keys below the key, or not above it if orEqual, even with duplicates
+       of a separator on both sides of it */
+    while (true) {
+        auto node = (NonLeafNode<T>*)page;
+        int idx = orEqual ? nodeUpperBound(node->keyArray, node->numKeys, key) : nodeLowerBound(node->keyArray, node->numKeys, key);
+        PageId childPageNum = node->pageNoArray[idx];
+
+        /* An empty tree holds no key */
+        if (childPageNum == Page::INVALID_NUMBER) {
+            releasePage(pageNum, false);
+            return 0;
+        }
+        for (int i = 0; i < idx; i++)
+            rank += node->countArray[i];
+        leafCount = node->countArray[idx];
+
+        bool leafNext = node->level == 1;
+        Page* childPage;
+        bufMgr->readPage(file, childPageNum, childPage);
+        bufMgr->latchPage(file, childPageNum, false);
+        releasePage(pageNum, false);
+
+        pageNum = childPageNum;
+        page = childPage;
+        if (leafNext)
+            break;
+    }
+
+    /* Count the entries of the leaf on the shorter side of the key, the parent counts them all */
+    LeafEntries<T> leaf;
+    readLeafEntries(page, leaf, false);
+    int count = leaf.numEntries;
+    int pos = orEqual ? nodeUpperBound(leaf.keyArray, count, key) : nodeLowerBound(leaf.keyArray, count, key);
+    if (pos <= count / 2) {
+        for (int i = 0; i < pos; i++)
+            rank += ridCount(leaf.ridArray[i]);
+    }
+    else {
+        rank += leafCount;
+        for (int i = pos; i < count; i++)
+            rank -= ridCount(leaf.ridArray[i]);
+    }
+    releasePage(pageNum, false);
+
+    return rank;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::selectKthTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void BTreeIndex::selectKthTyped(long long k, void* outKey, RecordId& outRid)
+{
+    std::unique_lock<std::mutex> appendLock = settleAppends<T>();
+    Page* page;
+    PageId pageNum = latchRoot(page, false);
+
+    /* Take the child whose entries cover position k, skipping the counts of the children before it */
+    while (true) {
+        auto node = (NonLeafNode<T>*)page;
+        int numKeys = node->numKeys, idx = 0;
+        while (idx < numKeys && k >= node->countArray[idx])
+            k -= node->countArray[idx++];
+
+        PageId childPageNum = node->pageNoArray[idx];
+        if (childPageNum == Page::INVALID_NUMBER || k >= node->countArray[idx]) {
+            releasePage(pageNum, false);
+            throw NoSuchKeyFoundException();
+        }
+
+        bool leafNext = node->level == 1;
+        Page* childPage;
+        bufMgr->readPage(file, childPageNum, childPage);
+        bufMgr->latchPage(file, childPageNum, false);
+        releasePage(pageNum, false);
+
+        pageNum = childPageNum;
+        page = childPage;
+        if (leafNext)
+            break;
+    }
+
+    LeafEntries<T> leaf;
+    readLeafEntries(page, leaf, false);
+    int count = leaf.numEntries, i = 0;
+    for (; i < count; i++) {
+        int numRids = ridCount(leaf.ridArray[i]);
+        if (k < numRids)
+            break;
+        k -= numRids;
+    }
+    if (i == count) {
+        releasePage(pageNum, false);
+        throw NoSuchKeyFoundException();
+    }
+
+    /* The record ids of a posting list are in its pages in scan order */
+    if (isPostingList(leaf.ridArray[i])) {
+        std::vector<RecordId> rids;
+        readPostingList(leaf.ridArray[i].page_number, rids);
+        outRid = rids[k];
+    }
+    else {
+        outRid = leaf.ridArray[i];
+    }
+    memcpy(outKey, &leaf.keyArray[i], sizeof(T));
+    releasePage(pageNum, false);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::subtreeCount
+// -----------------------------------------------------------------------------
+template <class T>
+int BTreeIndex::subtreeCount(PageId pageNum, bool leaf)
+{
+    Page* page;
+    bufMgr->readPage(file, pageNum, page);
+
+    int count = 0;
+    if (leaf) {
+        LeafEntries<T> entries;
+        readLeafEntries(page, entries, false);
+        for (int i = 0; i < entries.numEntries; i++)
+            count += ridCount(entries.ridArray[i]);
+    }
+    else {
+        auto node = (NonLeafNode<T>*)page;
+        count = std::accumulate(node->countArray, node->countArray + node->numKeys + 1, 0);
+    }
+    bufMgr->unPinPage(file, pageNum, false);
+
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::ridCount
+// -----------------------------------------------------------------------------
+int BTreeIndex::ridCount(const RecordId& rid)
+{
+    if (!isPostingList(rid))
+        return 1;
+
+    int count = 0;
+    PageId pageNum = rid.page_number;
+    while (pageNum != Page::INVALID_NUMBER) {
+        Page* page;
+        bufMgr->readPage(file, pageNum, page);
+        auto posting = (PostingNode*)page;
+        count += posting->numRids;
+        PageId nextPageNum = posting->nextPageNo;
+        bufMgr->unPinPage(file, pageNum, false);
+        pageNum = nextPageNum;
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::collectMatches
+// -----------------------------------------------------------------------------
+template <class T>
+bool BTreeIndex::collectMatches(const LeafEntries<T>& leaf, const T& key, std::vector<RecordId>& outRids)
+{
+    int count = leaf.numEntries;
+    int i = nodeLowerBound(leaf.keyArray, count, key);
+    for (; i < count && leaf.keyArray[i] == key; i++)
+        outRids.push_back(leaf.ridArray[i]);
+
+    /* Only a run reaching the end of the leaf can go on, and only if the key is not below the right sibling's keys */
+    return i == count && leaf.rightSibPageNo != Page::INVALID_NUMBER && key >= leaf.highKey;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupTyped
+// -----------------------------------------------------------------------------
+template <class T>
+int BTreeIndex::lookupTyped(const T& key, std::vector<RecordId>& outRids)
+{
+    size_t found = outRids.size();
+    Page* page;
+    PageId pageNum = latchRoot(page, false);
+
+    /* Couple shared latches down to the leftmost leaf that may hold the key, like insertEntry */
+    while (true) {
+        auto node = (NonLeafNode<T>*)page;
+        int idx = nodeLowerBound(node->keyArray, node->numKeys, key);
+        PageId childPageNum = node->pageNoArray[idx];
+
+        /* An empty tree holds no key */
+        if (childPageNum == Page::INVALID_NUMBER) {
+            releasePage(pageNum, false);
+            return 0;
+        }
+
+        bool leafNext = node->level == 1;
+        Page* childPage;
+        bufMgr->readPage(file, childPageNum, childPage);
+        bufMgr->latchPage(file, childPageNum, false);
+        releasePage(pageNum, false);
+
+        pageNum = childPageNum;
+        page = childPage;
+        if (leafNext)
+            break;
+    }
+
+    /* Walk right while the duplicates of the key run on, reading posting lists while their leaf is latched */
+    LeafEntries<T> leaf;
+    while (true) {
+        size_t from = outRids.size();
+        readLeafEntries(page, leaf, false);
+        bool moreRight = collectMatches(leaf, key, outRids);
+        expandPostingLists(outRids, from);
+        if (!moreRight)
+            break;
+
+        PageId rightSibPageNo = leaf.rightSibPageNo;
+        Page* rightSibPage;
+        bufMgr->readPage(file, rightSibPageNo, rightSibPage);
+        bufMgr->latchPage(file, rightSibPageNo, false);
+        releasePage(pageNum, false);
+        pageNum = rightSibPageNo;
+        page = rightSibPage;
+    }
+    releasePage(pageNum, false);
+
+    return outRids.size() - found;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupOptimistic
+// -----------------------------------------------------------------------------
+template <class T>
+int BTreeIndex::lookupOptimistic(const T& key, std::vector<RecordId>& outRids)
+{
+    size_t found = outRids.size();
+    PageId pageNum = rootPageNum;
+    Page* page;
+
+    /* Descend without latches, validating the version of every node read */
+    while (true) {
+        bufMgr->readPage(file, pageNum, page);
+        auto node = (NonLeafNode<T>*)page;
+
+        unsigned int version = node->version.load(std::memory_order_acquire);
+        PageId nextPageNum;
+        bool leafNext = false;
+        if (node->rightSibPageNo != Page::INVALID_NUMBER && key > node->highKey) {
+            /* The node was split since its parent was read, the key moved to the right */
+            nextPageNum = node->rightSibPageNo;
+        }
+        else {
+            int idx = nodeLowerBound(node->keyArray, node->numKeys, key);
+            nextPageNum = node->pageNoArray[idx];
+            leafNext = node->level == 1;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool consistent = (version & 1) == 0 && node->version.load(std::memory_order_relaxed) == version;
+        bufMgr->unPinPage(file, pageNum, false);
+
+        if (!consistent) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        /* An empty tree holds no key */
+        if (nextPageNum == Page::INVALID_NUMBER)
+            return 0;
+
+        pageNum = nextPageNum;
+        if (leafNext)
+            break;
+    }
+
+    /* Each leaf's matches are kept only once its version shows no writer changed it while they were read */
+    std::vector<RecordId> leafRids;
+    LeafEntries<T> leaf;
+    while (true) {
+        bufMgr->readPage(file, pageNum, page);
+        auto node = (LeafNode<T>*)page;
+
+        unsigned int version = node->version.load(std::memory_order_acquire);
+        leafRids.clear();
+        bool decoded = readLeafEntries(page, leaf, false);
+        bool moreRight = decoded && collectMatches(leaf, key, leafRids);
+        PageId rightSibPageNo = leaf.rightSibPageNo;
+        bool keyMovedRight = rightSibPageNo != Page::INVALID_NUMBER && key > leaf.highKey;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool consistent = decoded && (version & 1) == 0 && node->version.load(std::memory_order_relaxed) == version;
+        bufMgr->unPinPage(file, pageNum, false);
+
+        if (!consistent) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        /* A split since the parent was read may have moved all of the key's entries to the right */
+        if (keyMovedRight) {
+            pageNum = rightSibPageNo;
+            continue;
+        }
+
+        /* The posting lists of a consistent copy of the leaf are in place */
+        size_t from = outRids.size();
+        outRids.insert(outRids.end(), leafRids.begin(), leafRids.end());
+        expandPostingLists(outRids, from);
+        if (!moreRight)
+            break;
+        pageNum = rightSibPageNo;
+    }
+
+    return outRids.size() - found;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::multiLookupTyped
+// -----------------------------------------------------------------------------
+template <class T>
+size_t BTreeIndex::multiLookupTyped(const void* const keys[], size_t n, std::vector<RecordId> outRids[])
+{
+    /* A lookup in flight, with the node it reads next pinned */
+    struct Lookup {
+        T key;
+        size_t slot;
+        PageId pageNum;
+        Page* page;
+        bool atLeaf;
+        bool probed;
+    };
+
+    /* Pins a node and prefetches its header, which holds the key count the probes are placed by */
+    auto fetch = [this](Lookup& lookup) {
+        bufMgr->readPage(file, lookup.pageNum, lookup.page);
+        __builtin_prefetch(lookup.page);
+        lookup.probed = false;
+    };
+
+    /* Prefetches the keys the first steps of the binary search of the node compare against. The count is read
+       without a latch and only bounded here, the search itself validates what it reads. A compressed leaf is
+       decoded whole and gets no probes. */
+    auto probe = [this](Lookup& lookup) {
+        const T* keys = NULL;
+        int n = 0;
+        if (!lookup.atLeaf) {
+            auto node = (const NonLeafNode<T>*)lookup.page;
+            keys = node->keyArray;
+            n = std::min(std::max(node->numKeys, 0), (int)NodeSize<T>::NONLEAF);
+        }
+        else if (leafFormat != COMPRESSED_LEAVES) {
+            auto node = (const LeafNode<T>*)lookup.page;
+            keys = node->keyArray;
+            n = std::min(std::max(node->numEntries, 0), (int)NodeSize<T>::LEAF);
+        }
+        if (n > 0) {
+            __builtin_prefetch(&keys[n / 2]);
+            __builtin_prefetch(&keys[n / 4]);
+            __builtin_prefetch(&keys[n * 3 / 4]);
+        }
+        lookup.probed = true;
+    };
+
+    std::vector<Lookup> group;
+    group.reserve(MULTI_LOOKUP_GROUP);
+    std::vector<RecordId> leafRids;
+    LeafEntries<T> leaf;
+    size_t next = 0, found = 0;
+
+    while (next < n || !group.empty()) {
+        /* Start lookups until the group is full, each with the root fetched */
+        while (group.size() < (size_t)MULTI_LOOKUP_GROUP && next < n) {
+            Lookup lookup;
+            lookup.key = readKey<T>(keys[next]);
+            lookup.slot = next++;
+            lookup.pageNum = rootPageNum;
+            lookup.atLeaf = false;
+            fetch(lookup);
+            group.push_back(lookup);
+        }
+
+        /* Each lookup in turn either places the probes of the node it fetched, or searches the node like
+           lookupOptimistic() and fetches the next one, so both the header and the probed keys of a node
+           arrive while the other lookups take their turns */
+        for (size_t i = 0; i < group.size();) {
+            Lookup& lookup = group[i];
+            if (!lookup.probed) {
+                probe(lookup);
+                i++;
+                continue;
+            }
+            bool done = false;
+            if (!lookup.atLeaf) {
+                auto node = (NonLeafNode<T>*)lookup.page;
+                unsigned int version = node->version.load(std::memory_order_acquire);
+                PageId nextPageNum;
+                bool leafNext = false;
+                if (node->rightSibPageNo != Page::INVALID_NUMBER && lookup.key > node->highKey) {
+                    nextPageNum = node->rightSibPageNo;
+                }
+                else {
+                    nextPageNum = node->pageNoArray[nodeLowerBound(node->keyArray, node->numKeys, lookup.key)];
+                    leafNext = node->level == 1;
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                bool consistent = (version & 1) == 0 && node->version.load(std::memory_order_relaxed) == version;
+                bufMgr->unPinPage(file, lookup.pageNum, false);
+
+                /* An empty tree holds no key, a node changed meanwhile is fetched again */
+                if (consistent && nextPageNum == Page::INVALID_NUMBER) {
+                    done = true;
+                }
+                else if (consistent) {
+                    lookup.pageNum = nextPageNum;
+                    lookup.atLeaf = leafNext;
+                }
+            }
+            else {
+                auto node = (LeafNode<T>*)lookup.page;
+                unsigned int version = node->version.load(std::memory_order_acquire);
+                leafRids.clear();
+                bool decoded = readLeafEntries(lookup.page, leaf, false);
+                bool moreRight = decoded && collectMatches(leaf, lookup.key, leafRids);
+                PageId rightSibPageNo = leaf.rightSibPageNo;
+                bool keyMovedRight = rightSibPageNo != Page::INVALID_NUMBER && lookup.key > leaf.highKey;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                bool consistent = decoded && (version & 1) == 0 && node->version.load(std::memory_order_relaxed) == version;
+                bufMgr->unPinPage(file, lookup.pageNum, false);
+
+                if (consistent && keyMovedRight) {
+                    lookup.pageNum = rightSibPageNo;
+                }
+                else if (consistent) {
+                    std::vector<RecordId>& rids = outRids[lookup.slot];
+                    size_t from = rids.size();
+                    rids.insert(rids.end(), leafRids.begin(), leafRids.end());
+                    expandPostingLists(rids, from);
+                    found += rids.size() - from;
+                    if (moreRight)
+                        lookup.pageNum = rightSibPageNo;
+                    else
+                        done = true;
+                }
+            }
+
+            /* A finished lookup gives its place to the last one of the group */
+            if (done) {
+                group[i] = group.back();
+                group.pop_back();
+            }
+            else {
+                fetch(lookup);
+                i++;
+            }
+        }
+    }
+    return found;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startScan
+// -----------------------------------------------------------------------------
+void BTreeIndex::startScan(const void* lowValParm,
+    const Operator lowOpParm,
+    const void* highValParm,
+    const Operator highOpParm,
+    const ScanOrder order,
+    const size_t limit,
+    const size_t offset)
+{
+    scan.startScan(lowValParm, lowOpParm, highValParm, highOpParm, order, limit, offset);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startScan
+// -----------------------------------------------------------------------------
+void BTreeIndex::startScan(const KeyRange* ranges, size_t numRanges)
+{
+    scan.startScan(ranges, numRanges);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+void BTreeIndex::scanNext(RecordId& outRid)
+{
+    scan.scanNext(outRid);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNextBatch
+// -----------------------------------------------------------------------------
+size_t BTreeIndex::scanNextBatch(RecordId* outRids, size_t maxRids)
+{
+    return scan.scanNextBatch(outRids, maxRids);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::endScan
+// -----------------------------------------------------------------------------
+//
+void BTreeIndex::endScan()
+{
+    scan.endScan();
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::IndexScanCursor -- Constructor
+// -----------------------------------------------------------------------------
+IndexScanCursor::IndexScanCursor(BTreeIndex* indexIn)
+    : index(indexIn), scanExecuting(false), nextEntry(0),
+      currentPageNum(Page::INVALID_NUMBER),
+      postingPageNum(Page::INVALID_NUMBER), postingEntry(0), descending(false), remaining(0), nextRange(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::~IndexScanCursor -- destructor
+// -----------------------------------------------------------------------------
+IndexScanCursor::~IndexScanCursor()
+{
+    /* The cursor holds no page between calls, so there is nothing to let go of */
+    scanExecuting = false;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::startScan
+// -----------------------------------------------------------------------------
+void IndexScanCursor::startScan(const void* lowValParm,
+    const Operator lowOpParm,
+    const void* highValParm,
+    const Operator highOpParm,
+    const ScanOrder order,
+    const size_t limit,
+    const size_t offset)
+{
+    /* Check aprameters values */
+    if ((lowOpParm != GT && lowOpParm != GTE) || (highOpParm != LT && highOpParm != LTE)) {
+        throw BadOpcodesException();
+    }
+
+    TreeLatchGuard guard(&index->treeLatch, false);
+    switch (index->attributeType) {
+    case INTEGER:
+        startScanTyped<int>(lowValParm, highValParm);
+        break;
+    case DOUBLE:
+        startScanTyped<double>(lowValParm, highValParm);
+        break;
+    case STRING:
+        startScanTyped<StringKey>(lowValParm, highValParm);
+        break;
+    }
+
+    /* set scan */
+    lowOp = lowOpParm;
+    highOp = highOpParm;
+    descending = order == DESCENDING;
+
+    /* Scan the tree from root to find the first leaf node to be scanned, the one holding the high bound if descending */
+    bool optimistic = index->concurrencyMode == BLINK;
+    switch (index->attributeType) {
+    case INTEGER:
+        optimistic ? getFirstLeafOptimistic<int>() : getFirstParent<int>();
+        break;
+    case DOUBLE:
+        optimistic ? getFirstLeafOptimistic<double>() : getFirstParent<double>();
+        break;
+    case STRING:
+        optimistic ? getFirstLeafOptimistic<StringKey>() : getFirstParent<StringKey>();
+        break;
+    }
+    postingPageNum = Page::INVALID_NUMBER;
+    scanExecuting = true;
+
+    /* Skip the offset from the start position, a scan whose range ends before it is completed */
+    bool inRange = true;
+    switch (index->attributeType) {
+    case INTEGER:
+        inRange = skipEntries<int>(offset);
+        break;
+    case DOUBLE:
+        inRange = skipEntries<double>(offset);
+        break;
+    case STRING:
+        inRange = skipEntries<StringKey>(offset);
+        break;
+    }
+    remaining = inRange ? limit : 0;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::startScanTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::startScanTyped(const void* lowValParm, const void* highValParm)
+{
+    T lowVal = readKey<T>(lowValParm);
+    T highVal = readKey<T>(highValParm);
+
+    /* check bounds */
+    if (lowVal > highVal)
+        throw BadScanrangeException();
+
+    if (scanExecuting) {
+        endScan();
+    }
+
+    scanLowVal<T>() = lowVal;
+    scanHighVal<T>() = highVal;
+    scanRanges<T>().clear();
+    nextRange = 0;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::startScan
+// -----------------------------------------------------------------------------
+void IndexScanCursor::startScan(const KeyRange* ranges, size_t numRanges)
+{
+    for (size_t i = 0; i < numRanges; i++) {
+        if ((ranges[i].lowOp != GT && ranges[i].lowOp != GTE) || (ranges[i].highOp != LT && ranges[i].highOp != LTE)) {
+            throw BadOpcodesException();
+        }
+    }
+    if (numRanges == 0)
+        throw BadScanrangeException();
+
+    TreeLatchGuard guard(&index->treeLatch, false);
+    switch (index->attributeType) {
+    case INTEGER:
+        startMultiScanTyped<int>(ranges, numRanges);
+        break;
+    case DOUBLE:
+        startMultiScanTyped<double>(ranges, numRanges);
+        break;
+    case STRING:
+        startMultiScanTyped<StringKey>(ranges, numRanges);
+        break;
+    }
+
+    /* The first range is scanned like a single one, the others follow from the leaf it ends in */
+    lowOp = ranges[0].lowOp;
+    highOp = ranges[0].highOp;
+    descending = false;
+    bool optimistic = index->concurrencyMode == BLINK;
+    switch (index->attributeType) {
+    case INTEGER:
+        optimistic ? getFirstLeafOptimistic<int>() : getFirstParent<int>();
+        break;
+    case DOUBLE:
+        optimistic ? getFirstLeafOptimistic<double>() : getFirstParent<double>();
+        break;
+    case STRING:
+        optimistic ? getFirstLeafOptimistic<StringKey>() : getFirstParent<StringKey>();
+        break;
+    }
+    postingPageNum = Page::INVALID_NUMBER;
+    scanExecuting = true;
+    remaining = NO_SCAN_LIMIT;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::startMultiScanTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::startMultiScanTyped(const KeyRange* ranges, size_t numRanges)
+{
+    std::vector<ScanRange<T> > scanned(numRanges);
+    for (size_t i = 0; i < numRanges; i++) {
+        ScanRange<T>& range = scanned[i];
+        range.lowVal = readKey<T>(ranges[i].lowVal);
+        range.lowOp = ranges[i].lowOp;
+        range.highVal = readKey<T>(ranges[i].highVal);
+        range.highOp = ranges[i].highOp;
+        if (range.lowVal > range.highVal)
+            throw BadScanrangeException();
+
+        /* Each range must start past the end of the one before it */
+        if (i > 0) {
+            const ScanRange<T>& prev = scanned[i - 1];
+            bool shared = prev.highOp == LTE && range.lowOp == GTE;
+            if (range.lowVal < prev.highVal || (range.lowVal == prev.highVal && shared))
+                throw BadScanrangeException();
+        }
+    }
+
+    startScanTyped<T>(ranges[0].lowVal, ranges[0].highVal);
+    scanRanges<T>().swap(scanned);
+    nextRange = 1;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::moveToNextRange
+// -----------------------------------------------------------------------------
+template <class T>
+bool IndexScanCursor::moveToNextRange()
+{
+    std::vector<ScanRange<T> >& ranges = scanRanges<T>();
+    if (nextRange >= ranges.size())
+        return false;
+
+    const ScanRange<T>& range = ranges[nextRange++];
+    scanLowVal<T>() = range.lowVal;
+    scanHighVal<T>() = range.highVal;
+    lowOp = range.lowOp;
+    highOp = range.highOp;
+
+    /* A range past the high key of the leaf starts in a leaf further right, found from the root */
+    LeafEntries<T>& leaf = leafEntries<T>();
+    if (leaf.rightSibPageNo != Page::INVALID_NUMBER && startsRightOf(leaf.highKey)) {
+        if (index->concurrencyMode == BLINK)
+            getFirstLeafOptimistic<T>();
+        else
+            getFirstParent<T>();
+        return true;
+    }
+
+    /* Otherwise it starts in this leaf, past the entries already scanned, or on one of the next leaves */
+    nextEntry = std::max(nextEntry, rangeBound(leaf.keyArray, leaf.numEntries, false));
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::rangeBound
+// -----------------------------------------------------------------------------
+template <class T>
+int IndexScanCursor::rangeBound(const T* keys, int count, bool upper)
+{
+    /* For the low bound, the first key above it, or not below it if the low bound is in the range, since
+       duplicates of the low bound may run over several leaves left of an equal separator. For the high
+       bound, the first key above it, or not below it if the high bound is out of the range. */
+    if (upper) {
+        const T& highVal = scanHighVal<T>();
+        return highOp == LTE ? nodeUpperBound(keys, count, highVal) : nodeLowerBound(keys, count, highVal);
+    }
+    const T& lowVal = scanLowVal<T>();
+    return lowOp == GTE ? nodeLowerBound(keys, count, lowVal) : nodeUpperBound(keys, count, lowVal);
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::startsRightOf
+// -----------------------------------------------------------------------------
+template <class T>
+bool IndexScanCursor::startsRightOf(const T& highKey)
+{
+    if (descending) {
+        const T& highVal = scanHighVal<T>();
+        return highOp == LTE ? highVal >= highKey : highVal > highKey;
+    }
+    const T& lowVal = scanLowVal<T>();
+    return lowOp == GTE ? lowVal > highKey : lowVal >= highKey;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::getFirstParent
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::getFirstParent()
+{
+    /* Readers couple shared latches down the tree, latching the child before letting go of the parent */
+    Page* page;
+    currentPageNum = index->latchRoot(page, false);
+    while (true) {
+        auto nonLeafNode = (NonLeafNode<T>*)page;
+        int i = rangeBound(nonLeafNode->keyArray, nonLeafNode->numKeys, descending);
+
+        /* An empty tree has no leaf to scan */
+        PageId childPageNum = nonLeafNode->pageNoArray[i];
+        if (childPageNum == Page::INVALID_NUMBER) {
+            index->releasePage(currentPageNum, false);
+            throw NoSuchKeyFoundException();
+        }
+
+        bool leafNext = nonLeafNode->level == 1;
+        Page* childPage;
+        index->bufMgr->readPage(index->file, childPageNum, childPage);
+        index->bufMgr->latchPage(index->file, childPageNum, false);
+        index->releasePage(currentPageNum, false);
+
+        currentPageNum = childPageNum;
+        page = childPage;
+        if (leafNext)
+            break;
+    }
+
+    /* The leaf is copied under its latch and let go, the cursor holds no latch between calls */
+    LeafEntries<T>& leaf = leafEntries<T>();
+    index->readLeafEntries(page, leaf, true);
+    index->releasePage(currentPageNum, false);
+
+    /* binary search to set the value of nextEntry to the first record that is not below the scan range, or the last
+       one not above it */
+    nextEntry = rangeBound(leaf.keyArray, leaf.numEntries, descending) - (descending ? 1 : 0);
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::getFirstLeafOptimistic
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::getFirstLeafOptimistic()
+{
+    PageId pageNum = index->rootPageNum;
+    Page* page;
+
+    while (true) {
+        index->bufMgr->readPage(index->file, pageNum, page);
+        auto node = (NonLeafNode<T>*)page;
+
+        /* Read what is needed from the node, then check that no writer changed it meanwhile */
+        unsigned int version = node->version.load(std::memory_order_acquire);
+        PageId nextPageNum;
+        bool leafNext = false;
+        if (node->rightSibPageNo != Page::INVALID_NUMBER && startsRightOf(node->highKey)) {
+            /* The node was split since its parent was read, the range goes on to the right */
+            nextPageNum = node->rightSibPageNo;
+        }
+        else {
+            /* Writers only ever store valid counts, so the search stays inside the node even if torn */
+            nextPageNum = node->pageNoArray[rangeBound(node->keyArray, node->numKeys, descending)];
+            leafNext = node->level == 1;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool consistent = (version & 1) == 0 && node->version.load(std::memory_order_relaxed) == version;
+        index->bufMgr->unPinPage(index->file, pageNum, false);
+
+        if (!consistent) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        /* An empty tree has no leaf to scan */
+        if (nextPageNum == Page::INVALID_NUMBER)
+            throw NoSuchKeyFoundException();
+
+        pageNum = nextPageNum;
+        if (leafNext)
+            break;
+    }
+
+    copyLeaf<T>(pageNum);
+
+    /* binary search to set the value of nextEntry to the first record that is not below the scan range, or the last
+       one not above it */
+    LeafEntries<T>& leaf = leafEntries<T>();
+    nextEntry = rangeBound(leaf.keyArray, leaf.numEntries, descending) - (descending ? 1 : 0);
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::copyLeaf
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::copyLeaf(PageId pageNum, PageId leftOf)
+{
+    LeafEntries<T>& copy = leafEntries<T>();
+    Page* page;
+
+    while (true) {
+        index->bufMgr->readPage(index->file, pageNum, page);
+        auto leaf = (LeafNode<T>*)page;
+
+        /* Only the header and the entries in use are copied */
+        unsigned int version = leaf->version.load(std::memory_order_acquire);
+        bool decoded = index->readLeafEntries(page, copy, true);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool consistent = decoded && (version & 1) == 0 && leaf->version.load(std::memory_order_relaxed) == version;
+        index->bufMgr->unPinPage(index->file, pageNum, false);
+
+        if (!consistent) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        /* A split since the parent was read may have moved the start of the range to the right. Moving left, a split
+           of the leaf on the left since its link was read put the new leaf between it and leftOf. */
+        bool moveRight = leftOf != Page::INVALID_NUMBER ? copy.rightSibPageNo != leftOf : startsRightOf(copy.highKey);
+        if (copy.rightSibPageNo != Page::INVALID_NUMBER && moveRight) {
+            pageNum = copy.rightSibPageNo;
+            continue;
+        }
+        break;
+    }
+
+    currentPageNum = pageNum;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::moveToRightSibling
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::moveToRightSibling(PageId rightSibPageNo)
+{
+    nextEntry = 0;
+
+    /* The copy of the leaf the scan leaves already holds every entry split off to its right since it was taken */
+    if (index->concurrencyMode == BLINK) {
+        copyLeaf<T>(rightSibPageNo);
+        return;
+    }
+
+    /* Copy the right sibling under its latch. Like the copy on a BLINK index, the copy of this leaf holds every
+       entry split off to its right since it was taken. */
+    Page* rightSibPage;
+    index->bufMgr->readPage(index->file, rightSibPageNo, rightSibPage);
+    index->bufMgr->latchPage(index->file, rightSibPageNo, false);
+    index->readLeafEntries(rightSibPage, leafEntries<T>(), true);
+    index->releasePage(rightSibPageNo, false);
+    currentPageNum = rightSibPageNo;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::moveToLeftSibling
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::moveToLeftSibling(PageId leftSibPageNo)
+{
+    PageId prevPageNum = currentPageNum;
+    LeafEntries<T>& leaf = leafEntries<T>();
+
+    if (index->concurrencyMode == BLINK) {
+        copyLeaf<T>(leftSibPageNo, prevPageNum);
+        nextEntry = leaf.numEntries - 1;
+        return;
+    }
+
+    /* Leaves split off the left one since the copy of this leaf was taken are found through its right links */
+    PageId pageNum = leftSibPageNo;
+    Page* page;
+    index->bufMgr->readPage(index->file, pageNum, page);
+    index->bufMgr->latchPage(index->file, pageNum, false);
+    while (true) {
+        PageId rightSibPageNo = ((LeafNode<T>*)page)->rightSibPageNo;
+        if (rightSibPageNo == prevPageNum || rightSibPageNo == Page::INVALID_NUMBER)
+            break;
+
+        Page* rightSibPage;
+        index->bufMgr->readPage(index->file, rightSibPageNo, rightSibPage);
+        index->bufMgr->latchPage(index->file, rightSibPageNo, false);
+        index->releasePage(pageNum, false);
+        pageNum = rightSibPageNo;
+        page = rightSibPage;
+    }
+
+    index->readLeafEntries(page, leaf, true);
+    index->releasePage(pageNum, false);
+    currentPageNum = pageNum;
+    nextEntry = leaf.numEntries - 1;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::copyPostingPage
+// -----------------------------------------------------------------------------
+void IndexScanCursor::copyPostingPage(PageId pageNum)
+{
+    Page* page;
+    while (true) {
+        index->bufMgr->readPage(index->file, pageNum, page);
+        auto posting = (PostingNode*)page;
+
+        unsigned int version = posting->version.load(std::memory_order_acquire);
+        auto copy = (PostingNode*)&postingCopy;
+        int count = posting->numRids;
+        copy->numRids = count;
+        copy->nextPageNo = posting->nextPageNo;
+        std::copy(posting->ridArray, posting->ridArray + count, copy->ridArray);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool consistent = (version & 1) == 0 && posting->version.load(std::memory_order_relaxed) == version;
+        index->bufMgr->unPinPage(index->file, pageNum, false);
+
+        if (consistent)
+            break;
+        std::this_thread::yield();
+    }
+
+    postingPageNum = pageNum;
+    postingEntry = 0;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::readPostingRids
+// -----------------------------------------------------------------------------
+size_t IndexScanCursor::readPostingRids(RecordId* outRids, size_t maxRids)
+{
+    size_t numRids = 0;
+    while (numRids < maxRids) {
+        auto posting = (PostingNode*)&postingCopy;
+        if (postingEntry < posting->numRids) {
+            size_t count = std::min((size_t)(posting->numRids - postingEntry), maxRids - numRids);
+            std::copy(posting->ridArray + postingEntry, posting->ridArray + postingEntry + count, outRids + numRids);
+            postingEntry += count;
+            numRids += count;
+            continue;
+        }
+        if (posting->nextPageNo != Page::INVALID_NUMBER) {
+            copyPostingPage(posting->nextPageNo);
+            continue;
+        }
+
+        /* The list is used up, the scan goes on with the leaf entry after it */
+        postingPageNum = Page::INVALID_NUMBER;
+        nextEntry += descending ? -1 : 1;
+        break;
+    }
+    return numRids;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanNext
+// -----------------------------------------------------------------------------
+void IndexScanCursor::scanNext(RecordId& outRid)
+{
+    /* Check if scan has started */
+    if (!scanExecuting)
+        throw ScanNotInitializedException();
+
+    /* Once the limit is reached the scan is completed without looking at any further entry */
+    if (remaining == 0)
+        throw IndexScanCompletedException();
+
+    TreeLatchGuard guard(&index->treeLatch, false);
+    switch (index->attributeType) {
+    case INTEGER:
+        descending ? scanPrevTyped<int>(outRid) : scanNextTyped<int>(outRid);
+        break;
+    case DOUBLE:
+        descending ? scanPrevTyped<double>(outRid) : scanNextTyped<double>(outRid);
+        break;
+    case STRING:
+        descending ? scanPrevTyped<StringKey>(outRid) : scanNextTyped<StringKey>(outRid);
+        break;
+    }
+    remaining--;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanNextTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::scanNextTyped(RecordId& outRid)
+{
+    const T& lowVal = scanLowVal<T>();
+    const T& highVal = scanHighVal<T>();
+
+    /* Keep track of node */
+    LeafEntries<T>& currentNode = leafEntries<T>();
+
+    /* Look for rid of next matching tuple */
+    while (true) {
+        /* Go on with the posting list being scanned, if any */
+        if (postingPageNum != Page::INVALID_NUMBER && readPostingRids(&outRid, 1) == 1)
+            return;
+
+        /* Validate index of entry */
+        if (nextEntry >= currentNode.numEntries) {
+            PageId rightSibPageNo = currentNode.rightSibPageNo;
+
+            /* Check that the right sibling is a valid leaf page, the scan stays on the last leaf otherwise */
+            if (rightSibPageNo == Page::INVALID_NUMBER)
+                throw IndexScanCompletedException();
+
+            /* Update the parameters for the index since no more entries are to be scanned on this leaf */
+            moveToRightSibling<T>(rightSibPageNo);
+        }
+
+        /* Check lower limit of scan with entry key */
+        if ((lowOp == GT && currentNode.keyArray[nextEntry] <= lowVal) || (lowOp == GTE && currentNode.keyArray[nextEntry] < lowVal)) {
+            nextEntry++;
+            continue;
+        }
+
+        /* Check upper limit of scan with entry key, a multi-range scan goes on with its next range */
+        if ((highOp == LT && currentNode.keyArray[nextEntry] >= highVal)
+            || (highOp == LTE && currentNode.keyArray[nextEntry] > highVal)) {
+            if (!moveToNextRange<T>())
+                throw IndexScanCompletedException();
+            continue;
+        }
+
+        /* A posting list entry is scanned through its list */
+        const RecordId& rid = currentNode.ridArray[nextEntry];
+        if (isPostingList(rid)) {
+            copyPostingPage(rid.page_number);
+            continue;
+        }
+        break;
+    }
+
+    /* Return  entry rid */
+    outRid = currentNode.ridArray[nextEntry];
+
+    /* update index of next entry */
+    nextEntry++;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanNextBatch
+// -----------------------------------------------------------------------------
+size_t IndexScanCursor::scanNextBatch(RecordId* outRids, size_t maxRids)
+{
+    /* Check if scan has started */
+    if (!scanExecuting)
+        throw ScanNotInitializedException();
+
+    /* The batch stops at the limit, so no leaf past the last entry returned is read */
+    maxRids = std::min(maxRids, remaining);
+    if (maxRids == 0)
+        return 0;
+
+    TreeLatchGuard guard(&index->treeLatch, false);
+    size_t numRids = 0;
+    switch (index->attributeType) {
+    case INTEGER:
+        numRids = descending ? scanPrevBatchTyped<int>(outRids, maxRids) : scanNextBatchTyped<int>(outRids, maxRids);
+        break;
+    case DOUBLE:
+        numRids = descending ? scanPrevBatchTyped<double>(outRids, maxRids) : scanNextBatchTyped<double>(outRids, maxRids);
+        break;
+    case STRING:
+        numRids = descending ? scanPrevBatchTyped<StringKey>(outRids, maxRids) : scanNextBatchTyped<StringKey>(outRids, maxRids);
+        break;
+    }
+    remaining -= numRids;
+    return numRids;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanNextBatchTyped
+// -----------------------------------------------------------------------------
+template <class T>
+size_t IndexScanCursor::scanNextBatchTyped(RecordId* outRids, size_t maxRids)
+{
+    const T& lowVal = scanLowVal<T>();
+    const T& highVal = scanHighVal<T>();
+
+    LeafEntries<T>& currentNode = leafEntries<T>();
+    size_t numRids = 0;
+
+    while (numRids < maxRids) {
+        /* Go on with the posting list being scanned, if any */
+        if (postingPageNum != Page::INVALID_NUMBER) {
+            numRids += readPostingRids(outRids + numRids, maxRids - numRids);
+            continue;
+        }
+
+        int count = currentNode.numEntries;
+
+        /* Move on to the right sibling once this leaf is used up, the scan stays on the last leaf otherwise */
+        if (nextEntry >= count) {
+            PageId rightSibPageNo = currentNode.rightSibPageNo;
+            if (rightSibPageNo == Page::INVALID_NUMBER)
+                break;
+
+            moveToRightSibling<T>(rightSibPageNo);
+            continue;
+        }
+
+        /* Skip entries below the scan range, only the first leaf of a range can hold any */
+        while (nextEntry < count
+            && ((lowOp == GT && currentNode.keyArray[nextEntry] <= lowVal)
+                || (lowOp == GTE && currentNode.keyArray[nextEntry] < lowVal)))
+            nextEntry++;
+        if (nextEntry == count)
+            continue;
+
+        /* Binary search the end of the range in this leaf, unless the whole leaf is below the high bound */
+        int end = count;
+        bool rangeEnds = (highOp == LT && currentNode.keyArray[count - 1] >= highVal)
+            || (highOp == LTE && currentNode.keyArray[count - 1] > highVal);
+        if (rangeEnds) {
+            int low = nextEntry, high = count - 1;
+            while (low < high) {
+                int mid = (low + high) / 2;
+                if ((highOp == LT && currentNode.keyArray[mid] >= highVal) || (highOp == LTE && currentNode.keyArray[mid] > highVal))
+                    high = mid;
+                else
+                    low = mid + 1;
+            }
+            end = low;
+        }
+
+        /* Copy the qualifying entries of the leaf */
+        if ((size_t)(end - nextEntry) > maxRids - numRids)
+            end = nextEntry + (maxRids - numRids);
+        const RecordId* rids = currentNode.ridArray;
+        int i = nextEntry;
+        for (; i < end && !isPostingList(rids[i]); i++)
+            outRids[numRids++] = rids[i];
+        nextEntry = i;
+
+        /* A posting list entry stops the copy, its list is scanned next */
+        if (i < end) {
+            copyPostingPage(rids[i].page_number);
+            continue;
+        }
+
+        if (rangeEnds && numRids < maxRids && !moveToNextRange<T>())
+            break;
+    }
+
+    return numRids;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanPrevTyped
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::scanPrevTyped(RecordId& outRid)
+{
+    const T& lowVal = scanLowVal<T>();
+    const T& highVal = scanHighVal<T>();
+    LeafEntries<T>& currentNode = leafEntries<T>();
+
+    while (true) {
+        /* Go on with the posting list being scanned, if any */
+        if (postingPageNum != Page::INVALID_NUMBER && readPostingRids(&outRid, 1) == 1)
+            return;
+
+        /* Move on to the left sibling once this leaf is used up, the scan stays on the first leaf otherwise */
+        if (nextEntry < 0) {
+            PageId leftSibPageNo = currentNode.leftSibPageNo;
+            if (leftSibPageNo == Page::INVALID_NUMBER)
+                throw IndexScanCompletedException();
+            moveToLeftSibling<T>(leftSibPageNo);
+            continue;
+        }
+
+        /* Skip entries above the scan range, only the first leaf can hold any */
+        const T& key = currentNode.keyArray[nextEntry];
+        if ((highOp == LT && key >= highVal) || (highOp == LTE && key > highVal)) {
+            nextEntry--;
+            continue;
+        }
+
+        /* The scan ends at the first entry below the low bound */
+        if ((lowOp == GT && key <= lowVal) || (lowOp == GTE && key < lowVal))
+            throw IndexScanCompletedException();
+
+        /* A posting list entry is scanned through its list */
+        const RecordId& rid = currentNode.ridArray[nextEntry];
+        if (isPostingList(rid)) {
+            copyPostingPage(rid.page_number);
+            continue;
+        }
+        break;
+    }
+
+    outRid = currentNode.ridArray[nextEntry];
+    nextEntry--;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::scanPrevBatchTyped
+// -----------------------------------------------------------------------------
+template <class T>
+size_t IndexScanCursor::scanPrevBatchTyped(RecordId* outRids, size_t maxRids)
+{
+    const T& lowVal = scanLowVal<T>();
+    const T& highVal = scanHighVal<T>();
+
+    LeafEntries<T>& currentNode = leafEntries<T>();
+    size_t numRids = 0;
+
+    while (numRids < maxRids) {
+        /* Go on with the posting list being scanned, if any */
+        if (postingPageNum != Page::INVALID_NUMBER) {
+            numRids += readPostingRids(outRids + numRids, maxRids - numRids);
+            continue;
+        }
+
+        /* Move on to the left sibling once this leaf is used up, the scan stays on the first leaf otherwise */
+        if (nextEntry < 0) {
+            PageId leftSibPageNo = currentNode.leftSibPageNo;
+            if (leftSibPageNo == Page::INVALID_NUMBER)
+                break;
+
+            moveToLeftSibling<T>(leftSibPageNo);
+            continue;
+        }
+
+        /* Skip entries above the scan range, only the first leaf can hold any */
+        while (nextEntry >= 0
+            && ((highOp == LT && currentNode.keyArray[nextEntry] >= highVal)
+                || (highOp == LTE && currentNode.keyArray[nextEntry] > highVal)))
+            nextEntry--;
+        if (nextEntry < 0)
+            continue;
+
+        /* Binary search the start of the range in this leaf, unless the whole leaf is above the low bound */
+        int begin = 0;
+        bool rangeEnds = (lowOp == GT && currentNode.keyArray[0] <= lowVal)
+            || (lowOp == GTE && currentNode.keyArray[0] < lowVal);
+        if (rangeEnds) {
+            int low = 0, high = nextEntry + 1;
+            while (low < high) {
+                int mid = (low + high) / 2;
+                if ((lowOp == GT && currentNode.keyArray[mid] <= lowVal) || (lowOp == GTE && currentNode.keyArray[mid] < lowVal))
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+            begin = low;
+        }
+
+        /* Copy the qualifying entries of the leaf, from the highest down */
+        if ((size_t)(nextEntry + 1 - begin) > maxRids - numRids)
+            begin = nextEntry + 1 - (maxRids - numRids);
+        const RecordId* rids = currentNode.ridArray;
+        int i = nextEntry;
+        for (; i >= begin && !isPostingList(rids[i]); i--)
+            outRids[numRids++] = rids[i];
+        nextEntry = i;
+
+        /* A posting list entry stops the copy, its list is scanned next */
+        if (i >= begin) {
+            copyPostingPage(rids[i].page_number);
+            continue;
+        }
+
+        if (rangeEnds && numRids < maxRids)
+            break;
+    }
+
+    return numRids;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::skipEntries
+// -----------------------------------------------------------------------------
+template <class T>
+bool IndexScanCursor::skipEntries(size_t count)
+{
+    if (count == 0)
+        return true;
+
+    /* An offset ending in the leaf the scan starts on moves along it. The entries of the range left in the leaf lie
+       between the bounds of the range and nextEntry. */
+    LeafEntries<T>& leaf = leafEntries<T>();
+    if (index->leafFormat != POSTING_LIST_LEAVES) {
+        int numEntries = leaf.numEntries;
+        int lowPos = rangeBound(leaf.keyArray, numEntries, false);
+        int highPos = rangeBound(leaf.keyArray, numEntries, true);
+        if (!descending) {
+            int begin = std::max(nextEntry, lowPos);
+            if (count < (size_t)(std::max(begin, highPos) - begin)) {
+                nextEntry = begin + (int)count;
+                return true;
+            }
+        }
+        else {
+            int end = std::min(nextEntry + 1, highPos);
+            if (count < (size_t)(end - std::min(end, lowPos))) {
+                nextEntry = end - 1 - (int)count;
+                return true;
+            }
+        }
+    }
+
+    /* Otherwise the ranks of the bounds place the entry the offset lands on, and the subtree counts lead down to its
+       leaf without visiting the leaves before it. */
+    std::unique_lock<std::mutex> appendLock = index->settleAppends<T>();
+    long long low = index->rankTyped(scanLowVal<T>(), lowOp == GT);
+    long long high = index->rankTyped(scanHighVal<T>(), highOp == LTE);
+    if (high <= low || (unsigned long long)(high - low) <= count) {
+        /* The range ends before the offset, the scan is left on its first leaf */
+        if (index->concurrencyMode == BLINK)
+            getFirstLeafOptimistic<T>();
+        else
+            getFirstParent<T>();
+        return false;
+    }
+    moveToRank<T>(descending ? high - 1 - (long long)count : low + (long long)count);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::moveToRank
+// -----------------------------------------------------------------------------
+template <class T>
+void IndexScanCursor::moveToRank(long long rank)
+{
+    /* Take the child whose entries cover the rank, like BTreeIndex::selectKthTyped() */
+    Page* page;
+    PageId pageNum = index->latchRoot(page, false);
+    while (true) {
+        auto node = (NonLeafNode<T>*)page;
+        int numKeys = node->numKeys, idx = 0;
+        while (idx < numKeys && rank >= node->countArray[idx])
+            rank -= node->countArray[idx++];
+
+        bool leafNext = node->level == 1;
+        PageId childPageNum = node->pageNoArray[idx];
+        Page* childPage;
+        index->bufMgr->readPage(index->file, childPageNum, childPage);
+        index->bufMgr->latchPage(index->file, childPageNum, false);
+        index->releasePage(pageNum, false);
+
+        pageNum = childPageNum;
+        page = childPage;
+        if (leafNext)
+            break;
+    }
+
+    /* Writers latch leaves in both modes, so the copy of the leaf is taken under the latch */
+    LeafEntries<T>& leaf = leafEntries<T>();
+    index->readLeafEntries(page, leaf, true);
+    index->releasePage(pageNum, false);
+    currentPageNum = pageNum;
+
+    int count = leaf.numEntries, i = 0;
+    long long skipped = 0;
+    for (; i < count; i++) {
+        int numRids = index->ridCount(leaf.ridArray[i]);
+        if (rank < numRids) {
+            /* The record ids of a posting list come in list order in either direction */
+            skipped = descending ? numRids - 1 - rank : rank;
+            break;
+        }
+        rank -= numRids;
+    }
+    nextEntry = descending ? std::min(i, count - 1) : i;
+
+    /* An offset landing inside a posting list starts the scan part way through it */
+    if (i < count && skipped > 0) {
+        copyPostingPage(leaf.ridArray[i].page_number);
+        RecordId rids[64];
+        while (skipped > 0)
+            skipped -= readPostingRids(rids, (size_t)std::min<long long>(skipped, 64));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// IndexScanCursor::endScan
+// -----------------------------------------------------------------------------
+//
+void IndexScanCursor::endScan()
+{
+    /* check scan */
+    if (!scanExecuting)
+        throw ScanNotInitializedException();
+
+    /* End scan, the cursor holds no page between calls */
+    scanExecuting = false;
+}
+
+// -----------------------------------------------------------------------------
+// MultiIndexBuilder::MultiIndexBuilder -- Constructor
+// -----------------------------------------------------------------------------
+MultiIndexBuilder::MultiIndexBuilder(const std::string& relationNameIn, BufMgr* bufMgrIn)
+    : relationName(relationNameIn), bufMgr(bufMgrIn)
+{
+}
+
+// -----------------------------------------------------------------------------
+// MultiIndexBuilder::addIndex
+// -----------------------------------------------------------------------------
+void MultiIndexBuilder::addIndex(const int attrByteOffset,
+    const Datatype attrType,
+    const double fillFactor,
+    const ConcurrencyMode concurrencyMode,
+    const bool appendMode,
+    const SplitPolicy& splitPolicy,
+    const LeafFormat leafFormat)
+{
+    IndexSpec spec = {attrByteOffset, attrType, fillFactor, concurrencyMode, appendMode, splitPolicy, leafFormat};
+    specs.push_back(spec);
+}
+
+// -----------------------------------------------------------------------------
+// MultiIndexBuilder::build
+// -----------------------------------------------------------------------------
+std::vector<BTreeIndex*> MultiIndexBuilder::build(std::vector<std::string>& outIndexNames)
+{
+    /* Pages of records each build may hold queued */
+    const size_t queueCapacity = 8;
+
+    /* The file of an index is named by its attribute offset, two indexes on one offset would build into one file */
+    for (size_t i = 0; i < specs.size(); i++)
+        for (size_t j = 0; j < i; j++)
+            if (specs[i].attrByteOffset == specs[j].attrByteOffset)
+                throw BadIndexInfoException("ERROR TWO INDEXES ON ONE ATTRIBUTE");
+
+    PageFile relation(relationName, false);
+    size_t numIndexes = specs.size();
+    std::vector<BTreeIndex*> indexes(numIndexes, nullptr);
+    std::vector<std::exception_ptr> errors(numIndexes);
+    std::vector<std::unique_ptr<RecordQueue> > queues;
+    outIndexNames.assign(numIndexes, std::string());
+
+    /* One thread per index builds it from its queue, then abandons the queue in case it took no records */
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < numIndexes; i++) {
+        queues.push_back(std::unique_ptr<RecordQueue>(new RecordQueue(queueCapacity)));
+        threads.push_back(std::thread([&, i]() {
+            const IndexSpec& spec = specs[i];
+            try {
+                indexes[i] = new BTreeIndex(relationName, outIndexNames[i], bufMgr, spec.attrByteOffset, spec.attrType,
+                                            spec.fillFactor, spec.concurrencyMode, spec.appendMode, spec.splitPolicy,
+                                            spec.leafFormat, 1, queues[i].get());
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+            queues[i]->abandon();
+        }));
+    }
+
+    /* Read the relation once, a page at a time, and hand each page of records to every build */
+    std::exception_ptr readError;
+    try {
+        for (FileIterator iter = relation.begin(); iter != relation.end(); iter++) {
+            Page page = *iter;
+            auto batch = std::make_shared<RecordBatch>();
+            for (PageIterator recordIter = page.begin(); recordIter != page.end(); recordIter++)
+                batch->push_back(std::make_pair(recordIter.getCurrentRecord(), *recordIter));
+            for (auto& queue : queues)
+                queue->push(batch);
+        }
+    }
+    catch (...) {
+        readError = std::current_exception();
+    }
+    for (auto& queue : queues)
+        queue->close();
+    for (auto& thread : threads)
+        thread.join();
+
+    /* On any error none of the indexes is handed out */
+    if (!readError) {
+        for (auto& error : errors) {
+            if (error) {
+                readError = error;
+                break;
+            }
+        }
+    }
+    if (readError) {
+        for (auto index : indexes)
+            delete index;
+        std::rethrow_exception(readError);
+    }
+    return indexes;
+}
+
 }
@@ -10,9 +10,17 @@
 #pragma once
 
 #include <iostream>
+#include <cstdint>
 #include <string>
+#include <stack>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <pthread.h>
 #include "string.h"
 #include <sstream>
+#include <vector>
 
 #include "types.h"
 #include "page.h"
@@ -43,18 +51,178 @@ namespace badgerdb
         GT		/* Greater Than */
     };
 
+/**
+ * @brief Order in which a scan returns the entries of its range. Passed to BTreeIndex::startScan() method.
+ */
+    enum ScanOrder
+    {
+        ASCENDING,	/* From the low bound up, following right links */
+        DESCENDING	/* From the high bound down, following left links */
+    };
+
+/**
+ * @brief Row limit of a scan that returns every entry of its range. Passed to BTreeIndex::startScan() method.
+ */
+    const size_t NO_SCAN_LIMIT = (size_t)-1;
+
+/**
+ * @brief One range of a multi-range scan, passed to BTreeIndex::startScan(). The values point to an
+ * integer/double/char string like the bounds of a single range scan. An IN-list value is a range
+ * with the value as both bounds, GTE and LTE.
+ */
+    struct KeyRange{
+        const void* lowVal;
+        Operator lowOp;
+        const void* highVal;
+        Operator highOp;
+    };
+
+/**
+ * @brief How readers of a BTreeIndex synchronize with concurrent inserts. Passed to the BTreeIndex constructor.
+ */
+    enum ConcurrencyMode
+    {
+        LATCH_COUPLING,	/* Readers couple shared page latches and copy each leaf under its latch */
+        BLINK			/* Readers take no latches, they validate node versions and follow right links past splits */
+    };
+
+/**
+ * @brief How the leaves of a BTreeIndex store entries. Passed to the BTreeIndex constructor when the index is
+ * created and kept in its meta page.
+ */
+    enum LeafFormat
+    {
+        PLAIN_LEAVES,		/* Every entry is a key and record id pair */
+        POSTING_LIST_LEAVES,	/* Long runs of one key are stored as the key once and a posting list of record ids */
+        COMPRESSED_LEAVES	/* INTEGER keys only, keys and record ids are frame-of-reference coded and bit packed */
+    };
+
+
+/**
+ * @brief Number of leading characters of a STRING attribute that make up its key.
+ */
+    const  int STRINGSIZE = 10;
+
+/**
+ * @brief Key type for STRING attributes. Holds the first STRINGSIZE characters of the attribute,
+ * padded with '\0', and compares them the way strncmp does.
+ */
+    struct StringKey{
+        char data[ STRINGSIZE ];
+    };
+
+    inline bool operator<( const StringKey& k1, const StringKey& k2 ) { return strncmp( k1.data, k2.data, STRINGSIZE ) < 0; }
+    inline bool operator>( const StringKey& k1, const StringKey& k2 ) { return strncmp( k1.data, k2.data, STRINGSIZE ) > 0; }
+    inline bool operator<=( const StringKey& k1, const StringKey& k2 ) { return strncmp( k1.data, k2.data, STRINGSIZE ) <= 0; }
+    inline bool operator>=( const StringKey& k1, const StringKey& k2 ) { return strncmp( k1.data, k2.data, STRINGSIZE ) >= 0; }
+    inline bool operator==( const StringKey& k1, const StringKey& k2 ) { return strncmp( k1.data, k2.data, STRINGSIZE ) == 0; }
+    inline bool operator!=( const StringKey& k1, const StringKey& k2 ) { return strncmp( k1.data, k2.data, STRINGSIZE ) != 0; }
+
+/**
+ * @brief Copies a key of type T out of the attribute (or scan bound) it points to.
+ */
+    template <class T>
+    inline T readKey( const void* attr )
+    {
+        T key;
+        memcpy( &key, attr, sizeof( T ) );
+        return key;
+    }
+
+    template <>
+    inline StringKey readKey<StringKey>( const void* attr )
+    {
+        StringKey key;
+        strncpy( key.data, (const char*)attr, STRINGSIZE );
+        return key;
+    }
+
+/**
+ * @brief Number of key slots in B+Tree leaf and non-leaf nodes for a key of type T.
+ */
+    template <class T>
+    struct NodeSize{
+//                                    version, count    sibling ptrs           high key            key               rid
+        static const int LEAF = ( Page::SIZE - 2 * sizeof( int ) - 2 * sizeof( PageId ) - sizeof( T ) ) / ( sizeof( T ) + sizeof( RecordId ) );
+
+//                                 version, level, count, sibling ptr   high key (padded)                               extra pageNo, count                          key       pageNo             count
+        static const int NONLEAF = ( Page::SIZE - 4 * sizeof( int ) - ( sizeof( T ) > sizeof( int ) ? sizeof( T ) : sizeof( int ) ) - sizeof( PageId ) - sizeof( int ) ) / ( sizeof( T ) + sizeof( PageId ) + sizeof( int ) );
+    };
 
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
  */
-//                                                  sibling ptr             key               rid
-    const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( RecordId ) );
+    const  int INTARRAYLEAFSIZE = NodeSize<int>::LEAF;
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                     level     extra pageNo                  key       pageNo
-    const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
+    const  int INTARRAYNONLEAFSIZE = NodeSize<int>::NONLEAF;
+
+/**
+ * @brief Number of key slots in B+Tree leaf for DOUBLE key.
+ */
+    const  int DOUBLEARRAYLEAFSIZE = NodeSize<double>::LEAF;
+
+/**
+ * @brief Number of key slots in B+Tree non-leaf for DOUBLE key.
+ */
+    const  int DOUBLEARRAYNONLEAFSIZE = NodeSize<double>::NONLEAF;
+
+/**
+ * @brief Number of key slots in B+Tree leaf for STRING key.
+ */
+    const  int STRINGARRAYLEAFSIZE = NodeSize<StringKey>::LEAF;
+
+/**
+ * @brief Number of key slots in B+Tree non-leaf for STRING key.
+ */
+    const  int STRINGARRAYNONLEAFSIZE = NodeSize<StringKey>::NONLEAF;
+
+    class BTreeIndex;
+    class RecordQueue;
+
+/**
+ * @brief Default fraction of the slots in each node that is filled when the index is bulk loaded.
+ */
+    const double BULKLOAD_FILL_FACTOR = 1.0;
+
+/**
+ * @brief Number of lookups BTreeIndex::multiLookup() keeps in flight at a time.
+ */
+    const int MULTI_LOOKUP_GROUP = 8;
+
+/**
+ * @brief Where a full node is split when an insert overflows it.
+ */
+    enum SplitKind
+    {
+        EVEN_SPLIT,			/* Half of the entries stay in the left node */
+        LEFT_BIASED_SPLIT,	/* The left node keeps the bias fraction of the entries, suits increasing keys */
+        RIGHT_BIASED_SPLIT,	/* The left node keeps 1 - bias of the entries, suits decreasing keys */
+        ADAPTIVE_SPLIT		/* The split follows the position of the new entry, bounded by the two biased splits */
+    };
+
+/**
+ * @brief Split policy of a BTreeIndex, passed to its constructor. Fuller nodes after a split save space
+ * but split again sooner when keys keep landing in them.
+ */
+    class SplitPolicy{
+    public:
+        SplitKind kind;
+        double bias;
+
+        SplitPolicy( SplitKind k = EVEN_SPLIT, double b = 0.9 )
+            : kind( k ), bias( b )
+        {
+        }
+
+        /**
+         * Returns how many of the size entries of a full node stay in the left node when a new entry that goes
+         * at insertPos overflows it. Both nodes keep at least one entry.
+         */
+        int splitPoint( int size, int insertPos ) const;
+    };
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that
@@ -72,6 +240,15 @@ namespace badgerdb
         }
     };
 
+/**
+ * @brief Entry of a batch passed to BTreeIndex::insertBatch(): a key, pointing to an integer/double/char string
+ * like the key of BTreeIndex::insertEntry(), and the record id of its record.
+*/
+    struct KeyRid{
+        const void* key;
+        RecordId rid;
+    };
+
 /**
  * @brief Structure to store a key page pair which is used to pass the key and page to functions that make
  * any modifications to the non leaf pages of the tree.
@@ -102,13 +279,44 @@ namespace badgerdb
             return r1.rid.page_number < r2.rid.page_number;
     }
 
+/**
+ * @brief Statistics of a BTreeIndex, kept up to date by inserts and deletes and stored in its meta page, so that
+ * they are known without scanning the index. See BTreeIndex::getStats().
+*/
+    struct IndexStats{
+        /**
+         * Number of levels, the root and the leaves included. The root of an empty index has no leaves yet and makes a height of 1.
+         */
+        int height;
+
+        /**
+         * Number of leaves.
+         */
+        int numLeaves;
+
+        /**
+         * Number of entries, one per record id, whether it is in a leaf or in a posting list.
+         */
+        long long numEntries;
+
+        /**
+         * Lowest and highest key in the index, stored like a key in a leaf: an int, a double or the first STRINGSIZE
+         * characters of a string. Unset while the index is empty.
+         */
+        char minKey[ STRINGSIZE ];
+        char maxKey[ STRINGSIZE ];
+    };
+
+    static_assert( sizeof( int ) <= STRINGSIZE && sizeof( double ) <= STRINGSIZE, "Keys of every type must fit in IndexStats" );
+
 /**
  * @brief The meta page, which holds metadata for Index file, is always first page of the btree index file and is cast
  * to the following structure to store or retrieve information from it.
  * Contains the relation name for which the index is created, the byte offset
  * of the key value on which the index is made, the type of the key and the page no
  * of the root page. Root page starts as page 2 but since a split can occur
- * at the root the root page may get moved up and get a new page no.
+ * at the root the root page may get moved up and get a new page no, which is written
+ * back here along with the statistics of the index.
 */
     struct IndexMetaInfo{
         /**
@@ -130,6 +338,32 @@ namespace badgerdb
          * Page number of root page of the B+ Tree inside the file index file.
          */
         PageId rootPageNo;
+
+        /**
+         * Page number of the first page in the chain of pages freed by node merges, if any.
+         */
+        PageId freePageNo;
+
+        /**
+         * How the leaves store entries.
+         */
+        LeafFormat leafFormat;
+
+        /**
+         * Statistics of the index as of the last change to the shape of the tree or the last time the index was closed.
+         */
+        IndexStats stats;
+    };
+
+/**
+ * @brief Structure for an index page freed by a node merge. Freed pages are chained from
+ * IndexMetaInfo::freePageNo and reused by the next node allocations before the file is extended.
+*/
+    struct FreeNode{
+        /**
+         * Page number of the next freed page, Page::INVALID_NUMBER at the end of the chain.
+         */
+        PageId nextFreePageNo;
     };
 
 /*
@@ -137,101 +371,280 @@ Each node is a page, so once we read the page in we just cast the pointer to the
 These structures basically are the format in which the information is stored in the pages for the index file depending on what kind of
 node they are. The level memeber of each non leaf structure seen below is set to 1 if the nodes
 at this level are just above the leaf nodes. Otherwise set to 0.
+Every node is linked to its right neighbour on the same level and carries a high key, the first key
+of that neighbour's range, so that a reader that lands on a node split since it looked at the parent
+finds the rest of the range through the right link. Leaves are linked to their left neighbour as well,
+for descending scans. Writers make the version odd while they change
+a node, readers that take no latches re-read the version to check that what they read is consistent.
 */
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all non-leaf nodes, templated on the key type.
 */
-    struct NonLeafNodeInt{
+    template <class T>
+    struct NonLeafNode{
+        /**
+         * Version counter, odd while a writer is changing the node.
+         */
+        std::atomic<unsigned int> version;
+
         /**
          * Level of the node in the tree.
          */
         int level;
 
+        /**
+         * Number of keys in use, the node has one child more. The root of an empty tree has no child at all.
+         */
+        int numKeys;
+
+        /**
+         * Page number of the node on the right side on the same level, Page::INVALID_NUMBER for the last one.
+         */
+        PageId rightSibPageNo;
+
+        /**
+         * Keys at or above the high key belong to the nodes on the right. Unused without a right sibling.
+         */
+        T highKey;
+
         /**
          * Stores keys.
          */
-        int keyArray[ INTARRAYNONLEAFSIZE ];
+        T keyArray[ NodeSize<T>::NONLEAF ];
 
         /**
          * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
          */
-        PageId pageNoArray[ INTARRAYNONLEAFSIZE + 1 ];
+        PageId pageNoArray[ NodeSize<T>::NONLEAF + 1 ];
+
+        /**
+         * Number of entries, one per record id, in the subtree of each child. An insert counts its entry on the way
+         * down while it holds each node latched, so the counts change without a version change.
+         */
+        int countArray[ NodeSize<T>::NONLEAF + 1 ];
     };
 
 
 /**
- * @brief Structure for all leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all leaf nodes, templated on the key type.
 */
-    struct LeafNodeInt{
+    template <class T>
+    struct LeafNode{
         /**
-         * Stores keys.
+         * Version counter, odd while a writer is changing the node.
          */
-        int keyArray[ INTARRAYLEAFSIZE ];
+        std::atomic<unsigned int> version;
 
         /**
-         * Stores RecordIds.
+         * Number of entries in use, they fill the front of keyArray and ridArray.
          */
-        RecordId ridArray[ INTARRAYLEAFSIZE ];
+        int numEntries;
 
         /**
          * Page number of the leaf on the right side.
            * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
          */
         PageId rightSibPageNo;
+
+        /**
+         * Page number of the leaf on the left side, Page::INVALID_NUMBER for the first one. A split of that leaf
+         * links the new leaf in between only after it is complete, so a descending scan that finds the leaf on
+         * the left no longer linked to this one follows its right links up to this one.
+         */
+        PageId leftSibPageNo;
+
+        /**
+         * Keys at or above the high key belong to the leaves on the right. Unused without a right sibling.
+         */
+        T highKey;
+
+        /**
+         * Stores keys.
+         */
+        T keyArray[ NodeSize<T>::LEAF ];
+
+        /**
+         * Stores RecordIds.
+         */
+        RecordId ridArray[ NodeSize<T>::LEAF ];
     };
 
+    typedef NonLeafNode<int>        NonLeafNodeInt;
+    typedef NonLeafNode<double>     NonLeafNodeDouble;
+    typedef NonLeafNode<StringKey>  NonLeafNodeString;
+    typedef LeafNode<int>           LeafNodeInt;
+    typedef LeafNode<double>        LeafNodeDouble;
+    typedef LeafNode<StringKey>     LeafNodeString;
+
+    static_assert( sizeof( NonLeafNodeInt ) <= Page::SIZE && sizeof( LeafNodeInt ) <= Page::SIZE, "INTEGER nodes must fit in a page" );
+    static_assert( sizeof( NonLeafNodeDouble ) <= Page::SIZE && sizeof( LeafNodeDouble ) <= Page::SIZE, "DOUBLE nodes must fit in a page" );
+    static_assert( sizeof( NonLeafNodeString ) <= Page::SIZE && sizeof( LeafNodeString ) <= Page::SIZE, "STRING nodes must fit in a page" );
 
 /**
- * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
- * relation. This index supports only one scan at a time.
+ * @brief Number of record ids in a posting list page.
+ */
+//                                version, count    next ptr                rid
+    const int POSTINGARRAYSIZE = ( Page::SIZE - 2 * sizeof( int ) - sizeof( PageId ) ) / sizeof( RecordId );
+
+/**
+ * @brief Structure for the pages of a posting list. With POSTING_LIST_LEAVES, a run of entries with the same key
+ * that grows to half a leaf is replaced by a single leaf entry whose record id has slot Page::INVALID_SLOT, which
+ * no record uses, and the page number of the first page of the posting list. The list holds the record ids of the
+ * run sorted, over a chain of pages. Posting list pages are changed only while their leaf is latched exclusive,
+ * and like nodes they are versioned for readers that take no latches.
 */
-    class BTreeIndex {
+    struct PostingNode{
+        /**
+         * Version counter, odd while a writer is changing the page.
+         */
+        std::atomic<unsigned int> version;
 
-    private:
+        /**
+         * Number of record ids in use, they fill the front of ridArray.
+         */
+        int numRids;
 
         /**
-         * File object for the index file.
+         * Page number of the next page of the posting list, Page::INVALID_NUMBER for the last one.
          */
-        File		*file;
+        PageId nextPageNo;
 
         /**
-         * Buffer Manager Instance.
+         * Stores RecordIds, sorted across the pages of the list.
          */
-        BufMgr	*bufMgr;
+        RecordId ridArray[ POSTINGARRAYSIZE ];
+    };
+
+    static_assert( sizeof( PostingNode ) <= Page::SIZE, "Posting list pages must fit in a page" );
+
+/**
+ * @brief Returns true if the record id of a leaf entry refers to a posting list rather than a record.
+ */
+    inline bool isPostingList( const RecordId& rid )
+    {
+        return rid.slot_number == Page::INVALID_SLOT;
+    }
+
+/**
+ * @brief Number of bytes for the packed entries of a compressed leaf, including the padding the bit packing needs after them.
+ */
+//                                         version, count, high key, key base   sibling ptrs, page base     bit widths
+    const int COMPRESSEDLEAFDATASIZE = Page::SIZE - 4 * sizeof( int ) - 3 * sizeof( PageId ) - 4 * sizeof( unsigned char );
 
+/**
+ * @brief Most entries a compressed leaf holds: one short of twice what fits at the widest coding, so that
+ * either half of a leaf that overflows always fits in a leaf of its own.
+ */
+    const int COMPRESSEDLEAFSIZE = 2 * ( ( COMPRESSEDLEAFDATASIZE - (int)sizeof( uint64_t ) )
+                                         / (int)( sizeof( int ) + sizeof( PageId ) + sizeof( SlotId ) ) ) - 1;
+
+/**
+ * @brief Structure for the leaves of an index created with COMPRESSED_LEAVES. The header is the one of
+ * LeafNode<int>, so code that only reads the header handles both alike. The entries are stored in three
+ * bit-packed columns, see leaf_codec.h: the keys and the page numbers of the record ids as offsets from the
+ * lowest of them, the slot numbers as they are, each column with as many bits as its largest value needs.
+ * Entries are decoded to be read and the whole leaf is coded again when they change.
+*/
+    struct CompressedLeafNode{
         /**
-         * Page number of meta page.
+         * Version counter, odd while a writer is changing the node.
          */
-        PageId	headerPageNum;
+        std::atomic<unsigned int> version;
 
         /**
-         * page number of root page of B+ tree inside index file.
+         * Number of entries in use.
          */
-        PageId	rootPageNum;
+        int numEntries;
 
         /**
-         * Datatype of attribute over which index is built.
+         * Page number of the leaf on the right side.
          */
-        Datatype	attributeType;
+        PageId rightSibPageNo;
 
         /**
-         * Offset of attribute, over which index is built, inside records.
+         * Page number of the leaf on the left side.
          */
-        int 		attrByteOffset;
+        PageId leftSibPageNo;
 
         /**
-         * Number of keys in leaf node, depending upon the type of key.
+         * Keys at or above the high key belong to the leaves on the right. Unused without a right sibling.
          */
-        int			leafOccupancy;
+        int highKey;
 
         /**
-         * Number of keys in non-leaf node, depending upon the type of key.
+         * Lowest key, the keys are stored as offsets from it.
          */
-        int			nodeOccupancy;
+        int keyBase;
+
+        /**
+         * Lowest page number of the record ids, which are stored as offsets from it.
+         */
+        PageId pageBase;
+
+        /**
+         * Bits per key, page number and slot number.
+         */
+        unsigned char keyBits;
+        unsigned char pageBits;
+        unsigned char slotBits;
+        unsigned char unused;
+
+        /**
+         * The key column, followed by the page number and the slot number columns.
+         */
+        unsigned char data[ COMPRESSEDLEAFDATASIZE ];
+    };
+
+    static_assert( sizeof( CompressedLeafNode ) <= Page::SIZE, "Compressed leaves must fit in a page" );
+
+/**
+ * @brief The entries of a leaf as arrays, like the ones of LeafNode. They point into a plain leaf itself, or
+ * into the buffers when the entries are copied out of the leaf or decoded from a compressed one.
+*/
+    template <class T>
+    struct LeafEntries{
+        const T* keyArray;
+        const RecordId* ridArray;
+        int numEntries;
+        PageId rightSibPageNo;
+        PageId leftSibPageNo;
+        T highKey;
+        std::vector<T> keyBuffer;
+        std::vector<RecordId> ridBuffer;
+    };
+
+/**
+ * @brief Range of a multi-range scan with its bounds read as keys of type T.
+*/
+    template <class T>
+    struct ScanRange{
+        T lowVal;
+        Operator lowOp;
+        T highVal;
+        Operator highOp;
+    };
+
 
+/**
+ * @brief Scan over a range of a BTreeIndex. Each cursor holds its own scan state and works on a copy
+ * of the leaf it is positioned on, so any number of cursors can be open on one index at once, from
+ * any number of threads. A cursor is used by one thread at a time, which may change between calls.
+ * The copy is taken under a shared latch of the leaf, coupled down from the root or from the leaf
+ * before, and the latch is let go before the call returns. On a BLINK index the copy is instead
+ * taken without any latch, once no writer is changing the leaf. Either way a cursor holds nothing
+ * on the index between calls, and a thread may insert while it has cursors open.
+ * Cursors must be ended before the index is destroyed, and entries must not be deleted from the
+ * index while cursors are open on it.
+*/
+    class IndexScanCursor {
+
+    private:
 
-        // MEMBERS SPECIFIC TO SCANNING
+        /**
+         * Index being scanned.
+         */
+        BTreeIndex	*index;
 
         /**
          * True if an index scan has been started.
@@ -249,9 +662,28 @@ at this level are just above the leaf nodes. Otherwise set to 0.
         PageId	currentPageNum;
 
         /**
-         * Current Page being scanned.
+         * Entries of the current leaf for each key type, a copy of the leaf taken under its latch, or once no
+         * writer was changing it on a BLINK index, or its decoded entries if it is compressed.
+         */
+        LeafEntries<int>		intEntries;
+        LeafEntries<double>		doubleEntries;
+        LeafEntries<StringKey>	stringEntries;
+
+        /**
+         * Page number of the posting list page being scanned, Page::INVALID_NUMBER outside of a posting list.
+         * The leaf entry of the list stays at nextEntry until the whole list is scanned.
+         */
+        PageId	postingPageNum;
+
+        /**
+         * Index of the next record id to be scanned in postingCopy.
          */
-        Page		*currentPageData;
+        int			postingEntry;
+
+        /**
+         * Consistent copy of the posting list page being scanned.
+         */
+        Page		postingCopy;
 
         /**
          * Low INTEGER value for scan.
@@ -266,7 +698,7 @@ at this level are just above the leaf nodes. Otherwise set to 0.
         /**
          * Low STRING value for scan.
          */
-        std::string	lowValString;
+        StringKey	lowValString;
 
         /**
          * High INTEGER value for scan.
@@ -281,7 +713,26 @@ at this level are just above the leaf nodes. Otherwise set to 0.
         /**
          * High STRING value for scan.
          */
-        std::string highValString;
+        StringKey	highValString;
+
+        /**
+         * True if the scan runs from the high bound down, nextEntry then is the next entry to the left.
+         */
+        bool		descending;
+
+        /**
+         * Number of record ids the scan may still return before it is completed.
+         */
+        size_t	remaining;
+
+        /**
+         * Ranges of a multi-range scan for each key type, empty for a single range scan. The scan bounds
+         * hold the range being scanned, nextRange is the one after it.
+         */
+        std::vector<ScanRange<int> >		intRanges;
+        std::vector<ScanRange<double> >		doubleRanges;
+        std::vector<ScanRange<StringKey> >	stringRanges;
+        size_t	nextRange;
 
         /**
          * Low Operator. Can only be GT(>) or GTE(>=).
@@ -293,61 +744,792 @@ at this level are just above the leaf nodes. Otherwise set to 0.
          */
         Operator	highOp;
 
-//-------------------------- User Functions ------------------------------------------------#
+        /**
+         * Sets up the scan range and positions the scan at the first leaf entry that can be in it
+         */
+        template <class T>
+        void startScanTyped(const void* lowValParm, const void* highValParm);
 
         /**
-         * Splits the leaf node and returns pointer to a page containing the new node.
+         * Reads and checks the ranges of a multi-range scan, then sets up the first one like startScanTyped()
          */
-        PageId splitLeafNode(LeafNodeInt* dataNode, int& intKey, RecordId rid);
+        template <class T>
+        void startMultiScanTyped(const KeyRange* ranges, size_t numRanges);
 
+        /**
+         * Moves a multi-range scan on to its next range, from the current leaf if the range starts in it and
+         * from the root otherwise. Returns false once there is no range left.
+         */
+        template <class T>
+        bool moveToNextRange();
 
         /**
-         * Splits the non-leaf node and returns pointer to a page containing the new node.
+         * Fetches the record id of the next entry in the scan range
          */
-        PageId splitNonLeafNode(NonLeafNodeInt* node, int& intKey, PageId pageId);
+        template <class T>
+        void scanNextTyped(RecordId& outRid);
 
         /**
-         * Insert a key and record Id pair into a leaf node
+         * Copies the record ids of the next entries in the scan range, a leaf at a time
          */
-        bool insertKeyInLeafNode(LeafNodeInt* node, int key, RecordId rid);
+        template <class T>
+        size_t scanNextBatchTyped(RecordId* outRids, size_t maxRids);
 
         /**
-         * Insert a key and pageId pair into a non-leaf node
+         * Same as scanNextTyped() and scanNextBatchTyped() for a descending scan
          */
-        bool insertKeyInNonLeafNode(NonLeafNodeInt* node, int key, PageId pageId);
+        template <class T>
+        void scanPrevTyped(RecordId& outRid);
+        template <class T>
+        size_t scanPrevBatchTyped(RecordId* outRids, size_t maxRids);
 
         /**
-         * Clears the Leaf node entry at index i
+         * Moves the scan past its next count record ids. An offset within the start leaf moves along it, a longer
+         * one is turned into the rank of the entry it lands on from the ranks of the bounds of the range, and the
+         * subtree counts of the non-leaf nodes lead down to that entry, so no leaf before it is read.
+         * @return False if the range holds count record ids or fewer, the scan is then left on its first leaf
          */
-        void clearLeafNodeAtIdx(LeafNodeInt* node, int idx);
+        template <class T>
+        bool skipEntries(size_t count);
 
         /**
-         * Clears the Non-Leaf node entry at index i
+         * Moves the scan to the entry at position rank of the index, counted from its first entry, descending
+         * by the subtree counts like BTreeIndex::selectKthTyped().
          */
-        void clearNonLeafNodeAtIdx(NonLeafNodeInt* node, int idx);
+        template <class T>
+        void moveToRank(long long rank);
 
         /**
-         * Scans the tree to search for first non-leaf node to be scanned
+         * Low and high bounds of the scan for the key type T
          */
-        void getFirstParent(PageId pageNum);
-//----------------------------------------------------------------------------------#
+        template <class T>
+        T& scanLowVal();
+        template <class T>
+        T& scanHighVal();
 
-    public:
+        /**
+         * Entries of the current leaf for the key type T
+         */
+        template <class T>
+        LeafEntries<T>& leafEntries();
 
         /**
-         * BTreeIndex Constructor.
-         * Check to see if the corresponding index file exists. If so, open the file.
-         * If not, create it and insert entries for every tuple in the base relation using FileScan class.
-         *
-         * @param relationName        Name of file.
+         * Ranges of a multi-range scan for the key type T
+         */
+        template <class T>
+        std::vector<ScanRange<T> >& scanRanges();
+
+        /**
+         * Position in keys[0, count) of the first key not below the scan range, or if upper of the first key above
+         * it. Picks the child of a non-leaf node to descend into as well.
+         */
+        template <class T>
+        int rangeBound(const T* keys, int count, bool upper);
+
+        /**
+         * Returns true if the start of the scan lies right of a node with the given high key
+         */
+        template <class T>
+        bool startsRightOf(const T& highKey);
+
+        /**
+         * Scans the tree from the root, coupling shared latches, and copies the first leaf to be scanned
+         */
+        template <class T>
+        void getFirstParent();
+
+        /**
+         * Scans the tree from the root without latches, chasing right links past concurrent splits, and copies the first leaf to be scanned
+         */
+        template <class T>
+        void getFirstLeafOptimistic();
+
+        /**
+         * Copies the entries of a leaf once no writer is changing it, following right links while the scan starts past
+         * its high key, or, given leftOf, until the leaf copied is the left neighbour of leftOf
+         */
+        template <class T>
+        void copyLeaf(PageId pageNum, PageId leftOf = Page::INVALID_NUMBER);
+
+        /**
+         * Moves the scan on to the right sibling of the current leaf
+         */
+        template <class T>
+        void moveToRightSibling(PageId rightSibPageNo);
+
+        /**
+         * Moves a descending scan on to the left sibling of the current leaf, or to the leaves split off it since
+         * the link was read
+         */
+        template <class T>
+        void moveToLeftSibling(PageId leftSibPageNo);
+
+        /**
+         * Copies a posting list page into postingCopy once no writer is changing it and scans it from its start
+         */
+        void copyPostingPage(PageId pageNum);
+
+        /**
+         * Copies up to maxRids next record ids of the posting list being scanned, moving on to the next leaf entry
+         * once it is used up. Returns how many were copied.
+         */
+        size_t readPostingRids(RecordId* outRids, size_t maxRids);
+
+    public:
+
+        /**
+         * IndexScanCursor Constructor. The cursor starts out with no scan executing.
+         * @param indexIn	Index to scan
+         */
+        explicit IndexScanCursor(BTreeIndex *indexIn);
+
+        /**
+         * IndexScanCursor Destructor. Ends the scan if one is executing, without throwing.
+         */
+        ~IndexScanCursor();
+
+        /**
+         * Begin a filtered scan of the index, with the same semantics as BTreeIndex::startScan().
+         * If this cursor is already executing a scan, that is ended here. Scans of other cursors are not affected.
+         * @param lowVal	Low value of range, pointer to integer / double / char string
+         * @param lowOp		Low operator (GT/GTE)
+         * @param highVal	High value of range, pointer to integer / double / char string
+         * @param highOp	High operator (LT/LTE)
+         * @param order		Whether the entries come from the low bound up or from the high bound down
+         * @param limit		Maximum number of record ids the scan returns
+         * @param offset	Number of record ids of the range, in scan order, skipped before the first one returned
+         * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+         * @throws  BadScanrangeException If lowVal > highval
+         * @throws  NoSuchKeyFoundException If the index is empty.
+         */
+        void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+                       const ScanOrder order = ASCENDING, const size_t limit = NO_SCAN_LIMIT, const size_t offset = 0);
+
+        /**
+         * Begin an ascending scan of several ranges, with the same semantics as BTreeIndex::startScan().
+         * If this cursor is already executing a scan, that is ended here. Scans of other cursors are not affected.
+         * @param ranges		Ranges sorted by their bounds, that do not overlap
+         * @param numRanges	Number of ranges, at least one
+         * @throws  BadOpcodesException If an operator of a range does not contain one of its expected values
+         * @throws  BadScanrangeException If there is no range, a range is empty or the ranges are not sorted
+         * @throws  NoSuchKeyFoundException If the index is empty.
+         */
+        void startScan(const KeyRange* ranges, size_t numRanges);
+
+        /**
+         * Fetch the record id of the next index entry that matches the scan.
+         * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+         * @throws ScanNotInitializedException If no scan has been initialized.
+         * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+         */
+        void scanNext(RecordId& outRid);
+
+        /**
+         * Fetch the record ids of up to maxRids next index entries that match the scan, copying
+         * the qualifying entries of each leaf in one pass. Unlike scanNext the end of the scan is
+         * reported through the return value rather than an exception.
+         * @param outRids	Array receiving the record ids, room for at least maxRids of them
+         * @param maxRids	Maximum number of record ids to return
+         * @return Number of record ids returned, less than maxRids only once the scan is exhausted, 0 after that
+         * @throws ScanNotInitializedException If no scan has been initialized.
+         */
+        size_t scanNextBatch(RecordId* outRids, size_t maxRids);
+
+        /**
+         * Terminate the scan. Reset scan specific variables.
+         * @throws ScanNotInitializedException If no scan has been initialized.
+         */
+        void endScan();
+
+    private:
+        IndexScanCursor(const IndexScanCursor&);
+        IndexScanCursor& operator=(const IndexScanCursor&);
+    };
+
+
+/**
+ * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
+ * relation. The index runs one scan of its own through startScan(), more scans can be
+ * run at the same time through IndexScanCursor objects.
+ * Inserts and cursor scans are thread-safe. They couple page latches down the root-to-leaf
+ * path, and an insert lets go of the ancestors as soon as it reaches a node with room for one
+ * more entry. Deletes run alone. The scan of the index itself belongs to one thread at a time.
+ * In BLINK mode readers take no latches at all and never wait for a splitting writer, see ConcurrencyMode.
+*/
+    class BTreeIndex {
+
+        friend class IndexScanCursor;
+        friend class MultiIndexBuilder;
+
+    private:
+
+        /**
+         * File object for the index file.
+         */
+        File		*file;
+
+        /**
+         * Buffer Manager Instance.
+         */
+        BufMgr	*bufMgr;
+
+        /**
+         * Page number of meta page.
+         */
+        PageId	headerPageNum;
+
+        /**
+         * page number of root page of B+ tree inside index file. A root split moves it while
+         * other threads may be reading it.
+         */
+        std::atomic<PageId>	rootPageNum;
+
+        /**
+         * Page number of the first freed page available for reuse.
+         */
+        PageId	freePageNum;
+
+        /**
+         * Datatype of attribute over which index is built.
+         */
+        Datatype	attributeType;
+
+        /**
+         * Offset of attribute, over which index is built, inside records.
+         */
+        int 		attrByteOffset;
+
+        /**
+         * Number of keys in leaf node, depending upon the type of key.
+         */
+        int			leafOccupancy;
+
+        /**
+         * Number of keys in non-leaf node, depending upon the type of key.
+         */
+        int			nodeOccupancy;
+
+        /**
+         * How readers synchronize with concurrent inserts.
+         */
+        ConcurrencyMode	concurrencyMode;
+
+        /**
+         * Whether inserts are expected in increasing key order. Keys above every key in the index are then
+         * appended to the right-most leaf, latching no other node, and the right-most nodes split off only the
+         * new entry.
+         */
+        bool	appendMode;
+
+        /**
+         * Where full nodes are split.
+         */
+        SplitPolicy	splitPolicy;
+
+        /**
+         * How the leaves store entries.
+         */
+        LeafFormat	leafFormat;
+
+
+        /**
+         * Scan started through startScan() of the index itself.
+         */
+        IndexScanCursor	scan;
+
+        /**
+         * Tree latch. Inserts and scans hold it shared and coordinate through page latches,
+         * deletes hold it exclusive since merges reshape the tree in every direction.
+         */
+        pthread_rwlock_t	treeLatch;
+
+        /**
+         * Serializes node page allocation and the freed page chain.
+         */
+        std::mutex	allocMutex;
+
+        /**
+         * Statistics of the index. The meta page gets them, with the root page number, whenever a split or merge
+         * changes the number of leaves or levels and when the index is closed.
+         */
+        IndexStats	stats;
+
+        /**
+         * Serializes changes to stats and their writes to the meta page.
+         */
+        std::mutex	statsMutex;
+
+        /**
+         * Right-most leaf the last insert in append mode reached, Page::INVALID_NUMBER until one does and after a
+         * delete. Appends go to it while it is still the right-most leaf.
+         */
+        PageId	appendLeafPageNum;
+
+        /**
+         * Entries appended to appendLeafPageNum that the nodes of the right edge do not count yet.
+         */
+        int	appendsUncounted;
+
+        /**
+         * In append mode, serializes inserts with each other and with the readers of the subtree counts, which
+         * count the pending appends first. Guards appendLeafPageNum and appendsUncounted.
+         */
+        std::mutex	appendMutex;
+
+//-------------------------- User Functions ------------------------------------------------#
+// The tree routines are templated on the key type, so each Datatype gets its own code. The public
+// functions only pick the instantiation matching attributeType.
+
+        /**
+         * Sets up an empty root and bulk loads it with the entries of every tuple in the base relation. Each of
+         * numThreads threads reads the entries of a run of consecutive page numbers of the relation from its file,
+         * past the buffer pool and through a descriptor of its own, and sorts them, then the sorted runs are merged
+         * pairwise, the pairs of each round in parallel. Given records, the tuples come from that queue instead.
+         */
+        template <class T>
+        void buildIndex(const std::string & relationName, double fillFactor, unsigned int numThreads, RecordQueue* records);
+
+        /**
+         * Collects the key rid pairs of every tuple in the base relation, sorted, see buildIndex()
+         */
+        template <class T>
+        void readRelation(const std::string & relationName, unsigned int numThreads, std::vector<RIDKeyPair<T> >& entries);
+
+        /**
+         * Collects the key rid pairs of the records passed through the queue until it is closed, sorted
+         */
+        template <class T>
+        void readRecords(RecordQueue* records, std::vector<RIDKeyPair<T> >& entries);
+
+        /**
+         * Inserts a key and record Id pair, in append mode into the last leaf if it takes it
+         */
+        template <class T>
+        void insertEntryTyped(T key, RecordId rid);
+
+        /**
+         * Inserts a key and record Id pair, starting from the root
+         */
+        template <class T>
+        void insertFromRoot(T key, RecordId rid);
+
+        /**
+         * Inserts the pair into the leaf at the top of path, splitting it and the nodes below it in path as needed,
+         * then releases path and counts the insert in the statistics along with the leaves and levels the descent
+         * added. path holds the nodes down to the leaf, latched exclusive, each already counting the entry.
+         */
+        template <class T>
+        void finishInsert(std::stack<std::pair<PageId, int> >& path, LeafNode<T>* dataNode, T key, RecordId rid,
+                          int newLeaves, int newLevels);
+
+        /**
+         * Sorts a batch and inserts it leaf by leaf, see insertBatch()
+         */
+        template <class T>
+        void insertBatchTyped(const KeyRid* batch, size_t n);
+
+        /**
+         * Places the sorted entries [begin, end), all in the range of the leaf, into it up to as many as it holds
+         * without a split, and returns how many it took
+         */
+        template <class T>
+        size_t fillLeaf(Page* page, const std::vector<RIDKeyPair<T> >& entries, size_t begin, size_t end);
+
+        /**
+         * Splits the leaf node and returns pointer to a page containing the new node.
+         */
+        template <class T>
+        PageId splitLeafNode(PageId pageNum, LeafNode<T>* dataNode, T& key, RecordId rid);
+
+
+        /**
+         * Splits the non-leaf node and returns pointer to a page containing the new node.
+         * The key and pageId of the new child go right after the child at childIdx, which was split.
+         */
+        template <class T>
+        PageId splitNonLeafNode(NonLeafNode<T>* node, T& key, PageId pageId, int childIdx, int count);
+
+        /**
+         * Insert a key and record Id pair into a leaf node
+         */
+        template <class T>
+        bool insertKeyInLeafNode(LeafNode<T>* node, const T& key, RecordId rid);
+
+        /**
+         * Insert a key and pageId pair into a non-leaf node, right after the child at childIdx, which was split.
+         * count is the number of entries of the new child, which the split child no longer counts.
+         */
+        template <class T>
+        bool insertKeyInNonLeafNode(NonLeafNode<T>* node, const T& key, PageId pageId, int childIdx, int count);
+
+        /**
+         * Appends the pair to the leaf at appendLeafPageNum if it is still the right-most leaf, has room and holds
+         * only keys below the key. Only that leaf is latched, its ancestors count the entry in countAppends().
+         * Returns false, changing nothing, if the insert has to search its way down from the root instead. The
+         * caller holds appendMutex.
+         */
+        template <class T>
+        bool appendToLastLeaf(const T& key, RecordId rid);
+
+        /**
+         * Counts the appends not counted yet in the nodes of the right edge, from the root down. The caller holds
+         * appendMutex or the tree latch exclusive.
+         */
+        template <class T>
+        void countAppends();
+
+        /**
+         * In append mode, locks appendMutex and counts the pending appends, so that the subtree counts take in
+         * every entry while the returned lock is held. Returns an empty lock otherwise.
+         */
+        template <class T>
+        std::unique_lock<std::mutex> settleAppends();
+
+        /**
+         * Builds the tree bottom-up from the given entries, sorted: packs the leaves left to
+         * right and then each non-leaf level above them, finishing in the root page.
+         */
+        template <class T>
+        void bulkLoad(std::vector<RIDKeyPair<T> >& entries, double fillFactor);
+
+        /**
+         * Fills a non-leaf node with count consecutive children of the level below, starting at begin
+         */
+        template <class T>
+        void fillNonLeafNode(NonLeafNode<T>* node, const std::vector<PageKeyPair<T> >& children,
+                             const std::vector<int>& childCounts, size_t begin, size_t count, int level);
+
+        /**
+         * Reads and latches the root page, retrying if a root split moved the root while waiting for the latch
+         */
+        PageId latchRoot(Page*& page, bool exclusive);
+
+        /**
+         * Unlatches and unpins a page read and latched on the way down the tree
+         */
+        void releasePage(PageId pageNum, bool dirty);
+
+        /**
+         * Allocates a page for a new node, reusing a freed page if there is one
+         */
+        void allocNodePage(PageId& pageNum, Page*& page);
+
+        /**
+         * Adds an unpinned node page to the chain of freed pages
+         */
+        void freeNodePage(PageId pageNum);
+
+        /**
+         * Points the left link of a leaf at a new left neighbour, latching the leaf while it changes
+         */
+        template <class T>
+        void setLeftSibling(PageId pageNum, PageId leftSibPageNum);
+
+        /**
+         * Writes the head of the freed page chain to the meta page
+         */
+        void writeFreePageNum();
+
+        /**
+         * Writes the root page number and the statistics to the meta page, with statsMutex held
+         */
+        void writeMetaInfo();
+
+        /**
+         * Adds leaves and levels to the statistics and writes them to the meta page
+         */
+        void countShapeChange(int leafDelta, int heightDelta);
+
+        /**
+         * Counts an inserted entry in the statistics
+         */
+        template <class T>
+        void countInsert(const T& key);
+
+        /**
+         * Counts a deleted entry in the statistics. If it held the lowest or the highest key, the new one is read
+         * from the leaf at that edge of the tree.
+         */
+        template <class T>
+        void countDelete(const T& key);
+
+        /**
+         * Counts the entries deleted from a range in the statistics, reading the lowest or the highest key again if
+         * the range held it
+         */
+        template <class T>
+        void countDeleteRange(const T& lowVal, Operator lowOp, const T& highVal, Operator highOp, long long removed);
+
+        /**
+         * Reads the lowest and/or the highest key of the index into the statistics from the leaves at its edges
+         */
+        template <class T>
+        void readEdgeKeys(bool lowest, bool highest);
+
+        /**
+         * Number of entries, one per record id, in the subtree under a node page: the sum of the counts of its children,
+         * or for a leaf its entries, with each posting list counted by its length
+         */
+        template <class T>
+        int subtreeCount(PageId pageNum, bool leaf);
+
+        /**
+         * Number of record ids an entry of a leaf stands for, the length of its list for a posting list entry
+         */
+        int ridCount(const RecordId& rid);
+
+        /**
+         * Number of entries with a key below the given one, or not above it if orEqual, from the entry counts of
+         * the nodes on one root-to-leaf path, coupling shared latches down the tree
+         */
+        template <class T>
+        long long rankTyped(const T& key, bool orEqual);
+
+        /**
+         * Finds the entry at position k of the index from the entry counts on the way down, see selectKth()
+         */
+        template <class T>
+        void selectKthTyped(long long k, void* outKey, RecordId& outRid);
+
+        /**
+         * Returns the leftmost or the rightmost leaf, Page::INVALID_NUMBER if the tree has no leaves yet
+         */
+        template <class T>
+        PageId findEdgeLeaf(bool rightmost);
+
+        /**
+         * Reads the entries of the leaves from left to right and writes them as a snapshot, see exportSnapshot()
+         */
+        template <class T>
+        void exportSnapshotTyped(const std::string& snapshotName);
+
+        /**
+         * Returns the leftmost leaf that may hold the key
+         */
+        template <class T>
+        PageId findLeaf(const T& key);
+
+        /**
+         * Searches the subtree under pageNum for the entry <key, rid>. If found, leaves the
+         * non-leaf nodes on the way (with the index of the child taken) in path and returns true.
+         */
+        template <class T>
+        bool findEntryLeaf(PageId pageNum, const T& key, const RecordId& rid,
+                           std::stack<std::pair<PageId, int> >& path, PageId& leafPageNum, int& entryIdx);
+
+        /**
+         * Deletes the entry <key, rid> and rebalances the nodes on its path that become underfull
+         */
+        template <class T>
+        void deleteEntryTyped(const T& key, RecordId rid);
+
+        /**
+         * Deletes every entry in the range and returns how many there were
+         */
+        template <class T>
+        int deleteRangeTyped(const void* lowValParm, Operator lowOp, const void* highValParm, Operator highOp);
+
+        /**
+         * Deletes the entries in the range from the subtree under a non-leaf node, walking each node the range
+         * overlaps once. The counts of the node are lowered once per child, and its children left underfull are
+         * rebalanced once all of them are done. Returns the number of entries deleted.
+         */
+        template <class T>
+        long long deleteRangeInNode(PageId pageNum, const T& lowVal, Operator lowOp, const T& highVal, Operator highOp);
+
+        /**
+         * Deletes the run of entries of a leaf in the range, with the posting lists among them, and returns the
+         * number of record ids deleted
+         */
+        template <class T>
+        long long deleteRangeInLeaf(PageId pageNum, const T& lowVal, Operator lowOp, const T& highVal, Operator highOp);
+
+        /**
+         * True if a node holds fewer entries than deletes keep it at, see deleteEntryTyped()
+         */
+        template <class T>
+        bool nodeUnderfull(PageId pageNum, bool leaf);
+
+        /**
+         * Merges or redistributes the underfull child at childIdx of the parent with a sibling.
+         * Returns true if the parent is left underfull in turn.
+         */
+        template <class T>
+        bool rebalanceLeaf(PageId parentPageNum, int childIdx);
+        template <class T>
+        bool rebalanceNonLeaf(PageId parentPageNum, int childIdx);
+
+        /**
+         * Removes the key at keyIdx and the child pointer to its right from a non-leaf node, counting the entries of
+         * that child under the one on its left, which took them over
+         */
+        template <class T>
+        void removeNonLeafEntry(NonLeafNode<T>* node, int keyIdx);
+
+        /**
+         * Replaces a root left with a single non-leaf child by that child, keeping the root page number
+         */
+        template <class T>
+        void collapseRoot();
+
+        /**
+         * Appends the record ids of every entry with the key to outRids, coupling shared latches down the tree
+         */
+        template <class T>
+        int lookupTyped(const T& key, std::vector<RecordId>& outRids);
+
+        /**
+         * Same as lookupTyped() for BLINK mode, reading each node without latches and validating its version
+         */
+        template <class T>
+        int lookupOptimistic(const T& key, std::vector<RecordId>& outRids);
+
+        /**
+         * Looks up the keys in groups of MULTI_LOOKUP_GROUP, see multiLookup()
+         */
+        template <class T>
+        size_t multiLookupTyped(const void* const keys[], size_t n, std::vector<RecordId> outRids[]);
+
+        /**
+         * Appends the record ids of the entries of the leaf with the key to outRids.
+         * Returns true if more of them may follow on the right sibling.
+         */
+        template <class T>
+        bool collectMatches(const LeafEntries<T>& leaf, const T& key, std::vector<RecordId>& outRids);
+
+        /**
+         * Points entries at the entries of a leaf page, copying them out if copy is set. The entries of a compressed
+         * leaf are always decoded into the buffers. Returns false if a leaf read without latches was too torn to decode.
+         */
+        template <class T>
+        bool readLeafEntries(const Page* page, LeafEntries<T>& entries, bool copy);
+
+        /**
+         * Returns true if the pair fits into the leaf without a split
+         */
+        template <class T>
+        bool leafHasRoom(const Page* page, const T& key, const RecordId& rid);
+
+        /**
+         * Inserts the pair into a compressed leaf, coding the leaf again. If the entries do not fit any more the leaf is
+         * split, and like splitLeafNode() the page number of the new leaf is returned and key set to its first key.
+         */
+        template <class T>
+        PageId insertIntoCompressedLeaf(PageId pageNum, Page* page, T& key, RecordId rid);
+
+        /**
+         * Removes the entry at entryIdx from a compressed leaf
+         */
+        template <class T>
+        void removeFromCompressedLeaf(Page* page, int entryIdx);
+
+        /**
+         * Moves the entries of the right leaf into the left one if they fit together in one compressed leaf.
+         * Returns false, changing nothing, if they do not.
+         */
+        template <class T>
+        bool mergeCompressedLeaves(Page* leftPage, Page* rightPage);
+
+        /**
+         * Codes as many of the sorted entries from pos on into a compressed leaf as fit at the fill factor and returns how many
+         */
+        template <class T>
+        size_t packCompressedLeaf(Page* page, const std::vector<RIDKeyPair<T> >& entries, size_t pos, double fillFactor);
+
+        /**
+         * With POSTING_LIST_LEAVES, adds the pair to the posting list of the key in the leaf, or turns the run of the
+         * key into a posting list once it is long enough. Returns false if the pair is to be inserted as a plain entry.
+         */
+        template <class T>
+        bool addToPostingList(LeafNode<T>* leaf, const T& key, RecordId rid);
+
+        /**
+         * Replaces the runs of keys in sorted entries that are long enough by posting lists, for a bulk load
+         */
+        template <class T>
+        void packPostingLists(std::vector<RIDKeyPair<T> >& entries);
+
+        /**
+         * Writes count sorted record ids to a new posting list and returns the page number of its first page
+         */
+        PageId createPostingList(const RecordId* rids, int count);
+
+        /**
+         * Adds a record id to a posting list, splitting the page it goes into if that is full
+         */
+        void insertIntoPostingList(PageId headPageNum, const RecordId& rid);
+
+        /**
+         * Removes a record id the posting list holds, freeing pages left empty. Returns false if the list is left
+         * empty, with all its pages freed.
+         */
+        bool removeFromPostingList(PageId headPageNum, const RecordId& rid);
+
+        /**
+         * Frees every page of a posting list and returns the number of record ids it held
+         */
+        int freePostingList(PageId headPageNum);
+
+        /**
+         * Returns true if a posting list holds the record id
+         */
+        bool postingListContains(PageId headPageNum, const RecordId& rid);
+
+        /**
+         * Appends the record ids of a posting list to outRids, copying each page once no writer is changing it
+         */
+        void readPostingList(PageId headPageNum, std::vector<RecordId>& outRids);
+
+        /**
+         * Replaces the posting list entries in rids[from, end) by the record ids of their lists
+         */
+        void expandPostingLists(std::vector<RecordId>& rids, size_t from);
+//----------------------------------------------------------------------------------#
+
+    public:
+
+        /**
+         * BTreeIndex Constructor.
+         * Check to see if the corresponding index file exists. If so, open the file.
+         * If not, create it and bulk load it with the entries of every tuple in the base relation, read in parallel by
+         * buildThreads threads that each take a run of consecutive pages of the relation.
+         *
+         * @param relationName        Name of file.
          * @param outIndexName        Return the name of index file.
          * @param bufMgrIn			  Buffer Manager Instance
          * @param attrByteOffset	  Offset of attribute, over which index is to be built, in the record
          * @param attrType			  Datatype of attribute over which index is built
+         * @param fillFactor		  Fraction of each node filled when a new index is bulk loaded, clamped to (0, 1]
+         * @param concurrencyModeIn	  How readers synchronize with concurrent inserts, latch coupling or B-link reads without latches
+         * @param appendModeIn		  Whether keys are mostly inserted in increasing order, see insertEntry()
+         * @param splitPolicyIn		  Where full leaf and non-leaf nodes are split by inserts
+         * @param leafFormatIn		  How the leaves of a new index store entries, an existing index keeps the format it was created with
+         * @param buildThreads		  Number of threads reading and sorting the relation when the index is created, 0 for one per hardware thread
          * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
+         * @throws  BadIndexInfoException     If compressed leaves are asked for an attribute that is not INTEGER.
          */
         BTreeIndex(const std::string & relationName, std::string & outIndexName,
-                   BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+                   BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+                   const double fillFactor = BULKLOAD_FILL_FACTOR,
+                   const ConcurrencyMode concurrencyModeIn = LATCH_COUPLING,
+                   const bool appendModeIn = false,
+                   const SplitPolicy& splitPolicyIn = SplitPolicy(),
+                   const LeafFormat leafFormatIn = PLAIN_LEAVES,
+                   const unsigned int buildThreads = 1);
+
+    private:
+
+        /**
+         * Same as the public constructor, except that a new index is built from the records passed through the
+         * queue, when records is not null, rather than from its own read of the base relation
+         */
+        BTreeIndex(const std::string & relationName, std::string & outIndexName,
+                   BufMgr *bufMgrIn, const int attrByteOffset, const Datatype attrType,
+                   const double fillFactor, const ConcurrencyMode concurrencyModeIn, const bool appendModeIn,
+                   const SplitPolicy& splitPolicyIn, const LeafFormat leafFormatIn, const unsigned int buildThreads,
+                   RecordQueue* records);
+
+    public:
 
 
         /**
@@ -365,28 +1547,68 @@ at this level are just above the leaf nodes. Otherwise set to 0.
          * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
          * This may continue all the way up to the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
          * Make sure to unpin pages as soon as you can.
+         * In append mode a key above every key in the index goes straight into the right-most leaf, and a full
+         * right-most leaf or non-leaf keeps its entries, splitting off only the new one, so that increasing keys
+         * leave the nodes behind them full instead of half empty. Inserts into one index in append mode run one
+         * at a time.
          * @param key			Key to insert, pointer to integer/double/char string
          * @param rid			Record ID of a record whose entry is getting inserted into the index.
          */
         void insertEntry(const void* key, RecordId rid);
 
 
+        /**
+         * Insert a batch of entries. The batch is sorted and each leaf takes all the entries of its range
+         * that fit in one pass, with the path to it latched once: after a leaf the insert walks up only
+         * as far as the lowest node whose range holds the next entry. A full leaf is split as in
+         * insertEntry(), and the batch then goes on from the root. The path stays latched from one leaf
+         * to the next, so other inserts wait until the batch is done with a node.
+         * @param entries		Entries to insert, entries with a null key are skipped
+         * @param n				Number of entries
+         */
+        void insertBatch(const KeyRid* entries, size_t n);
+
+
         /**
          * Begin a filtered scan of the index.  For instance, if the method is called
          * using ("a",GT,"d",LTE) then we should seek all entries with a value
          * greater than "a" and less than or equal to "d".
-         * If another scan is already executing, that needs to be ended here.
+         * If another scan is already executing, that needs to be ended here. Scans of IndexScanCursor objects are not affected.
          * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
          * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
          * @param lowVal	Low value of range, pointer to integer / double / char string
          * @param lowOp		Low operator (GT/GTE)
          * @param highVal	High value of range, pointer to integer / double / char string
          * @param highOp	High operator (LT/LTE)
+         * @param order		ASCENDING to scan from the low bound up, DESCENDING to start at the high bound and walk
+         *					the leaves leftwards, so that the first k entries from the top cost k entries
+         * @param limit		Maximum number of record ids the scan returns. Once they are returned the scan is completed
+         *					and moves on to no further leaf.
+         * @param offset	Number of record ids of the range, in scan order, skipped before the first one returned.
+         *					Leaves wholly skipped are passed over from their entry counts, so a page of results
+         *					deep into a range costs one binary search per leaf before it rather than a visit of
+         *					each entry.
          * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
          * @throws  BadScanrangeException If lowVal > highval
          * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
          */
-        void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+        void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+                       const ScanOrder order = ASCENDING, const size_t limit = NO_SCAN_LIMIT, const size_t offset = 0);
+
+
+        /**
+         * Begin an ascending scan of several ranges, such as the values of an IN-list, returning the entries
+         * of each range in turn. The scan descends from the root to the first range only. A range that starts
+         * in the leaf the previous one ended in is found there by a binary search, and the tree is descended
+         * again only for a range that starts past the high key of that leaf.
+         * If another scan is already executing, that needs to be ended here. Scans of IndexScanCursor objects are not affected.
+         * @param ranges		Ranges sorted by their bounds, that do not overlap
+         * @param numRanges	Number of ranges, at least one
+         * @throws  BadOpcodesException If an operator of a range does not contain one of its expected values
+         * @throws  BadScanrangeException If there is no range, a range is empty or the ranges are not sorted
+         * @throws  NoSuchKeyFoundException If the index is empty.
+         */
+        void startScan(const KeyRange* ranges, size_t numRanges);
 
 
         /**
@@ -399,12 +1621,203 @@ at this level are just above the leaf nodes. Otherwise set to 0.
         void scanNext(RecordId& outRid);  // returned record id
 
 
+        /**
+         * Fetch the record ids of up to maxRids next index entries that match the scan. See IndexScanCursor::scanNextBatch().
+         * @param outRids	Array receiving the record ids, room for at least maxRids of them
+         * @param maxRids	Maximum number of record ids to return
+         * @return Number of record ids returned, less than maxRids only once the scan is exhausted, 0 after that
+         * @throws ScanNotInitializedException If no scan has been initialized.
+         */
+        size_t scanNextBatch(RecordId* outRids, size_t maxRids);
+
+
         /**
          * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
          * @throws ScanNotInitializedException If no scan has been initialized.
          */
         void endScan();
 
+
+        /**
+         * Delete the entry <key, rid> from the index.
+         * Start from root to find the leaf holding the entry and remove it. A node left less than half full is
+         * redistributed with a sibling, or merged with it when both fit in one node. A merge removes an entry
+         * from the parent, which may in turn become underfull, all the way up to the root. Pages freed by merges
+         * are reused by later node allocations. The scan started through startScan() is ended first.
+         * @param key			Key to delete, pointer to integer/double/char string
+         * @param rid			Record ID of the record whose entry is getting deleted from the index.
+         * @throws  NoSuchKeyFoundException If the index holds no entry <key, rid>.
+         */
+        void deleteEntry(const void* key, const RecordId rid);
+
+
+        /**
+         * Delete every entry whose key is in the given range, with the same range semantics as startScan.
+         * The scan started through startScan() is ended first.
+         * @param lowVal	Low value of range, pointer to integer / double / char string
+         * @param lowOp		Low operator (GT/GTE)
+         * @param highVal	High value of range, pointer to integer / double / char string
+         * @param highOp	High operator (LT/LTE)
+         * @return Number of entries deleted
+         * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+         * @throws  BadScanrangeException If lowVal > highval
+         */
+        int deleteRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+
+        /**
+         * Find every entry with the given key and pass its record id to the callback.
+         * Descends from the root once and walks right across the leaves the duplicates of the key span.
+         * No page stays pinned once the call returns and the callback runs after all pages are released.
+         * The scan started through startScan() is not affected.
+         * @param key			Key to look up, pointer to integer/double/char string
+         * @param callback		Called with the record id of each matching entry, in index order
+         * @return Number of matching entries, 0 if the key is not in the index
+         */
+        int lookup(const void* key, const std::function<void(const RecordId&)>& callback);
+
+
+        /**
+         * Find every entry with the given key and append its record id to outRids. See lookup().
+         * @param key			Key to look up, pointer to integer/double/char string
+         * @param outRids		Vector the record ids of matching entries are appended to, in index order
+         * @return Number of matching entries, 0 if the key is not in the index
+         */
+        int lookupAll(const void* key, std::vector<RecordId>& outRids);
+
+
+        /**
+         * Find the entries of several keys at once, with the results of lookupAll() for each key. Up to
+         * MULTI_LOOKUP_GROUP lookups are in flight at a time and take turns going down one node each:
+         * the next node of a lookup is pinned and prefetched, then searched only after the others have
+         * taken their turn, so the cache misses of one lookup overlap the key comparisons of the others.
+         * The nodes are read without latches and checked against their versions like in BLINK mode,
+         * whatever the concurrency mode, since writers version the nodes they change in either mode.
+         * @param keys			Keys to look up, each a pointer to integer/double/char string
+         * @param n				Number of keys
+         * @param outRids		Array of n vectors, the record ids of the entries with keys[i] are appended to outRids[i] in index order
+         * @return Total number of matching entries
+         */
+        size_t multiLookup(const void* const keys[], size_t n, std::vector<RecordId> outRids[]);
+
+
+        /**
+         * Statistics of the index: its height, number of leaves and entries and its lowest and highest key.
+         * Inserts and deletes keep them up to date and an existing index reads them from its meta page, so
+         * getting them reads no page.
+         * @return Copy of the statistics, see IndexStats
+         */
+        IndexStats getStats();
+
+
+        /**
+         * Write the entries of the index to a read-only snapshot file, to be read through a StaticIndex. The
+         * snapshot holds every entry in index order with the posting lists expanded, packed for searches and
+         * scans rather than updates. Inserts and deletes wait until it is written, later ones do not reach it.
+         * @param snapshotName	Name of the snapshot file, replaced if it exists
+         * @throws  BadIndexInfoException If the file cannot be written
+         */
+        void exportSnapshot(const std::string& snapshotName);
+
+
+        /**
+         * Count the entries whose key is in the given range, with the same range semantics as startScan.
+         * The non-leaf nodes keep the number of entries under each child, so the count comes from the
+         * nodes on the paths down to the two ends of the range and reads two leaves, whatever the
+         * size of the range. Inserts running meanwhile may or may not be counted.
+         * @param lowVal	Low value of range, pointer to integer / double / char string
+         * @param lowOp		Low operator (GT/GTE)
+         * @param highVal	High value of range, pointer to integer / double / char string
+         * @param highOp	High operator (LT/LTE)
+         * @return Number of entries in the range, one per record id
+         * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+         * @throws  BadScanrangeException If lowVal > highval
+         */
+        long long countRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+
+        /**
+         * Find the entry at position k of the index in key order, counting from 0, by descending into the
+         * child whose entry counts cover position k at each level. Entries with equal keys are in the
+         * order a scan returns them.
+         * @param k			Position of the entry
+         * @param outKey	Receives the key of the entry: an int, a double or the first STRINGSIZE characters of a string
+         * @param outRid	Receives the record id of the entry
+         * @throws  NoSuchKeyFoundException If the index holds k entries or fewer.
+         */
+        void selectKth(long long k, void* outKey, RecordId& outRid);
+
+    };
+
+
+/**
+ * @brief Builds several indexes of one relation from a single read of it. The relation is read once, a page
+ * at a time, and each page of records is handed to every index. Each index is built in a thread of its own,
+ * which takes its keys out of the records, sorts them and bulk loads the tree like the BTreeIndex constructor.
+ * A queue of a few pages between the read and each build keeps the read from running far ahead of the slowest
+ * build. An index whose file already exists is opened as it is and takes no records.
+*/
+    class MultiIndexBuilder {
+
+    private:
+
+        /**
+         * Arguments of the BTreeIndex constructor for an index to build
+         */
+        struct IndexSpec{
+            int attrByteOffset;
+            Datatype attrType;
+            double fillFactor;
+            ConcurrencyMode concurrencyMode;
+            bool appendMode;
+            SplitPolicy splitPolicy;
+            LeafFormat leafFormat;
+        };
+
+        /**
+         * Name of the relation the indexes are built on.
+         */
+        std::string	relationName;
+
+        /**
+         * Buffer manager the indexes and the read of the relation go through.
+         */
+        BufMgr	*bufMgr;
+
+        /**
+         * Indexes to build, in the order they were added.
+         */
+        std::vector<IndexSpec>	specs;
+
+    public:
+
+        /**
+         * MultiIndexBuilder Constructor. No index is built until build() is called.
+         * @param relationNameIn	Name of the relation file
+         * @param bufMgrIn			Buffer Manager Instance
+         */
+        MultiIndexBuilder(const std::string & relationNameIn, BufMgr *bufMgrIn);
+
+        /**
+         * Adds an index to build, with the same arguments as the BTreeIndex constructor.
+         */
+        void addIndex(const int attrByteOffset, const Datatype attrType,
+                      const double fillFactor = BULKLOAD_FILL_FACTOR,
+                      const ConcurrencyMode concurrencyMode = LATCH_COUPLING,
+                      const bool appendMode = false,
+                      const SplitPolicy& splitPolicy = SplitPolicy(),
+                      const LeafFormat leafFormat = PLAIN_LEAVES);
+
+        /**
+         * Reads the relation once and builds every index added. The indexes are returned in the order they were
+         * added and belong to the caller, who deletes them.
+         * @param outIndexNames	Return the name of the file of each index, in the same order
+         * @return The indexes built or opened
+         * @throws  FileNotFoundException If the relation file does not exist.
+         * @throws  BadIndexInfoException Like the BTreeIndex constructor, once no index is left open, or before any
+         *          index is opened if two indexes were added on the same attribute offset.
+         */
+        std::vector<BTreeIndex*> build(std::vector<std::string> & outIndexNames);
     };
 
 }
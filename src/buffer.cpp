@@ -54,11 +54,11 @@ BufMgr::~BufMgr() {
   delete [] bufPool;
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+void BufMgr::allocBuf(FrameId & frame, std::unique_lock<std::mutex>& lock) 
 {
   // perform first part of clock algorithm to search for 
   // open buffer frame
-  // Assumes non-concurrent access to buffer manager
+  // Called with bufMutex held by the public calls
   std::uint32_t numScanned = 0;
   bool found = 0;
 
@@ -68,9 +68,16 @@ void BufMgr::allocBuf(FrameId & frame)
     advanceClock();
     numScanned++;
 
+    // frames doing I/O or reserved by another thread are skipped like pinned ones
+    if (bufDescTable[clockHand].ioPending)
+    {
+      continue;
+    }
+
     // if invalid, use frame
     if (! bufDescTable[clockHand].valid)
     {
+      found = true;
       break;
     }
 
@@ -80,8 +87,42 @@ void BufMgr::allocBuf(FrameId & frame)
       // check to see if someone has it pinned
       if (bufDescTable[clockHand].pinCnt == 0)
       {
-        // hasn't been referenced and is not pinned, use it
-        // remove previous entry from hash table
+        // hasn't been referenced and is not pinned
+        if (bufDescTable[clockHand].dirty)
+        {
+          // flush the changes to disk without holding the mutex, the page stays in the hash table
+          // and threads asking for it wait until it is written
+          BufDesc* victim = &bufDescTable[clockHand];
+          victim->ioPending = true;
+          victim->dirty = false;
+          bufStats.diskwrites++;
+          lock.unlock();
+          try
+          {
+            victim->file->writePage(victim->pageNo, bufPool[victim->frameNo]);
+          }
+          catch (...)
+          {
+            lock.lock();
+            victim->dirty = true;
+            victim->ioPending = false;
+            ioDone.notify_all();
+            throw;
+          }
+          lock.lock();
+          victim->ioPending = false;
+          ioDone.notify_all();
+
+          // the page may have been used again meanwhile, then look on
+          if (victim->pinCnt > 0 || victim->dirty || victim->refbit)
+          {
+            numScanned = 0;
+            continue;
+          }
+          clockHand = victim->frameNo;
+        }
+
+        // use it, remove previous entry from hash table
         hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
         found = true;
         break;
@@ -96,64 +137,105 @@ void BufMgr::allocBuf(FrameId & frame)
   }
   
   // check for full buffer pool
-  if (!found && numScanned >= 2*numBufs)
+  if (!found)
   {
     throw BufferExceededException();
   }
-  
-  // flush any existing changes to disk if necessary
-  if (bufDescTable[clockHand].dirty)
-  {
-    bufStats.diskwrites++;
-    //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
-    bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
-  }
 
-	//Reset all the BufDesc entry for the frame before returning the frame
+	//Reset all the BufDesc entry for the frame and reserve it before returning the frame
   bufDescTable[clockHand].Clear();
+  bufDescTable[clockHand].ioPending = true;
 
   // return new frame number
   frame = clockHand;
 } // end allocBuf
 
+
+FrameId BufMgr::lookupSettled(File* file, const PageId pageNo, std::unique_lock<std::mutex>& lock)
+{
+  FrameId frameNo = 0;
+  hashTable->lookup(file, pageNo, frameNo);
+  while (bufDescTable[frameNo].ioPending)
+  {
+    // the frame may hold another page, or none, once its I/O ends
+    ioDone.wait(lock);
+    hashTable->lookup(file, pageNo, frameNo);
+  }
+  return frameNo;
+}
+
+
+bool BufMgr::pinCached(File* file, const PageId pageNo, Page*& page, std::unique_lock<std::mutex>& lock)
+{
+  FrameId frameNo = 0;
+  try
+  {
+    frameNo = lookupSettled(file, pageNo, lock);
+  }
+  catch(HashNotFoundException e)
+  {
+    return false;
+  }
+
+  // set the referenced bit
+  bufDescTable[frameNo].refbit = true;
+  bufDescTable[frameNo].pinCnt++;
+  page = &bufPool[frameNo];
+  return true;
+}
+
 	
 void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 {
+  std::unique_lock<std::mutex> lock(bufMutex);
+
   // check to see if it is already in the buffer pool
   // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
+  if (pinCached(file, pageNo, page, lock))
+    return;
+
+  //not in the buffer pool, must allocate a new page
   FrameId frameNo = 0;
-	try
-	{
-  	hashTable->lookup(file, pageNo, frameNo);
+  allocBuf(frameNo, lock);
 
-    // set the referenced bit
-    bufDescTable[frameNo].refbit = true;
-    bufDescTable[frameNo].pinCnt++;
-    page = &bufPool[frameNo];
-  }
-  catch(HashNotFoundException e) //not in the buffer pool, must allocate a new page
+  // another thread may have read the page in while a page was written back for this one
+  if (pinCached(file, pageNo, page, lock))
   {
-    // alloc a new frame
-    allocBuf(frameNo);
-
-    // read the page into the new frame
-    bufStats.diskreads++;
-    //status = file->readPage(pageNo, &bufPool[frameNo]);
-    bufPool[frameNo] = file->readPage(pageNo);
+    bufDescTable[frameNo].Clear();
+    return;
+  }
 
-    // set up the entry properly
-    bufDescTable[frameNo].Set(file, pageNo);
-    page = &bufPool[frameNo];
+  // set up the entry properly and insert it in the hash table, threads asking for the page wait until it is read
+  bufDescTable[frameNo].Set(file, pageNo);
+  hashTable->insert(file, pageNo, frameNo);
 
-    // insert in the hash table
-    hashTable->insert(file, pageNo, frameNo);
+  // read the page into the new frame without holding the mutex
+  bufStats.diskreads++;
+  lock.unlock();
+  try
+  {
+    bufPool[frameNo] = file->readPage(pageNo);
+  }
+  catch (...)
+  {
+    lock.lock();
+    hashTable->remove(file, pageNo);
+    bufDescTable[frameNo].Clear();
+    ioDone.notify_all();
+    throw;
   }
+  lock.lock();
+  bufDescTable[frameNo].ioPending = false;
+  ioDone.notify_all();
+  page = &bufPool[frameNo];
 }
 
 
 void BufMgr::unPinPage(File* file, const PageId pageNo, 
 			     const bool dirty) 
 {
+  std::lock_guard<std::mutex> guard(bufMutex);
+
   // lookup in hashtable
   FrameId frameNo = 0;
   hashTable->lookup(file, pageNo, frameNo);
@@ -170,19 +252,47 @@ void BufMgr::unPinPage(File* file, const PageId pageNo,
 
 void BufMgr::flushFile(const File* file) 
 {
+  std::unique_lock<std::mutex> lock(bufMutex);
+
   for (std::uint32_t i = 0; i < numBufs; i++)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
   	if(tmpbuf->valid == true && tmpbuf->file == file)
 		{
+	    if (tmpbuf->ioPending)
+			{
+				// look at the frame again once its I/O is over
+				ioDone.wait(lock);
+				i--;
+				continue;
+			}
+
 	    if (tmpbuf->pinCnt > 0)
   			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
 
 	    if (tmpbuf->dirty == true)
 			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
-				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
+				// write the page without holding the mutex, then look at the frame again
+				tmpbuf->ioPending = true;
 				tmpbuf->dirty = false;
+				lock.unlock();
+				try
+				{
+					tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
+				}
+				catch (...)
+				{
+					lock.lock();
+					tmpbuf->dirty = true;
+					tmpbuf->ioPending = false;
+					ioDone.notify_all();
+					throw;
+				}
+				lock.lock();
+				tmpbuf->ioPending = false;
+				ioDone.notify_all();
+				i--;
+				continue;
     	}
 
     	hashTable->remove(file,tmpbuf->pageNo);
@@ -195,15 +305,18 @@ void BufMgr::flushFile(const File* file)
 
 void BufMgr::disposePage(File* file, const PageId pageNo) 
 {
-	//Deallocate from file altogether
-  //See if it is in the buffer pool
-  FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  {
+    std::unique_lock<std::mutex> lock(bufMutex);
 
-	// clear the page
-	bufDescTable[frameNo].Clear();
+    //Deallocate from file altogether
+    //See if it is in the buffer pool
+    FrameId frameNo = lookupSettled(file, pageNo, lock);
 
-	hashTable->remove(file, pageNo);
+    // clear the page
+    bufDescTable[frameNo].Clear();
+
+    hashTable->remove(file, pageNo);
+  }
 
   // deallocate it in the file	
   file->deletePage(pageNo);
@@ -212,21 +325,69 @@ void BufMgr::disposePage(File* file, const PageId pageNo)
 
 void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page) 
 {
+  std::unique_lock<std::mutex> lock(bufMutex);
+
   FrameId frameNo;
 
   // alloc a new frame
-  allocBuf(frameNo);
+  allocBuf(frameNo, lock);
 
-  // allocate a new page in the file
+  // allocate a new page in the file without holding the mutex, the frame stays reserved
 	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
-  bufPool[frameNo] = file->allocatePage(pageNo);
+  lock.unlock();
+  try
+  {
+    bufPool[frameNo] = file->allocatePage(pageNo);
+  }
+  catch (...)
+  {
+    lock.lock();
+    bufDescTable[frameNo].Clear();
+    ioDone.notify_all();
+    throw;
+  }
+  lock.lock();
   page = &bufPool[frameNo];
 
   // set up the entry properly
   bufDescTable[frameNo].Set(file, pageNo);
+  bufDescTable[frameNo].ioPending = false;
 
   // insert in the hash table
   hashTable->insert(file, pageNo, frameNo);
+  ioDone.notify_all();
+}
+
+void BufMgr::latchPage(File* file, const PageId pageNo, const bool exclusive)
+{
+  FrameId frameNo = 0;
+  {
+    std::lock_guard<std::mutex> guard(bufMutex);
+    hashTable->lookup(file, pageNo, frameNo);
+
+    // the pin keeps the frame from being reused while this thread waits for the latch
+    if (bufDescTable[frameNo].pinCnt == 0)
+      throw PageNotPinnedException(file->filename(), pageNo, frameNo);
+  }
+
+  if (exclusive)
+    pthread_rwlock_wrlock(&bufDescTable[frameNo].latch);
+  else
+    pthread_rwlock_rdlock(&bufDescTable[frameNo].latch);
+}
+
+void BufMgr::unlatchPage(File* file, const PageId pageNo)
+{
+  FrameId frameNo = 0;
+  {
+    std::lock_guard<std::mutex> guard(bufMutex);
+    hashTable->lookup(file, pageNo, frameNo);
+
+    if (bufDescTable[frameNo].pinCnt == 0)
+      throw PageNotPinnedException(file->filename(), pageNo, frameNo);
+  }
+
+  pthread_rwlock_unlock(&bufDescTable[frameNo].latch);
 }
 
 void BufMgr::printSelf(void) 
@@ -10,6 +10,9 @@
 #include "file.h"
 #include "bufHashTbl.h"
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
 
 namespace badgerdb {
 
@@ -61,6 +64,17 @@ class BufDesc {
 	 */
   bool refbit;
 
+	/**
+   * True while the frame is read into or written out without bufMutex held, or reserved for a page about to
+   * be read in. Other threads wait for the I/O to end before they use the page or the frame.
+	 */
+  bool ioPending;
+
+	/**
+   * Latch protecting the contents of the page in this frame, shared for readers and exclusive for writers
+	 */
+  pthread_rwlock_t latch;
+
 	/**
    * Initialize buffer frame for a new user
 	 */
@@ -72,6 +86,7 @@ class BufDesc {
     dirty = false;
     refbit = false;
 		valid = false;
+    ioPending = false;
   };
 
 	/**
@@ -104,7 +119,8 @@ class BufDesc {
 		std::cout << "valid:" << valid << " ";
 		std::cout << "pinCnt:" << pinCnt << " ";
 		std::cout << "dirty:" << dirty << " ";
-		std::cout << "refbit:" << refbit << "\n";
+		std::cout << "refbit:" << refbit << " ";
+		std::cout << "ioPending:" << ioPending << "\n";
   }
 
 	/**
@@ -113,6 +129,15 @@ class BufDesc {
   BufDesc()
 	{
   	Clear();
+  	pthread_rwlock_init(&latch, NULL);
+  }
+
+	/**
+   * Destructor of BufDesc class 
+	 */
+  ~BufDesc()
+	{
+  	pthread_rwlock_destroy(&latch);
   }
 };
 
@@ -187,12 +212,43 @@ class BufMgr
   BufStats bufStats;
 
 	/**
-	 * Allocate a free frame.  
+   * Protects the frame descriptors, the hash table, the clock and the statistics. It is let go while pages
+   * are read from and written to their files, the frames doing I/O being marked ioPending meanwhile.
+	 */
+  std::mutex bufMutex;
+
+	/**
+   * Signalled whenever the I/O of a frame ends
+	 */
+  std::condition_variable ioDone;
+
+	/**
+	 * Allocate a free frame, writing the page in it back first if it is dirty. The frame is returned reserved,
+	 * marked ioPending but not valid, so that no other thread takes it.
 	 *
 	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
+	 * @param lock   	Lock held on bufMutex, let go while a page is written back
 	 * @throws BufferExceededException If no such buffer is found which can be allocated
 	 */
-  void allocBuf(FrameId & frame);
+  void allocBuf(FrameId & frame, std::unique_lock<std::mutex>& lock);
+
+	/**
+	 * Pin the page if it is in the buffer pool, waiting for I/O of its frame to end first.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param page  	Set to the page if it is in the buffer pool
+	 * @param lock   	Lock held on bufMutex, let go while waiting
+	 * @return True if the page was found and pinned
+	 */
+  bool pinCached(File* file, const PageId pageNo, Page*& page, std::unique_lock<std::mutex>& lock);
+
+	/**
+	 * Look up the frame of a page, waiting for I/O of the frame to end first.
+	 *
+	 * @throws HashNotFoundException If the page is not in the buffer pool
+	 */
+  FrameId lookupSettled(File* file, const PageId pageNo, std::unique_lock<std::mutex>& lock);
 
 	/**
    * Advance clock to next frame in the buffer pool
@@ -250,6 +306,26 @@ class BufMgr
 	 */
   void allocPage(File* file, PageId &PageNo, Page*& page); 
 
+	/**
+	 * Latches the frame holding a page, so that threads sharing the page can coordinate access to its contents.
+	 * The page must stay pinned while it is latched. Waiting for the latch does not block other buffer manager calls.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number
+	 * @param exclusive	True to latch for writing, false to share the latch with other readers
+   * @throws  PageNotPinnedException If the page is not pinned
+	 */
+  void latchPage(File* file, const PageId PageNo, const bool exclusive);
+
+	/**
+	 * Releases the latch taken on a page through latchPage().
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number
+   * @throws  PageNotPinnedException If the page is not pinned
+	 */
+  void unlatchPage(File* file, const PageId PageNo);
+
 	/**
 	 * Writes out all dirty pages of the file to disk.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
@@ -13,6 +13,8 @@
 #include <string>
 #include <cstdio>
 #include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "exceptions/file_exists_exception.h"
 #include "exceptions/file_not_found_exception.h"
@@ -25,6 +27,7 @@ namespace badgerdb {
 
 File::StreamMap File::open_streams_;
 File::CountMap File::open_counts_;
+File::MutexMap File::open_mutexes_;
 
 void File::remove(const std::string& filename) {
   if (!exists(filename)) {
@@ -60,6 +63,7 @@ File::~File() {
 
 
 PageId File::getFirstPageNo() {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   const FileHeader& header = readHeader();
   return header.first_used_page;
 }
@@ -79,6 +83,7 @@ void File::openIfNeeded(const bool create_new) {
   if (open_counts_.find(filename_) != open_counts_.end()) {	//exists an entry already
     ++open_counts_[filename_];
     stream_ = open_streams_[filename_];
+    stream_mutex_ = open_mutexes_[filename_];
   } else {
     std::ios_base::openmode mode =
         std::fstream::in | std::fstream::out | std::fstream::binary;
@@ -98,6 +103,8 @@ void File::openIfNeeded(const bool create_new) {
     }
     stream_.reset(new std::fstream(filename_, mode));
     open_streams_[filename_] = stream_;
+    stream_mutex_.reset(new std::recursive_mutex);
+    open_mutexes_[filename_] = stream_mutex_;
     open_counts_[filename_] = 1;
   }
 }
@@ -107,15 +114,18 @@ void File::close() {
   	--open_counts_[filename_];
 
   stream_.reset();
+  stream_mutex_.reset();
 	assert(open_counts_[filename_] >= 0);
 
   if (open_counts_[filename_] == 0) {
     open_streams_.erase(filename_);
+    open_mutexes_.erase(filename_);
     open_counts_.erase(filename_);
   }
 }
 
 FileHeader File::readHeader() const {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   FileHeader header;
   stream_->seekg(0 /* pos */, std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
@@ -123,6 +133,7 @@ FileHeader File::readHeader() const {
 }
 
 void File::writeHeader(const FileHeader& header) {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   stream_->seekp(0 /* pos */, std::ios::beg);
   stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
   stream_->flush();
@@ -163,6 +174,7 @@ PageFile& PageFile::operator=(const PageFile& rhs) {
 }
 
 Page PageFile::allocatePage(PageId &new_page_number) {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   FileHeader header = readHeader();
   Page new_page;
   Page existing_page;
@@ -236,6 +248,7 @@ Page PageFile::allocatePage(PageId &new_page_number) {
 }
 
 Page PageFile::readPage(const PageId page_number) const {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   FileHeader header = readHeader();
 
 	if (page_number >= header.num_pages)
@@ -246,6 +259,7 @@ Page PageFile::readPage(const PageId page_number) const {
 }
 
 Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   Page page;
   stream_->seekg(pagePosition(page_number), std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(PageHeader));
@@ -258,6 +272,7 @@ Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
 }
 
 void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
 	PageHeader header = readPageHeader(new_page_number);
 	if (header.current_page_number == Page::INVALID_NUMBER)
 	{
@@ -274,6 +289,7 @@ void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
 }
 
 void PageFile::deletePage(const PageId page_number) {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   FileHeader header = readHeader();
 
   Page existing_page = readPage(page_number);
@@ -315,6 +331,7 @@ FileIterator PageFile::end() {
 
 void PageFile::writePage(const PageId page_number, const PageHeader& header,
                      const Page& new_page) {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   stream_->seekp(pagePosition(page_number), std::ios::beg);
   stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
   stream_->write(reinterpret_cast<const char*>(&new_page.data_[0]),
@@ -323,6 +340,7 @@ void PageFile::writePage(const PageId page_number, const PageHeader& header,
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   PageHeader header;
   stream_->seekg(pagePosition(page_number), std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&header), sizeof(PageHeader));
@@ -362,6 +380,7 @@ BlobFile& BlobFile::operator=(const BlobFile& rhs) {
 }
 
 Page BlobFile::allocatePage(PageId &new_page_number) {
+  std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
   FileHeader header = readHeader();
 	Page new_page;
 
@@ -380,6 +399,7 @@ Page BlobFile::allocatePage(PageId &new_page_number) {
 }
 
 Page BlobFile::readPage(const PageId page_number) const {
+	std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
 	Page page;
 	stream_->seekg(pagePosition(page_number), std::ios::beg);
 	stream_->read(reinterpret_cast<char*>(&page), Page::SIZE);
@@ -387,6 +407,7 @@ Page BlobFile::readPage(const PageId page_number) const {
 }
 
 void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
+	std::lock_guard<std::recursive_mutex> guard(*stream_mutex_);
 	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
 	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
 	stream_->flush();
@@ -397,4 +418,41 @@ void BlobFile::deletePage(const PageId page_number) {
 	throw InvalidPageException(page_number, filename_);
 }
 
+PageFileReader::PageFileReader(const std::string& filename)
+: filename_(filename) {
+  fd_ = ::open(filename.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    throw FileNotFoundException(filename);
+  }
+}
+
+PageFileReader::~PageFileReader() {
+  ::close(fd_);
+}
+
+PageId PageFileReader::numPages() const {
+  FileHeader header;
+  readAt(&header, sizeof(FileHeader), 0, 0);
+  return header.num_pages;
+}
+
+bool PageFileReader::readPage(const PageId page_number, Page& page) const {
+  readAt(&page, Page::SIZE, (std::streamoff)File::pagePosition(page_number), page_number);
+  return page.isUsed();
+}
+
+void PageFileReader::readAt(void* buffer, std::size_t size, off_t offset,
+                            PageId page_number) const {
+  char* bytes = static_cast<char*>(buffer);
+  while (size > 0) {
+    ssize_t count = ::pread(fd_, bytes, size, offset);
+    if (count <= 0) {
+      throw InvalidPageException(page_number, filename_);
+    }
+    bytes += count;
+    size -= count;
+    offset += count;
+  }
+}
+
 }
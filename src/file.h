@@ -11,12 +11,15 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <sys/types.h>
 
 #include "page.h"
 
 namespace badgerdb {
 
 class FileIterator;
+class PageFileReader;
 
 /**
  * @brief Header metadata for files on disk which contain pages.
@@ -212,6 +215,7 @@ class File {
 
   typedef std::map<std::string, std::shared_ptr<std::fstream> > StreamMap;
   typedef std::map<std::string, int> CountMap;
+  typedef std::map<std::string, std::shared_ptr<std::recursive_mutex> > MutexMap;
 
   /**
    * Streams for opened files.
@@ -223,6 +227,11 @@ class File {
    */
   static CountMap open_counts_;
 
+  /**
+   * Mutexes serializing the use of the streams for opened files.
+   */
+  static MutexMap open_mutexes_;
+
   /**
    * Name of the file this object represents.
    */
@@ -233,7 +242,15 @@ class File {
    */
   std::shared_ptr<std::fstream> stream_;
 
+  /**
+   * Mutex held while the stream is positioned and read or written, shared by all
+   * File objects using the stream. Operations made of several reads and writes,
+   * like allocating a page, hold it throughout.
+   */
+  std::shared_ptr<std::recursive_mutex> stream_mutex_;
+
   friend class FileIterator;
+  friend class PageFileReader;
 };
 
 class PageFile : public File {
@@ -475,4 +492,63 @@ class BlobFile : public File {
   void deletePage(const PageId page_number);
 };
 
+/**
+ * @brief Reads the pages of a PageFile through a file descriptor of its own, with
+ * positioned reads that share no stream or lock with the File objects of the file
+ * or with other readers. Several threads can each read pages through their own
+ * reader in parallel. Pages changed through a File object are seen once they are
+ * written out.
+ */
+class PageFileReader {
+ public:
+  /**
+   * Opens the file for reading.
+   *
+   * @param filename  Name of the file.
+   * @throws  FileNotFoundException   If the file cannot be opened.
+   */
+  explicit PageFileReader(const std::string& filename);
+
+  /**
+   * Closes the file descriptor.
+   */
+  ~PageFileReader();
+
+  PageFileReader(const PageFileReader&) = delete;
+  PageFileReader& operator=(const PageFileReader&) = delete;
+
+  /**
+   * Returns the number of pages allocated in the file, counting the header, so
+   * that page numbers run from 1 up to it.
+   */
+  PageId numPages() const;
+
+  /**
+   * Reads a page of the file.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Set to the page read.
+   * @return  False if the page is free (unused).
+   * @throws  InvalidPageException  If the page is past the end of the file.
+   */
+  bool readPage(const PageId page_number, Page& page) const;
+
+ private:
+  /**
+   * Reads size bytes at offset, throwing InvalidPageException for page_number if
+   * the file ends first.
+   */
+  void readAt(void* buffer, std::size_t size, off_t offset, PageId page_number) const;
+
+  /**
+   * Name of the file read.
+   */
+  std::string filename_;
+
+  /**
+   * Descriptor the file is read through.
+   */
+  int fd_;
+};
+
 }
@@ -0,0 +1,140 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <limits>
+#include "indexfetchscan.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+
+namespace badgerdb {
+
+IndexFetchScan::IndexFetchScan(const std::string &name, BufMgr *bufferMgr, BTreeIndex *index,
+                               const size_t sortThresholdIn)
+  : cursor(index)
+{
+  file = new PageFile(name, false);	//dont create new file
+  bufMgr = bufferMgr;
+  sortThreshold = sortThresholdIn;
+  nextRid = 0;
+  sorted = false;
+  scanExecuting = false;
+  curPage = NULL;
+  curPageNum = Page::INVALID_NUMBER;
+}
+
+IndexFetchScan::~IndexFetchScan()
+{
+  if (curPage != NULL)
+  {
+    bufMgr->unPinPage(file, curPageNum, false);
+    curPage = NULL;
+  }
+  bufMgr->flushFile(file);
+  delete file;
+}
+
+void IndexFetchScan::startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp)
+{
+  if (scanExecuting)
+  {
+    endScan();
+  }
+
+  // a range of up to sortThreshold record ids is read whole and fetched in key order, only a range past that is
+  // read to its end and sorted. The index is let go before any page of the relation is read.
+  cursor.startScan(lowVal, lowOp, highVal, highOp);
+  rids.clear();
+  try
+  {
+    size_t firstRids = sortThreshold < std::numeric_limits<size_t>::max() ? sortThreshold + 1 : sortThreshold;
+    sorted = readRids(firstRids) > sortThreshold;
+    if (sorted)
+    {
+      readRids(std::numeric_limits<size_t>::max());
+    }
+  }
+  catch (...)
+  {
+    cursor.endScan();
+    throw;
+  }
+  cursor.endScan();
+
+  // a large range reads each page once, in file order
+  if (sorted)
+  {
+    std::sort(rids.begin(), rids.end(), [](const RecordId& a, const RecordId& b)
+      { return a.page_number != b.page_number ? a.page_number < b.page_number : a.slot_number < b.slot_number; });
+  }
+  nextRid = 0;
+  scanExecuting = true;
+}
+
+size_t IndexFetchScan::readRids(size_t maxRids)
+{
+  const size_t batchSize = 256;
+  size_t numRids;
+  do
+  {
+    size_t wanted = std::min(batchSize, maxRids - rids.size());
+    rids.resize(rids.size() + wanted);
+    numRids = cursor.scanNextBatch(rids.data() + rids.size() - wanted, wanted);
+    rids.resize(rids.size() - wanted + numRids);
+  } while (numRids > 0 && rids.size() < maxRids);
+  return rids.size();
+}
+
+void IndexFetchScan::scanNext(RecordId& outRid)
+{
+  if (!scanExecuting)
+  {
+    throw ScanNotInitializedException();
+  }
+  if (nextRid == rids.size())
+  {
+    throw IndexScanCompletedException();
+  }
+
+  // the page stays pinned for the records after this one on it
+  const RecordId& rid = rids[nextRid++];
+  if (curPage == NULL || rid.page_number != curPageNum)
+  {
+    if (curPage != NULL)
+    {
+      bufMgr->unPinPage(file, curPageNum, false);
+      curPage = NULL;
+    }
+    bufMgr->readPage(file, rid.page_number, curPage);
+    curPageNum = rid.page_number;
+  }
+  curRecord = curPage->getRecord(rid);
+  outRid = rid;
+}
+
+std::string IndexFetchScan::getRecord()
+{
+  return curRecord;
+}
+
+void IndexFetchScan::endScan()
+{
+  if (!scanExecuting)
+  {
+    throw ScanNotInitializedException();
+  }
+  if (curPage != NULL)
+  {
+    bufMgr->unPinPage(file, curPageNum, false);
+    curPage = NULL;
+  }
+  rids.clear();
+  nextRid = 0;
+  scanExecuting = false;
+}
+
+}
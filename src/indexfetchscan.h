@@ -0,0 +1,131 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "page.h"
+#include "buffer.h"
+#include "btree.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Number of record ids of a range up to which IndexFetchScan fetches the records in key order.
+ */
+const size_t FETCH_SORT_THRESHOLD = 256;
+
+/**
+ * @brief This class is used to scan the records of a relation whose key lies in a range of an index on it.
+ * The record ids of the range are read from the index first, and the index scan is ended before any record
+ * is fetched. A range of up to sortThreshold record ids is read no further than one past that and its records
+ * come in key order. Only a range past that is read whole, and its record ids are sorted
+ * by page, so that each page of the relation is read once and the pages in file order, at the cost of the
+ * key order.
+ */
+class IndexFetchScan
+{
+ public:
+
+  IndexFetchScan(const std::string &name, BufMgr *bufMgr, BTreeIndex *index,
+                 const size_t sortThreshold = FETCH_SORT_THRESHOLD);
+
+  ~IndexFetchScan();
+
+  /**
+   * Begin a scan of the records whose key is in the range, with the same semantics as BTreeIndex::startScan().
+   * A scan already executing is ended first.
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+   * @throws  NoSuchKeyFoundException If the index is empty.
+   */
+  void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+   * Fetch the next record of the scan, read through getRecord().
+   * @param outRid	RecordId of the record
+   * @throws ScanNotInitializedException If no scan has been initialized.
+   * @throws IndexScanCompletedException If no more records are left to be scanned.
+   */
+  void scanNext(RecordId& outRid);
+
+  //read current record
+  std::string getRecord();
+
+  /**
+   * True if the records of the scan come sorted by page rather than in key order.
+   */
+  bool pageOrder() const { return sorted; }
+
+  /**
+   * Terminate the scan, unpinning the page of the current record.
+   * @throws ScanNotInitializedException If no scan has been initialized.
+   */
+  void endScan();
+
+ private:
+  /**
+   * Append the record ids of the scan of the cursor to rids until it holds maxRids or the range ends.
+   * @return Number of record ids in rids
+   */
+  size_t readRids(size_t maxRids);
+
+  /**
+   * File of the relation.
+   */
+  PageFile      *file;
+
+  /**
+   * Buffer Manager instance used to read pages into the buffer pool.
+   */
+	BufMgr				*bufMgr;
+
+  /**
+   * Cursor reading the record ids of the range from the index.
+   */
+  IndexScanCursor cursor;
+
+  /**
+   * Number of record ids up to which the records are fetched in key order.
+   */
+  size_t        sortThreshold;
+
+  /**
+   * Record ids of the range, in the order their records are fetched.
+   */
+  std::vector<RecordId> rids;
+
+  /**
+   * Position in rids of the next record to fetch.
+   */
+  size_t        nextRid;
+
+  /**
+   * True if rids is sorted by page.
+   */
+  bool          sorted;
+
+  /**
+   * True if a scan has been started.
+   */
+  bool          scanExecuting;
+
+  /**
+   * Page of the current record, kept pinned until a record of another page is fetched.
+   */
+  Page*         curPage;
+  PageId        curPageNum;
+
+  /**
+   * Current record.
+   */
+  std::string   curRecord;
+};
+
+}
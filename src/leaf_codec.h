@@ -0,0 +1,104 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "node_search.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Bit packing of the columns of a compressed leaf.
+ * A column of count values, each stored with the same number of bits, is packed into a byte stream value
+ * after value, with no padding between them. Packing and unpacking go through unaligned 64-bit words, so
+ * the stream needs LEAF_CODEC_PADDING bytes after its end. Unpacking, the hot part, works on each value on
+ * its own: the AVX2 kernel gathers the 32 bits holding 8 values at once, shifts each into place and masks
+ * it, and is picked at run time like the node search kernels. Other targets and widths past 25 bits, where
+ * a value may straddle 5 bytes, use the scalar loop.
+ */
+    const int LEAF_CODEC_PADDING = sizeof( uint64_t );
+
+    namespace leafcodec
+    {
+        /* Number of bits needed to store values up to maxValue */
+        inline int bitWidth( uint32_t maxValue )
+        {
+            return maxValue == 0 ? 0 : 32 - __builtin_clz( maxValue );
+        }
+
+        /* Number of bytes taken by a column of count values of the given width */
+        inline int columnBytes( int count, int bits )
+        {
+            return ( count * bits + 7 ) / 8;
+        }
+
+        /* Packs values[0, count) into out, which must be zeroed for the column and the padding after it */
+        inline void pack( unsigned char* out, const uint32_t* values, int count, int bits )
+        {
+            for( int i = 0; i < count; i++ )
+            {
+                int bit = i * bits;
+                uint64_t word;
+                memcpy( &word, out + bit / 8, sizeof( word ) );
+                word |= (uint64_t)values[ i ] << ( bit % 8 );
+                memcpy( out + bit / 8, &word, sizeof( word ) );
+            }
+        }
+
+        /* Unpacks the values from begin to count of a column and adds base to each */
+        inline void unpackScalar( const unsigned char* in, int begin, int count, int bits, uint32_t base, uint32_t* out )
+        {
+            const uint64_t mask = ( (uint64_t)1 << bits ) - 1;
+            for( int i = begin; i < count; i++ )
+            {
+                int bit = i * bits;
+                uint64_t word;
+                memcpy( &word, in + bit / 8, sizeof( word ) );
+                out[ i ] = base + (uint32_t)( ( word >> ( bit % 8 ) ) & mask );
+            }
+        }
+
+#ifdef BADGERDB_NODE_SEARCH_X86
+        __attribute__(( target( "avx2" ) ))
+        inline void unpackAvx2( const unsigned char* in, int count, int bits, uint32_t base, uint32_t* out )
+        {
+            const __m256i lanes = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+            const __m256i width = _mm256_set1_epi32( bits );
+            const __m256i mask = _mm256_set1_epi32( (int)( ( 1u << bits ) - 1 ) );
+            const __m256i seven = _mm256_set1_epi32( 7 );
+            const __m256i b = _mm256_set1_epi32( (int)base );
+            int i = 0;
+            for( ; i + 8 <= count; i += 8 )
+            {
+                __m256i bit = _mm256_mullo_epi32( _mm256_add_epi32( _mm256_set1_epi32( i ), lanes ), width );
+                __m256i words = _mm256_i32gather_epi32( (const int*)in, _mm256_srli_epi32( bit, 3 ), 1 );
+                __m256i values = _mm256_and_si256( _mm256_srlv_epi32( words, _mm256_and_si256( bit, seven ) ), mask );
+                _mm256_storeu_si256( (__m256i*)( out + i ), _mm256_add_epi32( values, b ) );
+            }
+            unpackScalar( in, i, count, bits, base, out );
+        }
+#endif
+
+        /* Unpacks a column of count values of the given width and adds base to each */
+        inline void unpack( const unsigned char* in, int count, int bits, uint32_t base, uint32_t* out )
+        {
+#ifdef BADGERDB_NODE_SEARCH_X86
+            /* A value and its offset in its first byte fit in the 32 bits gathered for it up to 25 bits */
+            if( bits <= 25 && nodesearch::haveAvx2() )
+            {
+                unpackAvx2( in, count, bits, base, out );
+                return;
+            }
+#endif
+            unpackScalar( in, 0, count, bits, base, out );
+        }
+    }
+
+}
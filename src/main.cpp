@@ -6,9 +6,16 @@
  */
 
 #include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <functional>
 #include "btree.h"
+#include "node_search.h"
 #include "page.h"
 #include "filescan.h"
+#include "indexfetchscan.h"
+#include "staticindex.h"
 #include "page_iterator.h"
 #include "file_iterator.h"
 #include "exceptions/insufficient_space_exception.h"
@@ -19,6 +26,7 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/bad_index_info_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -67,9 +75,21 @@ BufMgr * bufMgr = new BufMgr(100);
 void createRelationForward();
 void createRelationBackward();
 void createRelationRandom();
+void createRelationDuplicates(int numKeys);
+void createIntRelation(bool duplicates);
 void intTests();
 int intScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int intBatchScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int intDescendingScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp, bool batch);
+std::vector<int> intScanKeys(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp, ScanOrder order, size_t limit, size_t offset, bool batch);
+std::vector<int> scanKeys(BTreeIndex *index, bool batch);
+std::vector<RecordId> intScanRids(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp, ScanOrder order, size_t limit, size_t offset);
+void doubleTests();
+int doubleScan(BTreeIndex *index, double lowVal, Operator lowOp, double highVal, Operator highOp);
+void stringTests();
+int stringScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
 void indexTests();
+void formatTests(bool duplicates, bool appendMode, const std::function<void(BTreeIndex&, LeafFormat, bool)>& checks);
 void test1();
 void test2();
 void test3();
@@ -77,6 +97,48 @@ void test3();
 void test4();
 void test5();
 void test6();
+void test7();
+void test8();
+void test9();
+void test10();
+void test11();
+void test12();
+void test13();
+void test14();
+void test15();
+void test16();
+void test17();
+void test18();
+void test19();
+void test20();
+void test21();
+void test22();
+void test23();
+void test24();
+void test25();
+void test26();
+void test27();
+void test28();
+void concurrentTests(ConcurrencyMode mode);
+void lookupTests(ConcurrencyMode mode);
+long appendTests(bool appendMode);
+long splitPolicyTests(const SplitPolicy& policy, int step);
+long postingListTests(LeafFormat format, ConcurrencyMode mode);
+long compressedLeafTests(LeafFormat format, ConcurrencyMode mode);
+void descendingTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+void pagedScanTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+void orderStatisticTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+int badSelects(BTreeIndex *index, int numKeys, int perKey);
+void batchInsertTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+void insertKeys(BTreeIndex *index, const std::vector<int>& keys, const RecordId& rid, size_t batchSize);
+void multiRangeScanTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+void parallelBuildTests(LeafFormat format, bool duplicates);
+void removeIndexes(const std::vector<std::string>& names);
+std::vector<int> fetchScanKeys(IndexFetchScan& fetchScan, int lowVal, Operator lowOp, int highVal, Operator highOp, int& pageSwitches);
+void multiLookupTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+void snapshotTests(BTreeIndex& index, LeafFormat format, bool duplicates);
+std::vector<int> snapshotScanKeys(StaticIndex& snapshot, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int snapshotScanCount(StaticIndex& snapshot, const void* lowVal, Operator lowOp, const void* highVal, Operator highOp);
 void errorTests();
 void deleteRelation();
 
@@ -147,6 +209,28 @@ int main(int argc, char **argv)
     test4();
     test5();
     test6();
+    test7();
+    test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
+    test16();
+    test17();
+    test18();
+    test19();
+    test20();
+    test21();
+    test22();
+    test23();
+    test24();
+    test25();
+    test26();
+    test27();
+    test28();
 	//errorTests();
 
   return 1;
@@ -222,13 +306,1694 @@ void test6()
 	deleteRelation();
 }
 
+void test7()
+{
+	// Bulk load an index half full over a relation in random order, then insert
+	// entries on top of it and check that scans see both
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "bulk load with fill factor 0.5 for relationSize 100000" << std::endl;
+	relationSize = 100000;
+	createRelationRandom();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.5);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,-100,GT,4000000,LT), relationSize)
+
+		// point the new keys at the record of key 0 so the scan can fetch them
+		int zero = 0;
+		RecordId zeroRid;
+		index.startScan(&zero, GTE, &zero, LTE);
+		index.scanNext(zeroRid);
+		index.endScan();
+		for (int i = relationSize; i < relationSize + 1000; i++)
+			index.insertEntry(&i, zeroRid);
+
+		checkPassFail(intScan(&index,relationSize - 10,GTE,relationSize + 10,LT), 20)
+		checkPassFail(intScan(&index,-100,GT,4000000,LT), relationSize + 1000)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void test8()
+{
+	// Bulk load a sparse, deep index and delete from it, so that leaves and non-leaf
+	// nodes get merged and redistributed, then insert the entries back
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "deletes on a bulk load with fill factor 0.01 for relationSize 20000" << std::endl;
+	relationSize = 20000;
+	createRelationRandom();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.01);
+
+		// find the rid of every key
+		std::vector<RecordId> rids(relationSize);
+		int low = 0, high = relationSize;
+		RecordId scanRid;
+		Page *curPage;
+		index.startScan(&low, GTE, &high, LT);
+		try
+		{
+			while(1)
+			{
+				index.scanNext(scanRid);
+				bufMgr->readPage(file1, scanRid.page_number, curPage);
+				RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+				bufMgr->unPinPage(file1, scanRid.page_number, false);
+				rids[myRec.i] = scanRid;
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+		}
+		index.endScan();
+
+		// delete every even key
+		for (int i = 0; i < relationSize; i += 2)
+			index.deleteEntry(&i, rids[i]);
+		checkPassFail(intScan(&index,25,GT,40,LT), 7)
+		checkPassFail(intScan(&index,-100,GT,4000000,LT), relationSize / 2)
+
+		try
+		{
+			int two = 2;
+			index.deleteEntry(&two, rids[2]);
+			std::cout << "\nTest FAILS: deleted a missing entry" << std::endl;
+			exit(1);
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+		}
+
+		// delete a range of odd keys, then everything below 5000
+		int rangeLow = 1000, rangeHigh = 3000;
+		checkPassFail(index.deleteRange(&rangeLow, GTE, &rangeHigh, LT), 1000)
+		rangeLow = -100;
+		rangeHigh = 5000;
+		checkPassFail(index.deleteRange(&rangeLow, GT, &rangeHigh, LTE), 1500)
+		checkPassFail(intScan(&index,-100,GT,4000000,LT), relationSize / 2 - 2500)
+
+		// the subtree counts left by the range deletes land offset scans on the right keys
+		std::vector<RecordId> offsetRids = intScanRids(&index, -100, GT, 4000000, LT, ASCENDING, 1, 100);
+		checkPassFail((offsetRids.size() == 1 && offsetRids[0] == rids[5201]), true)
+		offsetRids = intScanRids(&index, -100, GT, 4000000, LT, DESCENDING, 1, 100);
+		checkPassFail((offsetRids.size() == 1 && offsetRids[0] == rids[relationSize - 201]), true)
+
+		// put everything back, reusing the pages freed by the merges
+		for (int i = 0; i < relationSize; i++)
+		{
+			if (i % 2 == 0 || i < 5000)
+				index.insertEntry(&i, rids[i]);
+		}
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,-100,GT,4000000,LT), relationSize)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void test9()
+{
+	// Run two cursors and the index's own scan over overlapping ranges at the same
+	// time, and a nested cursor restarted for every entry of an outer one
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "concurrent scan cursors for relationSize 5000" << std::endl;
+	relationSize = 5000;
+	createRelationRandom();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		IndexScanCursor first(&index), second(&index);
+		int low1 = 0, high1 = 1000, low2 = 500, high2 = 1500, low3 = 4000, high3 = 6000;
+		int count1 = 0, count2 = 0, count3 = 0;
+		bool done1 = false, done2 = false, done3 = false;
+		RecordId rid;
+
+		first.startScan(&low1, GTE, &high1, LT);
+		second.startScan(&low2, GTE, &high2, LTE);
+		index.startScan(&low3, GT, &high3, LT);
+		while (!done1 || !done2 || !done3)
+		{
+			try { if (!done1) { first.scanNext(rid); count1++; } } catch(IndexScanCompletedException e) { done1 = true; }
+			try { if (!done2) { second.scanNext(rid); count2++; } } catch(IndexScanCompletedException e) { done2 = true; }
+			try { if (!done3) { index.scanNext(rid); count3++; } } catch(IndexScanCompletedException e) { done3 = true; }
+		}
+		first.endScan();
+		second.endScan();
+		index.endScan();
+		checkPassFail(count1, 1000)
+		checkPassFail(count2, 1001)
+		checkPassFail(count3, 999)
+
+		// nested loop: every outer entry in [0, 100) restarts the inner cursor on [key, key + 10)
+		int outerLow = 0, outerHigh = 100, nested = 0;
+		first.startScan(&outerLow, GTE, &outerHigh, LT);
+		try
+		{
+			for (int key = 0; ; key++)
+			{
+				first.scanNext(rid);
+				int innerHigh = key + 10;
+				second.startScan(&key, GTE, &innerHigh, LT);
+				try
+				{
+					while(1)
+					{
+						second.scanNext(rid);
+						nested++;
+					}
+				}
+				catch(IndexScanCompletedException e)
+				{
+				}
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+		}
+		second.endScan();
+		first.endScan();
+		checkPassFail(nested, 1000)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void test10()
+{
+	// Insert from several threads while other threads scan the bulk loaded keys,
+	// forcing leaf and non-leaf splits under the readers
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "concurrent inserts and scans for relationSize 20000" << std::endl;
+	concurrentTests(LATCH_COUPLING);
+}
+
+void test11()
+{
+	// Same as test10 on a B-link index, whose readers take no latches
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "concurrent inserts and B-link scans for relationSize 20000" << std::endl;
+	concurrentTests(BLINK);
+}
+
+void test12()
+{
+	// Compare the vectorized node search against std::lower_bound/upper_bound on sorted
+	// key arrays of every length up to a full node, with duplicates and keys outside the array
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "node search kernels" << std::endl;
+	std::vector<int> intKeys;
+	std::vector<double> doubleKeys;
+	int mismatches = 0;
+	for (int n = 0; n <= INTARRAYNONLEAFSIZE; n += (n < 100 ? 1 : 37))
+	{
+		intKeys.clear();
+		doubleKeys.clear();
+		for (int i = 0; i < n; i++)
+		{
+			intKeys.push_back(i / 3 * 2);
+			doubleKeys.push_back(i / 3 * 2 + 0.5);
+		}
+		const int* ik = intKeys.data();
+		const double* dk = doubleKeys.data();
+		for (int key = -2; key <= n; key++)
+		{
+			double dkey = key + 0.5;
+			if (nodeLowerBound(ik, n, key) != std::lower_bound(ik, ik + n, key) - ik
+				|| nodeUpperBound(ik, n, key) != std::upper_bound(ik, ik + n, key) - ik
+				|| nodeLowerBound(dk, n, dkey) != std::lower_bound(dk, dk + n, dkey) - dk
+				|| nodeUpperBound(dk, n, dkey) != std::upper_bound(dk, dk + n, dkey) - dk)
+				mismatches++;
+		}
+	}
+	checkPassFail(mismatches, 0)
+}
+
+void test13()
+{
+	// Point lookups of every key, of missing keys and of a key duplicated across several
+	// leaves, in both concurrency modes, while the index's own scan is open
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "point lookups for relationSize 5000" << std::endl;
+	lookupTests(LATCH_COUPLING);
+	lookupTests(BLINK);
+}
+
+void lookupTests(ConcurrencyMode mode)
+{
+	relationSize = 5000;
+	createRelationForward();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, mode);
+		int low = 0, high = relationSize, scanned = 0;
+		RecordId rid;
+		index.startScan(&low, GTE, &high, LT);
+		index.scanNext(rid);
+		scanned++;
+
+		std::vector<RecordId> rids;
+		int badLookups = 0;
+		for (int key = 0; key < relationSize; key++)
+		{
+			rids.clear();
+			if (index.lookupAll(&key, rids) != 1 || rids.size() != 1)
+				badLookups++;
+		}
+		checkPassFail(badLookups, 0)
+
+		int missing = -1;
+		checkPassFail(index.lookupAll(&missing, rids), 0)
+		missing = relationSize;
+		checkPassFail(index.lookupAll(&missing, rids), 0)
+
+		// the index's own scan carries on where it was
+		try
+		{
+			while(1)
+			{
+				index.scanNext(rid);
+				scanned++;
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+		}
+		index.endScan();
+		checkPassFail(scanned, relationSize)
+
+		int dupKey = relationSize / 2, numDups = 1500;
+		for (int i = 0; i < numDups; i++)
+			index.insertEntry(&dupKey, rid);
+		rids.clear();
+		checkPassFail(index.lookupAll(&dupKey, rids), numDups + 1)
+		checkPassFail((int)rids.size(), numDups + 1)
+
+		int called = 0;
+		checkPassFail(index.lookup(&dupKey, [&called](const RecordId&) { called++; }), numDups + 1)
+		checkPassFail(called, numDups + 1)
+
+		int neighbour = dupKey - 1;
+		checkPassFail(index.lookup(&neighbour, [&called](const RecordId&) { called++; }), 1)
+		neighbour = dupKey + 1;
+		checkPassFail(index.lookup(&neighbour, [&called](const RecordId&) { called++; }), 1)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void test14()
+{
+	// Insert increasing keys with and without append mode, which should leave the leaves
+	// behind the right edge full and the index file about half the size
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "increasing inserts in append mode for relationSize 1000" << std::endl;
+	long plainSize = appendTests(false);
+	long appendSize = appendTests(true);
+	checkPassFail((appendSize * 3 < plainSize * 2), true)
+}
+
+long appendTests(bool appendMode)
+{
+	relationSize = 1000;
+	createRelationForward();
+	const int numInserts = 30000;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, appendMode);
+		RecordId rid;
+		int low = 0;
+		index.startScan(&low, GTE, &low, LTE);
+		index.scanNext(rid);
+		index.endScan();
+
+		for (int key = relationSize; key < relationSize + numInserts; key++)
+			index.insertEntry(&key, rid);
+		checkPassFail(intScan(&index,-1,GT,relationSize + numInserts,LT), relationSize + numInserts)
+		checkPassFail(intScan(&index,relationSize - 5,GTE,relationSize + 5,LT), 10)
+
+		// the subtree counts take in the appends not counted on the right edge yet
+		int none = -1, end = relationSize + numInserts, kthKey;
+		RecordId kthRid;
+		checkPassFail(index.countRange(&none, GT, &end, LT), relationSize + numInserts)
+		index.selectKth(end - 3, &kthKey, kthRid);
+		checkPassFail(kthKey, end - 3)
+
+		std::vector<RecordId> rids;
+		int badLookups = 0;
+		for (int key = 0; key < relationSize + numInserts; key += 7)
+		{
+			rids.clear();
+			if (index.lookupAll(&key, rids) != 1)
+				badLookups++;
+		}
+		checkPassFail(badLookups, 0)
+
+		// keys out of order and deletes at the right edge fall back to inserts from the root
+		int outOfOrder = -5;
+		index.insertEntry(&outOfOrder, rid);
+		int high = relationSize + numInserts;
+		int deleteLow = high - 1000;
+		checkPassFail(index.deleteRange(&deleteLow, GTE, &high, LT), 1000)
+		for (int key = deleteLow; key < high + 1000; key++)
+			index.insertEntry(&key, rid);
+		checkPassFail(intScan(&index,-10,GT,high + 1000,LT), relationSize + numInserts + 1001)
+		int outside = -10, highEnd = high + 1000;
+		checkPassFail(index.countRange(&outside, GT, &highEnd, LT), relationSize + numInserts + 1001)
+	}
+
+	std::ifstream indexFile(intIndexName.c_str(), std::ios::binary | std::ios::ate);
+	long indexSize = indexFile.tellg();
+	indexFile.close();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+	return indexSize;
+}
+
+void test15()
+{
+	// Insert increasing, decreasing and scattered keys under each split policy. The biased
+	// splits matching the insert order, and the adaptive one, should leave the index smaller.
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "split policies for relationSize 1000" << std::endl;
+	long evenUp = splitPolicyTests(SplitPolicy(EVEN_SPLIT), 1);
+	long leftUp = splitPolicyTests(SplitPolicy(LEFT_BIASED_SPLIT), 1);
+	long adaptiveUp = splitPolicyTests(SplitPolicy(ADAPTIVE_SPLIT), 1);
+	long evenDown = splitPolicyTests(SplitPolicy(EVEN_SPLIT), -1);
+	long rightDown = splitPolicyTests(SplitPolicy(RIGHT_BIASED_SPLIT), -1);
+	long adaptiveDown = splitPolicyTests(SplitPolicy(ADAPTIVE_SPLIT), -1);
+	splitPolicyTests(SplitPolicy(LEFT_BIASED_SPLIT, 0.75), 7919);
+	splitPolicyTests(SplitPolicy(RIGHT_BIASED_SPLIT, 0.75), 7919);
+	splitPolicyTests(SplitPolicy(ADAPTIVE_SPLIT, 0.6), 7919);
+	checkPassFail((leftUp * 3 < evenUp * 2), true)
+	checkPassFail((adaptiveUp * 3 < evenUp * 2), true)
+	checkPassFail((rightDown * 3 < evenDown * 2), true)
+	checkPassFail((adaptiveDown * 3 < evenDown * 2), true)
+}
+
+long splitPolicyTests(const SplitPolicy& policy, int step)
+{
+	// keys are inserted above the relation's keys for a positive step and below them otherwise,
+	// a step other than +-1 visits them in scattered order
+	relationSize = 1000;
+	createRelationForward();
+	const int numInserts = 20000;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, false, policy);
+		RecordId rid;
+		int low = 0;
+		index.startScan(&low, GTE, &low, LTE);
+		index.scanNext(rid);
+		index.endScan();
+
+		for (int i = 0; i < numInserts; i++)
+		{
+			int offset = (int)((long)i * (step < 0 ? -step : step) % numInserts);
+			int key = step < 0 ? -1 - offset : relationSize + offset;
+			index.insertEntry(&key, rid);
+		}
+		checkPassFail(intScan(&index,-numInserts - 1,GT,relationSize + numInserts,LT), relationSize + numInserts)
+		checkPassFail(intScan(&index,-5,GTE,5,LT), (step < 0 ? 10 : 5))
+		checkPassFail(intScan(&index,relationSize - 5,GTE,relationSize + 5,LT), (step < 0 ? 5 : 10))
+	}
+
+	std::ifstream indexFile(intIndexName.c_str(), std::ios::binary | std::ios::ate);
+	long indexSize = indexFile.tellg();
+	indexFile.close();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+	return indexSize;
+}
+
+void test16()
+{
+	// Bulk load a relation with few distinct keys into posting lists, grow a posting list past
+	// a page and a run of inserts into a new one, and delete from them
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "posting lists for relationSize 20000" << std::endl;
+	long plainSize = postingListTests(PLAIN_LEAVES, LATCH_COUPLING);
+	long postingSize = postingListTests(POSTING_LIST_LEAVES, LATCH_COUPLING);
+	postingListTests(POSTING_LIST_LEAVES, BLINK);
+	checkPassFail((postingSize < plainSize), true)
+}
+
+long postingListTests(LeafFormat format, ConcurrencyMode mode)
+{
+	relationSize = 20000;
+	const int numKeys = 10, perKey = relationSize / numKeys;
+	createRelationDuplicates(numKeys);
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, mode, false, SplitPolicy(), format);
+		checkPassFail(intScan(&index,-1,GT,numKeys,LT), relationSize)
+		checkPassFail(intBatchScan(&index,3,GTE,5,LT), 2 * perKey)
+		checkPassFail(intBatchScan(&index,3,GT,5,LTE), 2 * perKey)
+
+		std::vector<RecordId> rids, moreRids;
+		int badLookups = 0;
+		for (int key = 0; key < numKeys; key++)
+		{
+			rids.clear();
+			if (index.lookupAll(&key, rids) != perKey)
+				badLookups++;
+		}
+		checkPassFail(badLookups, 0)
+
+		// give key 3 the record ids of key 4 as well, spilling its list over more pages
+		int key3 = 3, key4 = 4;
+		index.lookupAll(&key4, moreRids);
+		for (size_t i = 0; i < moreRids.size(); i++)
+			index.insertEntry(&key3, moreRids[i]);
+		checkPassFail(index.lookupAll(&key3, rids), 2 * perKey)
+		checkPassFail(intScan(&index,2,GT,4,LT), 2 * perKey)
+
+		// a run of inserts of a new key
+		int newKey = numKeys;
+		for (int i = 0; i < perKey; i++)
+			index.insertEntry(&newKey, moreRids[i]);
+		rids.clear();
+		checkPassFail(index.lookupAll(&newKey, rids), perKey)
+		checkPassFail(intScan(&index,-1,GT,numKeys,LTE), relationSize + 2 * perKey)
+
+		// delete them again, and a range with a list of its own
+		for (size_t i = 0; i < moreRids.size(); i++)
+			index.deleteEntry(&key3, moreRids[i]);
+		for (int i = 0; i < perKey; i++)
+			index.deleteEntry(&newKey, moreRids[i]);
+		rids.clear();
+		checkPassFail(index.lookupAll(&key3, rids), perKey)
+		checkPassFail(index.lookupAll(&newKey, rids), 0)
+		int low = 7, high = 8;
+		checkPassFail(index.deleteRange(&low, GTE, &high, LTE), 2 * perKey)
+		checkPassFail(intBatchScan(&index,-1,GT,numKeys,LTE), relationSize - 2 * perKey)
+	}
+
+	std::ifstream indexFile(intIndexName.c_str(), std::ios::binary | std::ios::ate);
+	long indexSize = indexFile.tellg();
+	indexFile.close();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+	return indexSize;
+}
+
+void concurrentTests(ConcurrencyMode mode)
+{
+	relationSize = 20000;
+	createRelationForward();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, mode);
+		const int numWriters = 4, numReaders = 3, insertsPerWriter = 5000;
+		std::atomic<int> badScans(0);
+
+		int zero = 0;
+		RecordId zeroRid;
+		index.startScan(&zero, GTE, &zero, LTE);
+		index.scanNext(zeroRid);
+		index.endScan();
+
+		std::vector<std::thread> threads;
+		for (int w = 0; w < numWriters; w++)
+		{
+			threads.push_back(std::thread([&index, &zeroRid, w]() {
+				for (int j = 0; j < insertsPerWriter; j++)
+				{
+					int key = relationSize + w + j * numWriters;
+					index.insertEntry(&key, zeroRid);
+				}
+			}));
+		}
+		for (int r = 0; r < numReaders; r++)
+		{
+			// the first reader fetches one entry at a time, the second in batches, the last one scans
+			// down from the leaf the writers split, one way and the other on alternate passes
+			threads.push_back(std::thread([&index, &badScans, r]() {
+				IndexScanCursor cursor(&index);
+				RecordId rids[100];
+				for (int pass = 0; pass < 10; pass++)
+				{
+					int low = 0, high = relationSize, count = 0;
+					cursor.startScan(&low, GTE, &high, LT, r == 2 ? DESCENDING : ASCENDING);
+					if (r == 0 || (r == 2 && pass % 2 == 0))
+					{
+						try
+						{
+							while(1)
+							{
+								cursor.scanNext(rids[0]);
+								count++;
+							}
+						}
+						catch(IndexScanCompletedException e)
+						{
+						}
+					}
+					else
+					{
+						for (size_t n; (n = cursor.scanNextBatch(rids, 100)) > 0; )
+							count += n;
+					}
+					cursor.endScan();
+					if (count != relationSize)
+						badScans++;
+				}
+			}));
+		}
+		for (size_t t = 0; t < threads.size(); t++)
+			threads[t].join();
+
+		checkPassFail(badScans.load(), 0)
+		checkPassFail(intScan(&index,relationSize - 10,GTE,relationSize + 10,LT), 20)
+		checkPassFail(intScan(&index,-100,GT,relationSize * 2,LT), relationSize + numWriters * insertsPerWriter)
+
+		// a cursor holds no latch between calls, its thread may insert into the leaf it is on and
+		// another thread may go on with it
+		IndexScanCursor cursor(&index);
+		int low = 0, high = 10, below = -1, count = 1;
+		RecordId rid;
+		cursor.startScan(&low, GTE, &high, LT);
+		cursor.scanNext(rid);
+		index.insertEntry(&below, zeroRid);
+		std::thread([&cursor, &count]() {
+			for (RecordId rid; cursor.scanNextBatch(&rid, 1) > 0; )
+				count++;
+			cursor.endScan();
+		}).join();
+		checkPassFail(count, 10)
+		checkPassFail(intScan(&index,-2,GT,0,LT), 1)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void test17()
+{
+	// Bulk load scattered keys into compressed leaves, insert keys far apart that widen their
+	// coding and delete them again. Compressed leaves should leave the index smaller.
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "compressed leaves for relationSize 20000" << std::endl;
+	long plainSize = compressedLeafTests(PLAIN_LEAVES, LATCH_COUPLING);
+	long compressedSize = compressedLeafTests(COMPRESSED_LEAVES, LATCH_COUPLING);
+	compressedLeafTests(COMPRESSED_LEAVES, BLINK);
+	checkPassFail((compressedSize * 3 < plainSize * 2), true)
+
+	// only INTEGER keys have a compressed coding
+	bool rejected = false;
+	try
+	{
+		BTreeIndex index(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, false, SplitPolicy(), COMPRESSED_LEAVES);
+	}
+	catch(BadIndexInfoException e)
+	{
+		rejected = true;
+	}
+	checkPassFail(rejected, true)
+}
+
+long compressedLeafTests(LeafFormat format, ConcurrencyMode mode)
+{
+	relationSize = 20000;
+	createRelationRandom();
+	const int numInserts = 10000, spacing = 10000;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, mode, false, SplitPolicy(), format);
+		checkPassFail(intScan(&index,-1,GT,relationSize,LT), relationSize)
+		checkPassFail(intBatchScan(&index,25,GT,5000,LTE), 4975)
+
+		std::vector<RecordId> rids;
+		int badLookups = 0;
+		for (int key = 0; key < relationSize; key += 97)
+		{
+			rids.clear();
+			if (index.lookupAll(&key, rids) != 1)
+				badLookups++;
+		}
+		checkPassFail(badLookups, 0)
+
+		// keys spread far apart, in scattered order, need many more bits than the bulk loaded ones
+		int zero = 0;
+		rids.clear();
+		index.lookupAll(&zero, rids);
+		RecordId rid = rids[0];
+		for (int i = 0; i < numInserts; i++)
+		{
+			int key = relationSize + (int)((long)i * 7919 % numInserts) * spacing;
+			index.insertEntry(&key, rid);
+		}
+		checkPassFail(intScan(&index,-1,GT,relationSize + numInserts * spacing,LT), relationSize + numInserts)
+		badLookups = 0;
+		for (int i = 0; i < numInserts; i++)
+		{
+			int key = relationSize + i * spacing;
+			rids.clear();
+			if (index.lookupAll(&key, rids) != 1)
+				badLookups++;
+		}
+		checkPassFail(badLookups, 0)
+		checkPassFail(intBatchScan(&index,relationSize - 100,GTE,relationSize,LT), 100)
+
+		// delete them again, and a range of the bulk loaded keys
+		for (int i = 0; i < numInserts; i++)
+		{
+			int key = relationSize + i * spacing;
+			index.deleteEntry(&key, rid);
+		}
+		int low = 1000, high = 2999, deleted = 1500;
+		checkPassFail(index.deleteRange(&low, GTE, &high, LTE), 2000)
+		checkPassFail(index.lookupAll(&deleted, rids), 0)
+		checkPassFail(intScan(&index,-1,GT,relationSize + numInserts * spacing,LT), relationSize - 2000)
+		checkPassFail(intBatchScan(&index,500,GTE,3500,LT), 1000)
+	}
+
+	std::ifstream indexFile(intIndexName.c_str(), std::ios::binary | std::ios::ate);
+	long indexSize = indexFile.tellg();
+	indexFile.close();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+	return indexSize;
+}
+
+void test18()
+{
+	// Grow an index past a root split, close and reopen it. The reopened index should start from
+	// the new root and report the statistics it was closed with, which deletes then keep up to date.
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "index statistics for relationSize 1000" << std::endl;
+	relationSize = 1000;
+	createRelationForward();
+	const int numInserts = 400000;
+	IndexStats closedStats;
+	RecordId rid;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		IndexStats stats = index.getStats();
+		checkPassFail(stats.height, 2)
+		checkPassFail(stats.numLeaves, 2)
+		checkPassFail(stats.numEntries, relationSize)
+		checkPassFail(readKey<int>(stats.minKey), 0)
+		checkPassFail(readKey<int>(stats.maxKey), relationSize - 1)
+
+		int low = 0;
+		index.startScan(&low, GTE, &low, LTE);
+		index.scanNext(rid);
+		index.endScan();
+		for (int key = relationSize; key < relationSize + numInserts; key++)
+			index.insertEntry(&key, rid);
+
+		closedStats = index.getStats();
+		checkPassFail(closedStats.height, 3)
+		checkPassFail((closedStats.numLeaves > INTARRAYNONLEAFSIZE + 1), true)
+		checkPassFail(closedStats.numEntries, relationSize + numInserts)
+		checkPassFail(readKey<int>(closedStats.maxKey), relationSize + numInserts - 1)
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		IndexStats stats = index.getStats();
+		checkPassFail(stats.height, closedStats.height)
+		checkPassFail(stats.numLeaves, closedStats.numLeaves)
+		checkPassFail(stats.numEntries, closedStats.numEntries)
+		checkPassFail(readKey<int>(stats.minKey), 0)
+		checkPassFail(readKey<int>(stats.maxKey), relationSize + numInserts - 1)
+
+		std::vector<RecordId> rids;
+		int badLookups = 0;
+		for (int key = 0; key < relationSize + numInserts; key += 101)
+		{
+			rids.clear();
+			if (index.lookupAll(&key, rids) != 1)
+				badLookups++;
+		}
+		checkPassFail(badLookups, 0)
+
+		// deleting the lowest and the highest keys moves the bounds, deleting most keys merges leaves away
+		int high = relationSize + numInserts - 1;
+		index.deleteEntry(&high, rid);
+		int deleteLow = 0, deleteHigh = relationSize + numInserts - 1000;
+		checkPassFail(index.deleteRange(&deleteLow, GTE, &deleteHigh, LT), relationSize + numInserts - 1000)
+		stats = index.getStats();
+		checkPassFail(stats.numEntries, 999)
+		checkPassFail(readKey<int>(stats.minKey), deleteHigh)
+		checkPassFail(readKey<int>(stats.maxKey), high - 1)
+		checkPassFail((stats.height < closedStats.height), true)
+		checkPassFail((stats.numLeaves < 5), true)
+		closedStats = stats;
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		IndexStats stats = index.getStats();
+		checkPassFail(stats.height, closedStats.height)
+		checkPassFail(stats.numLeaves, closedStats.numLeaves)
+		checkPassFail(stats.numEntries, 999)
+		checkPassFail(intScan(&index,-1,GT,relationSize + numInserts,LT), 999)
+	}
+
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void test19()
+{
+	// Scan ranges from the high bound down after inserts have split leaves and deletes have merged
+	// them, in each leaf format. The top entries of a range should come first, in descending order.
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "descending scans for relationSize 5000" << std::endl;
+	formatTests(false, false, descendingTests);
+}
+
+void descendingTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	checkPassFail(intDescendingScan(&index,-1,GT,relationSize,LT,false), relationSize)
+	checkPassFail(intDescendingScan(&index,25,GT,4000,LTE,true), 3975)
+	checkPassFail(intDescendingScan(&index,25,GTE,4000,LT,false), 3975)
+	checkPassFail(intDescendingScan(&index,4000,GTE,4000,LTE,true), 1)
+	checkPassFail(intDescendingScan(&index,4000,GT,4001,LT,false), 0)
+	checkPassFail(intDescendingScan(&index,relationSize,GTE,relationSize + 100,LT,true), 0)
+
+	// the top of a range, as for ORDER BY key DESC LIMIT 10
+	int low = 0, high = 3000, topKeys = 0;
+	RecordId rid;
+	Page *curPage;
+	index.startScan(&low, GTE, &high, LT, DESCENDING);
+	for (int k = 0; k < 10; k++)
+	{
+		index.scanNext(rid);
+		bufMgr->readPage(file1, rid.page_number, curPage);
+		RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rid).data()));
+		bufMgr->unPinPage(file1, rid.page_number, false);
+		if (myRec.i == high - 1 - k)
+			topKeys++;
+	}
+	index.endScan();
+	checkPassFail(topKeys, 10)
+
+	// a second entry for every key splits the leaves, deleting them and a range merges them again
+	std::vector<RecordId> rids;
+	for (int key = 0; key < relationSize; key++)
+	{
+		rids.clear();
+		index.lookupAll(&key, rids);
+		index.insertEntry(&key, rids[0]);
+	}
+	checkPassFail(intDescendingScan(&index,-1,GT,relationSize,LT,true), relationSize * 2)
+	checkPassFail(intDescendingScan(&index,25,GT,4000,LTE,false), 3975 * 2)
+	for (int key = 0; key < relationSize; key++)
+	{
+		rids.clear();
+		index.lookupAll(&key, rids);
+		index.deleteEntry(&key, rids[0]);
+	}
+	int deleteLow = 1000, deleteHigh = 2999;
+	checkPassFail(index.deleteRange(&deleteLow, GTE, &deleteHigh, LTE), 2000)
+	checkPassFail(intDescendingScan(&index,-1,GT,relationSize,LT,false), relationSize - 2000)
+	checkPassFail(intDescendingScan(&index,500,GTE,3500,LT,true), 1000)
+}
+
+void test20()
+{
+	// Page through ranges with a limit and an offset, in both orders and each leaf format. Every page
+	// should hold the same entries as the matching slice of a scan of the whole range.
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "paged scans for relationSize 5000" << std::endl;
+	formatTests(true, false, pagedScanTests);
+}
+
+void pagedScanTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	int low = duplicates ? 2 : 250, high = duplicates ? 8 : 4750;
+	std::vector<int> ascending = intScanKeys(&index, low, GT, high, LTE, ASCENDING, NO_SCAN_LIMIT, 0, true);
+	std::vector<int> descending = intScanKeys(&index, low, GT, high, LTE, DESCENDING, NO_SCAN_LIMIT, 0, true);
+	checkPassFail((int)ascending.size(), (duplicates ? 3000 : 4500))
+	checkPassFail((int)descending.size(), (int)ascending.size())
+
+	// pages of an uneven size, so that they start and end inside leaves and posting lists
+	const size_t pageSize = 97;
+	int badPages = 0, numPages = 0;
+	for (size_t offset = 0; offset <= ascending.size(); offset += pageSize, numPages++)
+	{
+		size_t end = std::min(offset + pageSize, ascending.size());
+		bool batch = numPages % 2 == 0;
+		if (intScanKeys(&index, low, GT, high, LTE, ASCENDING, pageSize, offset, batch)
+			!= std::vector<int>(ascending.begin() + offset, ascending.begin() + end))
+			badPages++;
+		if (intScanKeys(&index, low, GT, high, LTE, DESCENDING, pageSize, offset, !batch)
+			!= std::vector<int>(descending.begin() + offset, descending.begin() + end))
+			badPages++;
+	}
+	checkPassFail(badPages, 0)
+
+	// the record ids too, which tell apart the entries of one key when an offset lands inside a posting list
+	ScanOrder orders[] = {ASCENDING, DESCENDING};
+	int badRids = 0;
+	for (int o = 0; o < 2; o++)
+	{
+		std::vector<RecordId> all = intScanRids(&index, low, GT, high, LTE, orders[o], NO_SCAN_LIMIT, 0);
+		for (size_t offset = 1; offset < all.size(); offset += 331)
+		{
+			std::vector<RecordId> page = intScanRids(&index, low, GT, high, LTE, orders[o], 50, offset);
+			for (size_t i = 0; i < page.size(); i++)
+				badRids += page[i].page_number != all[offset + i].page_number || page[i].slot_number != all[offset + i].slot_number;
+			badRids += page.size() != std::min((size_t)50, all.size() - offset);
+		}
+	}
+	checkPassFail(badRids, 0)
+
+	// an offset past the end of the range, a limit of 0, and a limit over the whole range
+	checkPassFail(intScanKeys(&index, low, GT, high, LTE, ASCENDING, 10, ascending.size(), false).size(), 0)
+	checkPassFail(intScanKeys(&index, low, GT, high, LTE, DESCENDING, 10, ascending.size() + 500, true).size(), 0)
+	checkPassFail(intScanKeys(&index, low, GT, high, LTE, ASCENDING, 0, 0, true).size(), 0)
+	checkPassFail((intScanKeys(&index, low, GT, high, LTE, DESCENDING, ascending.size() + 1, 1, false)
+		== std::vector<int>(descending.begin() + 1, descending.end())), true)
+}
+
+void test21()
+{
+	// Count ranges and find entries by position from the entry counts of the non-leaf nodes, after
+	// a bulk load, inserts that split nodes, appends, a posting list and deletes that merge nodes
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "order statistics for relationSize 5000" << std::endl;
+	formatTests(false, true, orderStatisticTests);
+}
+
+void orderStatisticTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	int low = 25, high = 4000, all = relationSize;
+	checkPassFail(index.countRange(&low, GT, &high, LTE), 3975)
+	checkPassFail(index.countRange(&low, GTE, &high, LT), 3975)
+	checkPassFail(index.countRange(&high, GTE, &high, LTE), 1)
+	checkPassFail(index.countRange(&all, GTE, &all, LTE), 0)
+	checkPassFail(badSelects(&index, relationSize, 1), 0)
+
+	// a second entry for every key splits the leaves
+	std::vector<RecordId> rids;
+	for (int key = 0; key < relationSize; key++)
+	{
+		rids.clear();
+		index.lookupAll(&key, rids);
+		index.insertEntry(&key, rids[0]);
+	}
+	checkPassFail(index.countRange(&low, GT, &high, LTE), 3975 * 2)
+	checkPassFail(badSelects(&index, relationSize, 2), 0)
+
+	// increasing keys past the end, appended to the last leaf in append mode, and a run long enough for a posting list
+	int none = -1, last = relationSize + 20000;
+	for (int key = relationSize; key < last; key++)
+		index.insertEntry(&key, rids[0]);
+	for (int i = 0; i < 1000; i++)
+		index.insertEntry(&high, rids[0]);
+	checkPassFail(index.countRange(&none, GT, &last, LT), relationSize * 2 + 21000)
+	checkPassFail(index.countRange(&high, GTE, &high, LTE), 1002)
+	checkPassFail(index.countRange(&low, GT, &high, LT), 3974 * 2)
+	checkPassFail(index.countRange(&all, GTE, &last, LT), 20000)
+	int key;
+	RecordId rid;
+	index.selectKth(high * 2 + 500, &key, rid);
+	checkPassFail(key, high)
+	index.selectKth(relationSize * 2 + 21000 - 1, &key, rid);
+	checkPassFail(key, last - 1)
+	bool outOfRange = false;
+	try
+	{
+		index.selectKth(relationSize * 2 + 21000, &key, rid);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		outOfRange = true;
+	}
+	checkPassFail(outOfRange, true)
+
+	// deletes merge the leaves again
+	for (int i = 0; i < 1000; i++)
+		index.deleteEntry(&high, rids[0]);
+	for (int key = relationSize; key < last; key++)
+		index.deleteEntry(&key, rids[0]);
+	for (int key = 0; key < relationSize; key++)
+	{
+		rids.clear();
+		index.lookupAll(&key, rids);
+		index.deleteEntry(&key, rids[0]);
+	}
+	int deleteLow = 1000, deleteHigh = 2999;
+	checkPassFail(index.deleteRange(&deleteLow, GTE, &deleteHigh, LTE), 2000)
+	checkPassFail(index.countRange(&none, GT, &last, LT), relationSize - 2000)
+	checkPassFail(index.countRange(&low, GT, &high, LTE), 3975 - 2000)
+	index.selectKth(1000, &key, rid);
+	checkPassFail(key, 3000)
+	checkPassFail(index.countRange(&none, GT, &last, LT), index.getStats().numEntries)
+}
+
+// Selects every entry of an index holding perKey entries of each key from 0 to numKeys - 1 by its position
+int badSelects(BTreeIndex * index, int numKeys, int perKey)
+{
+	int bad = 0, key;
+	RecordId rid;
+	for (long long k = 0; k < (long long)numKeys * perKey; k++)
+	{
+		index->selectKth(k, &key, rid);
+		if (key != k / perKey)
+			bad++;
+	}
+	return bad;
+}
+
+void test22()
+{
+	// Insert micro-batches of unsorted keys that split leaves across the tree, one long batch past the
+	// end and a batch of a single key, and check them with scans, counts and lookups
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "batch inserts for relationSize 5000" << std::endl;
+	formatTests(false, false, batchInsertTests);
+}
+
+void batchInsertTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	int low = 25, high = 4000;
+	std::vector<RecordId> rids;
+	index.lookupAll(&low, rids);
+	RecordId rid = rids[0];
+
+	// a second entry for every key, shuffled and inserted in batches of uneven size
+	std::vector<int> keys(relationSize);
+	for (int i = 0; i < relationSize; i++)
+		keys[i] = i;
+	for (int i = relationSize - 1; i > 0; i--)
+		std::swap(keys[i], keys[random() % (i + 1)]);
+	insertKeys(&index, keys, rid, 777);
+	checkPassFail(index.countRange(&low, GT, &high, LTE), 3975 * 2)
+	checkPassFail((int)intScanKeys(&index, low, GT, high, LTE, ASCENDING, NO_SCAN_LIMIT, 0, true).size(), 3975 * 2)
+	checkPassFail(badSelects(&index, relationSize, 2), 0)
+
+	// increasing keys past the end in one batch, and a batch of a single key long enough for a posting list
+	int none = -1, last = relationSize + 10000;
+	keys.clear();
+	for (int key = relationSize; key < last; key++)
+		keys.push_back(key);
+	insertKeys(&index, keys, rid, keys.size());
+	insertKeys(&index, std::vector<int>(1000, high), rid, 1000);
+	checkPassFail(index.countRange(&none, GT, &last, LT), relationSize * 2 + 11000)
+	checkPassFail(index.countRange(&high, GTE, &high, LTE), 1002)
+	checkPassFail((int)intScanKeys(&index, relationSize, GTE, last, LT, DESCENDING, NO_SCAN_LIMIT, 0, false).size(), 10000)
+	rids.clear();
+	index.lookupAll(&high, rids);
+	checkPassFail((int)rids.size(), 1002)
+	rids.clear();
+	int key = last - 1;
+	index.lookupAll(&key, rids);
+	checkPassFail((int)rids.size(), 1)
+	checkPassFail(index.countRange(&none, GT, &last, LT), index.getStats().numEntries)
+}
+
+// Inserts the keys, all with the same rid, in batches of batchSize
+void insertKeys(BTreeIndex * index, const std::vector<int>& keys, const RecordId& rid, size_t batchSize)
+{
+	std::vector<KeyRid> batch;
+	for (size_t begin = 0; begin < keys.size(); begin += batchSize)
+	{
+		batch.clear();
+		for (size_t i = begin; i < std::min(begin + batchSize, keys.size()); i++)
+		{
+			KeyRid entry = {&keys[i], rid};
+			batch.push_back(entry);
+		}
+		index->insertBatch(batch.data(), batch.size());
+	}
+}
+
+void test23()
+{
+	// Scan an IN-list and ranges of several sizes in one pass, and check the result against a scan
+	// of each range on its own
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "multi-range scans for relationSize 5000" << std::endl;
+	formatTests(true, false, multiRangeScanTests);
+}
+
+void multiRangeScanTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	// an IN-list, with values close enough to share leaves and some past the end of the index
+	std::vector<int> values;
+	for (int key = 3; key < relationSize + 100; key += duplicates ? 3 : 13)
+		values.push_back(key);
+	std::vector<KeyRange> ranges;
+	std::vector<int> expected;
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		KeyRange range = {&values[i], GTE, &values[i], LTE};
+		ranges.push_back(range);
+		std::vector<int> keys = intScanKeys(&index, values[i], GTE, values[i], LTE, ASCENDING, NO_SCAN_LIMIT, 0, true);
+		expected.insert(expected.end(), keys.begin(), keys.end());
+	}
+	index.startScan(ranges.data(), ranges.size());
+	checkPassFail((scanKeys(&index, true) == expected), true)
+	index.startScan(ranges.data(), ranges.size());
+	checkPassFail((scanKeys(&index, false) == expected), true)
+	checkPassFail((int)expected.size(), (duplicates ? 1500 : 385))
+
+	// ranges that meet at a bound, an empty one and one over the end of the index
+	int bounds[] = {1, 200, 200, 230, 231, 231, 1000, 4000, 4990, 9000};
+	Operator lowOps[] = {GT, GT, GTE, GT, GTE};
+	Operator highOps[] = {LTE, LT, LT, LTE, LTE};
+	ranges.clear();
+	expected.clear();
+	for (int i = 0; i < 5; i++)
+	{
+		KeyRange range = {&bounds[2 * i], lowOps[i], &bounds[2 * i + 1], highOps[i]};
+		ranges.push_back(range);
+		std::vector<int> keys = intScanKeys(&index, bounds[2 * i], lowOps[i], bounds[2 * i + 1], highOps[i], ASCENDING, NO_SCAN_LIMIT, 0, false);
+		expected.insert(expected.end(), keys.begin(), keys.end());
+	}
+	index.startScan(ranges.data(), ranges.size());
+	checkPassFail((scanKeys(&index, true) == expected), true)
+	checkPassFail((int)expected.size(), (duplicates ? 4000 : 199 + 29 + 3000 + 10))
+
+	// ranges out of order, or overlapping at a bound both hold
+	std::swap(ranges[1], ranges[2]);
+	bool badRanges = false;
+	try
+	{
+		index.startScan(ranges.data(), ranges.size());
+	}
+	catch(BadScanrangeException e)
+	{
+		badRanges = true;
+	}
+	checkPassFail(badRanges, true)
+	KeyRange overlapping[] = {{&bounds[0], GT, &bounds[1], LTE}, {&bounds[2], GTE, &bounds[3], LTE}};
+	badRanges = false;
+	try
+	{
+		index.startScan(overlapping, 2);
+	}
+	catch(BadScanrangeException e)
+	{
+		badRanges = true;
+	}
+	checkPassFail(badRanges, true)
+}
+
+void test24()
+{
+	// Build the index with several threads, and one per hardware thread, and check it holds the same
+	// entries and has the same shape as one built by a single thread
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "parallel builds for relationSize 5000" << std::endl;
+	parallelBuildTests(PLAIN_LEAVES, false);
+	parallelBuildTests(COMPRESSED_LEAVES, false);
+	parallelBuildTests(POSTING_LIST_LEAVES, true);
+}
+
+void parallelBuildTests(LeafFormat format, bool duplicates)
+{
+	createIntRelation(duplicates);
+
+	std::vector<int> expected;
+	IndexStats expectedStats;
+	unsigned int buildThreads[] = {1, 3, 8, 0};
+	for (int i = 0; i < 4; i++)
+	{
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, false, SplitPolicy(), format, buildThreads[i]);
+			std::vector<int> keys = intScanKeys(&index, -1, GT, relationSize, LT, ASCENDING, NO_SCAN_LIMIT, 0, true);
+			IndexStats stats = index.getStats();
+			if (i == 0)
+			{
+				expected = keys;
+				expectedStats = stats;
+				checkPassFail((int)keys.size(), relationSize)
+				checkPassFail(std::is_sorted(keys.begin(), keys.end()), true)
+			}
+			else
+			{
+				checkPassFail((keys == expected), true)
+				checkPassFail((stats.numLeaves == expectedStats.numLeaves && stats.height == expectedStats.height), true)
+			}
+			int none = -1;
+			checkPassFail(index.countRange(&none, GT, &relationSize, LT), relationSize)
+		}
+		removeIndexes(std::vector<std::string>{intIndexName});
+	}
+
+	// a page freed in the middle of the relation is skipped by the thread whose run of page numbers holds it
+	PageId freedPageNum = 2;
+	int freedRecords = 0;
+	Page freedPage = file1->readPage(freedPageNum);
+	for (PageIterator iter = freedPage.begin(); iter != freedPage.end(); iter++)
+		freedRecords++;
+	file1->deletePage(freedPageNum);
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, false, SplitPolicy(), format, 4);
+		int none = -1;
+		checkPassFail((freedRecords > 0), true)
+		checkPassFail(index.countRange(&none, GT, &relationSize, LT), relationSize - freedRecords)
+	}
+	removeIndexes(std::vector<std::string>{intIndexName});
+	deleteRelation();
+}
+
+void test25()
+{
+	// Build the indexes on i, d and s from one read of the relation, open them again through the
+	// builder once they exist, and check that an index that cannot be built leaves none open
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "multi-index build for relationSize 5000" << std::endl;
+	relationSize = 5000;
+	createRelationRandom();
+
+	std::vector<std::string> names;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		MultiIndexBuilder builder(relationName, bufMgr);
+		builder.addIndex(offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, false, SplitPolicy(), COMPRESSED_LEAVES);
+		builder.addIndex(offsetof(tuple,d), DOUBLE);
+		builder.addIndex(offsetof(tuple,s), STRING, 0.7, BLINK);
+		std::vector<BTreeIndex*> indexes = builder.build(names);
+		checkPassFail((int)indexes.size(), 3)
+		checkPassFail((int)intScanKeys(indexes[0], -1, GT, relationSize, LT, ASCENDING, NO_SCAN_LIMIT, 0, true).size(), relationSize)
+		checkPassFail(doubleScan(indexes[1], 300, GT, 400, LT), 99)
+		checkPassFail(stringScan(indexes[2], 3000, GTE, 4000, LT), 1000)
+		for (int i = 0; i < 3; i++)
+		{
+			checkPassFail(indexes[i]->getStats().numEntries, relationSize)
+			delete indexes[i];
+		}
+	}
+	removeIndexes(names);
+
+	MultiIndexBuilder builder(relationName, bufMgr);
+	builder.addIndex(offsetof(tuple,i), INTEGER);
+	builder.addIndex(offsetof(tuple,d), DOUBLE, BULKLOAD_FILL_FACTOR, LATCH_COUPLING, false, SplitPolicy(), COMPRESSED_LEAVES);
+	bool badIndex = false;
+	try
+	{
+		builder.build(names);
+	}
+	catch(BadIndexInfoException e)
+	{
+		badIndex = true;
+	}
+	checkPassFail(badIndex, true)
+	removeIndexes(names);
+
+	// two indexes on one attribute would share their file, no index is opened
+	MultiIndexBuilder sameAttrBuilder(relationName, bufMgr);
+	sameAttrBuilder.addIndex(offsetof(tuple,i), INTEGER);
+	sameAttrBuilder.addIndex(offsetof(tuple,i), INTEGER, 0.7, BLINK);
+	badIndex = false;
+	try
+	{
+		sameAttrBuilder.build(names);
+	}
+	catch(BadIndexInfoException e)
+	{
+		badIndex = true;
+	}
+	checkPassFail(badIndex, true)
+	std::ifstream intIndexFile(intIndexName.c_str());
+	checkPassFail(intIndexFile.good(), false)
+	deleteRelation();
+}
+
+void removeIndexes(const std::vector<std::string>& names)
+{
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		try
+		{
+			File::remove(names[i]);
+		}
+		catch(FileNotFoundException e)
+		{
+		}
+	}
+}
+
+void test26()
+{
+	// Fetch the records of ranges of an index on a relation inserted in random order: a small range
+	// in key order, a large one a page at a time in file order
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "sorted record id fetches for relationSize 5000" << std::endl;
+	relationSize = 5000;
+	createRelationRandom();
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		IndexFetchScan fetchScan(relationName, bufMgr, &index);
+		int pageSwitches;
+
+		std::vector<int> keys = fetchScanKeys(fetchScan, 25, GT, 40, LTE, pageSwitches);
+		checkPassFail(fetchScan.pageOrder(), false)
+		checkPassFail((int)keys.size(), 15)
+		checkPassFail(std::is_sorted(keys.begin(), keys.end()), true)
+
+		// every page is read once, in file order
+		keys = fetchScanKeys(fetchScan, -1, GT, relationSize, LT, pageSwitches);
+		checkPassFail(fetchScan.pageOrder(), true)
+		checkPassFail((int)keys.size(), relationSize)
+		int numPages = 0;
+		for (FileIterator iter = file1->begin(); iter != file1->end(); iter++)
+			numPages++;
+		checkPassFail(pageSwitches, numPages)
+		std::sort(keys.begin(), keys.end());
+		int misplaced = 0;
+		for (int i = 0; i < relationSize; i++)
+			misplaced += keys[i] != i;
+		checkPassFail(misplaced, 0)
+
+		// a range as long as the threshold keeps the key order, one record id longer is sorted
+		IndexFetchScan edgeScan(relationName, bufMgr, &index, 15);
+		keys = fetchScanKeys(edgeScan, 25, GT, 40, LTE, pageSwitches);
+		checkPassFail(edgeScan.pageOrder(), false)
+		checkPassFail(std::is_sorted(keys.begin(), keys.end()), true)
+		keys = fetchScanKeys(edgeScan, 24, GT, 40, LTE, pageSwitches);
+		checkPassFail(edgeScan.pageOrder(), true)
+		checkPassFail((int)keys.size(), 16)
+
+		// a threshold of 0 sorts even a small range
+		IndexFetchScan sortedScan(relationName, bufMgr, &index, 0);
+		keys = fetchScanKeys(sortedScan, 25, GT, 40, LTE, pageSwitches);
+		checkPassFail(sortedScan.pageOrder(), true)
+		checkPassFail((int)keys.size(), 15)
+
+		bool notStarted = false;
+		try
+		{
+			RecordId rid;
+			sortedScan.scanNext(rid);
+		}
+		catch(ScanNotInitializedException e)
+		{
+			notStarted = true;
+		}
+		checkPassFail(notStarted, true)
+	}
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+// Reads the keys of the records of a range through the fetch scan, counting the reads of a page other than the one
+// of the record before. A fetch scan in page order never comes back to a page.
+std::vector<int> fetchScanKeys(IndexFetchScan& fetchScan, int lowVal, Operator lowOp, int highVal, Operator highOp, int& pageSwitches)
+{
+	std::vector<int> keys;
+	RecordId rid;
+	PageId lastPage = Page::INVALID_NUMBER;
+	pageSwitches = 0;
+	bool backwards = false;
+
+	fetchScan.startScan(&lowVal, lowOp, &highVal, highOp);
+	while (true)
+	{
+		try
+		{
+			fetchScan.scanNext(rid);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		RECORD myRec = *(reinterpret_cast<const RECORD*>(fetchScan.getRecord().data()));
+		keys.push_back(myRec.i);
+		if (rid.page_number != lastPage)
+		{
+			backwards = backwards || (lastPage != Page::INVALID_NUMBER && rid.page_number < lastPage);
+			lastPage = rid.page_number;
+			pageSwitches++;
+		}
+	}
+	fetchScan.endScan();
+	if (fetchScan.pageOrder() && backwards)
+		pageSwitches = -1;
+	return keys;
+}
+
+void test27()
+{
+	// Look up shuffled keys in groups, present and missing, and check every result against lookupAll(),
+	// then look up the keys of the relation while another thread inserts new ones
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "grouped lookups for relationSize 5000" << std::endl;
+	formatTests(true, false, multiLookupTests);
+
+	relationSize = 5000;
+	createRelationRandom();
+	{
+		BTreeIndex index(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		char strings[3][64];
+		sprintf(strings[0], "%05d string record", 4321);
+		sprintf(strings[1], "%05d string record", 7);
+		sprintf(strings[2], "%05d string record", relationSize + 1);
+		const void* keys[] = {strings[0], strings[1], strings[2]};
+		std::vector<RecordId> rids[3];
+		checkPassFail((int)index.multiLookup(keys, 3, rids), 2)
+		checkPassFail((rids[0].size() == 1 && rids[1].size() == 1 && rids[2].empty()), true)
+	}
+	try
+	{
+		File::remove(stringIndexName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	deleteRelation();
+}
+
+void multiLookupTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	int numKeys = duplicates ? 10 : relationSize;
+	// every key once in random order, with missing keys below, between and above them
+	std::vector<int> keys;
+	for (int key = -3; key < numKeys + 3; key++)
+		keys.push_back(key);
+	for (int i = keys.size() - 1; i > 0; i--)
+		std::swap(keys[i], keys[random() % (i + 1)]);
+	std::vector<const void*> keyPtrs;
+	for (size_t i = 0; i < keys.size(); i++)
+		keyPtrs.push_back(&keys[i]);
+	std::vector<std::vector<RecordId>> rids(keys.size());
+	checkPassFail((int)index.multiLookup(keyPtrs.data(), keys.size(), rids.data()), relationSize)
+	int mismatches = 0;
+	std::vector<RecordId> expected;
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		expected.clear();
+		index.lookupAll(&keys[i], expected);
+		mismatches += expected.size() != rids[i].size()
+			|| !std::equal(expected.begin(), expected.end(), rids[i].begin(),
+				[](const RecordId& a, const RecordId& b) { return a.page_number == b.page_number && a.slot_number == b.slot_number; });
+	}
+	checkPassFail(mismatches, 0)
+
+	// fewer keys than a group, and none
+	size_t found = rids[0].size() + rids[1].size() + rids[2].size();
+	checkPassFail(index.multiLookup(keyPtrs.data(), 3, rids.data()), found)
+	checkPassFail((int)index.multiLookup(keyPtrs.data(), 0, rids.data()), 0)
+
+	// the keys of the relation keep being found while second entries for them split the leaves they are in
+	if (!duplicates)
+	{
+		int low = 25;
+		std::vector<RecordId> lowRids;
+		index.lookupAll(&low, lowRids);
+		RecordId rid = lowRids[0];
+		std::vector<int> newKeys(keys);
+		std::thread inserter([&index, &newKeys, &rid]() {
+			for (size_t i = 0; i < newKeys.size(); i++)
+				if (newKeys[i] >= 0 && newKeys[i] < relationSize)
+					index.insertEntry(&newKeys[i], rid);
+		});
+		int notFound = 0;
+		for (int round = 0; round < 20; round++)
+		{
+			for (size_t i = 0; i < keys.size(); i++)
+				rids[i].clear();
+			index.multiLookup(keyPtrs.data(), keys.size(), rids.data());
+			for (size_t i = 0; i < keys.size(); i++)
+				notFound += (keys[i] >= 0 && keys[i] < relationSize) ? (rids[i].empty() || rids[i].size() > 2) : !rids[i].empty();
+		}
+		inserter.join();
+		checkPassFail(notFound, 0)
+	}
+}
+
+void test28()
+{
+	// Export indexes to snapshots and check that scans of the snapshots return what scans of the indexes do,
+	// that the snapshot is smaller than the index, and that the file given to the reader must be a snapshot
+	std::cout << "--------------------------------------------------" << std::endl;
+	std::cout << "read-only snapshots for relationSize 5000" << std::endl;
+	formatTests(true, false, snapshotTests);
+
+	std::string snapshotName = relationName + ".snapshot";
+	relationSize = 5000;
+	createRelationRandom();
+	{
+		BTreeIndex doubleIndex(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE);
+		doubleIndex.exportSnapshot(snapshotName);
+		StaticIndex doubleSnapshot(snapshotName);
+		checkPassFail(doubleSnapshot.getAttributeType(), DOUBLE)
+		double low = 300, high = 400;
+		checkPassFail(snapshotScanCount(doubleSnapshot, &low, GT, &high, LT), 99)
+	}
+	{
+		BTreeIndex stringIndex(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		stringIndex.exportSnapshot(snapshotName);
+		StaticIndex stringSnapshot(snapshotName);
+		char low[64], high[64];
+		sprintf(low, "%05d string record", 3000);
+		sprintf(high, "%05d string record", 4000);
+		checkPassFail(snapshotScanCount(stringSnapshot, low, GTE, high, LT), 1000)
+	}
+
+	bool notSnapshot = false;
+	try
+	{
+		StaticIndex relationSnapshot(relationName);
+	}
+	catch(BadIndexInfoException e)
+	{
+		notSnapshot = true;
+	}
+	checkPassFail(notSnapshot, true)
+	std::remove(snapshotName.c_str());
+	bool notFound = false;
+	try
+	{
+		StaticIndex missingSnapshot(snapshotName);
+	}
+	catch(FileNotFoundException e)
+	{
+		notFound = true;
+	}
+	checkPassFail(notFound, true)
+	removeIndexes(std::vector<std::string>{doubleIndexName, stringIndexName});
+	deleteRelation();
+}
+
+void snapshotTests(BTreeIndex& index, LeafFormat format, bool duplicates)
+{
+	int numKeys = duplicates ? 10 : relationSize;
+	std::string snapshotName = relationName + ".snapshot";
+	{
+		index.exportSnapshot(snapshotName);
+		StaticIndex snapshot(snapshotName);
+		checkPassFail(snapshot.getNumEntries(), (uint64_t)relationSize)
+
+		// ranges with every pair of operators, bounds below, inside and above the keys, and empty ranges
+		Operator lowOps[] = {GT, GTE}, highOps[] = {LT, LTE};
+		int mismatches = 0;
+		for (int i = 0; i < 200; i++)
+		{
+			int low = random() % (numKeys + 10) - 5, high = low + random() % (numKeys / 4 + 2);
+			Operator lowOp = lowOps[i % 2], highOp = highOps[i / 2 % 2];
+			mismatches += snapshotScanKeys(snapshot, low, lowOp, high, highOp)
+				!= intScanKeys(&index, low, lowOp, high, highOp, ASCENDING, NO_SCAN_LIMIT, 0, true);
+		}
+		checkPassFail(mismatches, 0)
+		std::vector<int> keys = snapshotScanKeys(snapshot, -1, GT, numKeys, LT);
+		checkPassFail((int)keys.size(), relationSize)
+		checkPassFail(std::is_sorted(keys.begin(), keys.end()), true)
+
+		// a scan is started again without being ended, and is not used once ended
+		int low = 25, high = 40;
+		snapshot.startScan(&low, GT, &high, LTE);
+		int expected = duplicates ? 0 : 15;
+		checkPassFail((int)snapshotScanKeys(snapshot, low, GT, high, LTE).size(), expected)
+		bool badRange = false, notStarted = false;
+		try
+		{
+			snapshot.startScan(&high, GT, &low, LTE);
+		}
+		catch(BadScanrangeException e)
+		{
+			badRange = true;
+		}
+		try
+		{
+			RecordId rid;
+			snapshot.scanNext(rid);
+		}
+		catch(ScanNotInitializedException e)
+		{
+			notStarted = true;
+		}
+		checkPassFail((badRange && notStarted), true)
+
+		// the snapshot keeps no page headers, sibling links, free slots or padding
+		std::ifstream snapshotFile(snapshotName.c_str(), std::ios::binary | std::ios::ate);
+		std::streamoff snapshotBytes = snapshotFile.tellg();
+		std::streamoff leafBytes = (std::streamoff)index.getStats().numLeaves * (std::streamoff)Page::SIZE;
+		if (format == PLAIN_LEAVES)
+			checkPassFail((snapshotBytes < leafBytes), true)
+	}
+	std::remove(snapshotName.c_str());
+}
+
+// Reads the keys of the records of a range of the snapshot and ends the scan
+std::vector<int> snapshotScanKeys(StaticIndex& snapshot, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	std::vector<int> keys;
+	RecordId rid;
+	Page *curPage;
+
+	snapshot.startScan(&lowVal, lowOp, &highVal, highOp);
+	while (true)
+	{
+		try
+		{
+			snapshot.scanNext(rid);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		bufMgr->readPage(file1, rid.page_number, curPage);
+		RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rid).data()));
+		bufMgr->unPinPage(file1, rid.page_number, false);
+		keys.push_back(myRec.i);
+	}
+	snapshot.endScan();
+	return keys;
+}
+
+// Counts the entries of a range of the snapshot and ends the scan
+int snapshotScanCount(StaticIndex& snapshot, const void* lowVal, Operator lowOp, const void* highVal, Operator highOp)
+{
+	int count = 0;
+	RecordId rid;
+
+	snapshot.startScan(lowVal, lowOp, highVal, highOp);
+	while (true)
+	{
+		try
+		{
+			snapshot.scanNext(rid);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		count++;
+	}
+	snapshot.endScan();
+	return count;
+}
+
+// -----------------------------------------------------------------------------
+// createRelationForward
+// -----------------------------------------------------------------------------
+
+void createRelationForward()
+{
+	std::vector<RecordId> ridVec;
+  // destroy any old copies of relation file
+	try
+	{
+		File::remove(relationName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+
+  file1 = new PageFile(relationName, true);
+
+  // initialize all of record1.s to keep purify happy
+  memset(record1.s, ' ', sizeof(record1.s));
+	PageId new_page_number;
+  Page new_page = file1->allocatePage(new_page_number);
+
+  // Insert a bunch of tuples into the relation.
+  for(int i = 0; i < relationSize; i++ )
+	{
+    sprintf(record1.s, "%05d string record", i);
+    record1.i = i;
+    record1.d = (double)i;
+    std::string new_data(reinterpret_cast<char*>(&record1), sizeof(record1));
+
+		while(1)
+		{
+			try
+			{
+    		new_page.insertRecord(new_data);
+				break;
+			}
+			catch(InsufficientSpaceException e)
+			{
+				file1->writePage(new_page_number, new_page);
+  			new_page = file1->allocatePage(new_page_number);
+			}
+		}
+  }
+
+	file1->writePage(new_page_number, new_page);
+}
+
 // -----------------------------------------------------------------------------
-// createRelationForward
+// createRelationDuplicates
 // -----------------------------------------------------------------------------
 
-void createRelationForward()
+void createRelationDuplicates(int numKeys)
 {
-	std::vector<RecordId> ridVec;
   // destroy any old copies of relation file
 	try
 	{
@@ -245,12 +2010,12 @@ void createRelationForward()
 	PageId new_page_number;
   Page new_page = file1->allocatePage(new_page_number);
 
-  // Insert a bunch of tuples into the relation.
+  // Insert a bunch of tuples into the relation, cycling through numKeys keys.
   for(int i = 0; i < relationSize; i++ )
 	{
-    sprintf(record1.s, "%05d string record", i);
-    record1.i = i;
-    record1.d = (double)i;
+    sprintf(record1.s, "%05d string record", i % numKeys);
+    record1.i = i % numKeys;
+    record1.d = (double)(i % numKeys);
     std::string new_data(reinterpret_cast<char*>(&record1), sizeof(record1));
 
 		while(1)
@@ -384,6 +2149,20 @@ void createRelationRandom()
 	file1->writePage(new_page_number, new_page);
 }
 
+// -----------------------------------------------------------------------------
+// createIntRelation
+// -----------------------------------------------------------------------------
+
+// Creates a relation of 5000 tuples in random order, or with 500 tuples for each key from 0 to 9
+void createIntRelation(bool duplicates)
+{
+	relationSize = 5000;
+	if (duplicates)
+		createRelationDuplicates(10);
+	else
+		createRelationRandom();
+}
+
 // -----------------------------------------------------------------------------
 // indexTests
 // -----------------------------------------------------------------------------
@@ -400,9 +2179,66 @@ void indexTests()
   	catch(FileNotFoundException e)
   	{
   	}
+
+    doubleTests();
+		try
+		{
+			File::remove(doubleIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    stringTests();
+		try
+		{
+			File::remove(stringIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
   }
 }
 
+// -----------------------------------------------------------------------------
+// formatTests
+// -----------------------------------------------------------------------------
+
+// The leaf formats and concurrency modes the tests of the index features run against
+struct FormatCase
+{
+	LeafFormat format;
+	ConcurrencyMode mode;
+};
+
+const FormatCase formatCases[] = {
+	{PLAIN_LEAVES, LATCH_COUPLING},
+	{PLAIN_LEAVES, BLINK},
+	{COMPRESSED_LEAVES, BLINK},
+	{POSTING_LIST_LEAVES, LATCH_COUPLING}
+};
+
+// Runs checks against an INTEGER index on a new relation from createIntRelation() in each case of formatCases, then
+// removes both. Only the posting list index gets the relation with duplicates, and only the indexes latch coupling
+// are in append mode.
+void formatTests(bool duplicates, bool appendMode, const std::function<void(BTreeIndex&, LeafFormat, bool)>& checks)
+{
+	for (size_t i = 0; i < sizeof(formatCases) / sizeof(formatCases[0]); i++)
+	{
+		LeafFormat format = formatCases[i].format;
+		ConcurrencyMode mode = formatCases[i].mode;
+		bool caseDuplicates = duplicates && format == POSTING_LIST_LEAVES;
+		createIntRelation(caseDuplicates);
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, BULKLOAD_FILL_FACTOR, mode,
+			                 appendMode && mode == LATCH_COUPLING, SplitPolicy(), format);
+			checks(index, format, caseDuplicates);
+		}
+		removeIndexes(std::vector<std::string>{intIndexName});
+		deleteRelation();
+	}
+}
+
 // -----------------------------------------------------------------------------
 // intTests
 // -----------------------------------------------------------------------------
@@ -425,12 +2261,147 @@ void intTests()
     checkPassFail(intScan(&index,3000000,GT,4000000,LT), 0)
 	checkPassFail(intScan(&index,-200,GT,-100,LT), 0)
 	checkPassFail(intScan(&index,-100,GT,4000000,LT), relationSize)
+
+	/* batch scans */
+	checkPassFail(intBatchScan(&index,25,GT,40,LT), 14)
+	checkPassFail(intBatchScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(intBatchScan(&index,0,GT,1,LT), 0)
+	checkPassFail(intBatchScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(intBatchScan(&index,-100,GT,4000000,LT), relationSize)
+}
+
+int intBatchScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	RecordId rids[100];
+	Page *curPage;
+	int numResults = 0, prevKey = lowVal;
+	size_t numRids;
+
+	index->startScan(&lowVal, lowOp, &highVal, highOp);
+	while ((numRids = index->scanNextBatch(rids, 100)) > 0)
+	{
+		// the keys must come back in order and inside the range
+		for (size_t i = 0; i < numRids; i++)
+		{
+			bufMgr->readPage(file1, rids[i].page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+			bufMgr->unPinPage(file1, rids[i].page_number, false);
+			if (myRec.i < prevKey || (lowOp == GT && myRec.i == lowVal) || myRec.i > highVal || (highOp == LT && myRec.i == highVal))
+				return -1;
+			prevKey = myRec.i;
+		}
+		numResults += numRids;
+	}
+	checkPassFail(index->scanNextBatch(rids, 100), 0)
+	index->endScan();
+
+	return numResults;
+}
+
+int intDescendingScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp, bool batch)
+{
+	RecordId rids[100];
+	Page *curPage;
+	int numResults = 0, prevKey = highVal;
+	size_t numRids = 1;
+
+	index->startScan(&lowVal, lowOp, &highVal, highOp, DESCENDING);
+	while (numRids > 0)
+	{
+		if (batch)
+			numRids = index->scanNextBatch(rids, 100);
+		else
+		{
+			try
+			{
+				index->scanNext(rids[0]);
+			}
+			catch(IndexScanCompletedException e)
+			{
+				numRids = 0;
+			}
+		}
+
+		// the keys must come back in descending order and inside the range
+		for (size_t i = 0; i < numRids; i++)
+		{
+			bufMgr->readPage(file1, rids[i].page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+			bufMgr->unPinPage(file1, rids[i].page_number, false);
+			if (myRec.i > prevKey || (highOp == LT && myRec.i == highVal) || myRec.i < lowVal || (lowOp == GT && myRec.i == lowVal))
+				return -1;
+			prevKey = myRec.i;
+		}
+		numResults += numRids;
+	}
+	index->endScan();
+
+	return numResults;
+}
+
+std::vector<int> intScanKeys(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp, ScanOrder order, size_t limit, size_t offset, bool batch)
+{
+	index->startScan(&lowVal, lowOp, &highVal, highOp, order, limit, offset);
+	return scanKeys(index, batch);
+}
+
+// Reads the record ids of a range of the index
+std::vector<RecordId> intScanRids(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp, ScanOrder order, size_t limit, size_t offset)
+{
+	std::vector<RecordId> rids(64);
+	size_t numRids = 0, read;
+	index->startScan(&lowVal, lowOp, &highVal, highOp, order, limit, offset);
+	while ((read = index->scanNextBatch(rids.data() + numRids, 64)) > 0)
+	{
+		numRids += read;
+		rids.resize(numRids + 64);
+	}
+	index->endScan();
+	rids.resize(numRids);
+	return rids;
+}
+
+// Reads the keys of the scan started on the index to its end and ends it
+std::vector<int> scanKeys(BTreeIndex * index, bool batch)
+{
+	RecordId rids[64];
+	Page *curPage;
+	std::vector<int> keys;
+	size_t numRids = 1;
+
+	while (numRids > 0)
+	{
+		if (batch)
+			numRids = index->scanNextBatch(rids, 64);
+		else
+		{
+			try
+			{
+				index->scanNext(rids[0]);
+			}
+			catch(IndexScanCompletedException e)
+			{
+				numRids = 0;
+			}
+		}
+
+		for (size_t i = 0; i < numRids; i++)
+		{
+			bufMgr->readPage(file1, rids[i].page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+			bufMgr->unPinPage(file1, rids[i].page_number, false);
+			keys.push_back(myRec.i);
+		}
+	}
+	index->endScan();
+
+	return keys;
 }
 
 int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
 {
   RecordId scanRid;
-	Page *curPage;
+  IndexFetchScan fetchScan(relationName, bufMgr, index);
 
   std::cout << "Scan for ";
   if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
@@ -440,6 +2411,86 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 
   int numResults = 0;
 	
+	try
+	{
+  	fetchScan.startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	while(1)
+	{
+		try
+		{
+			fetchScan.scanNext(scanRid);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(fetchScan.getRecord().data()));
+
+			if( numResults < 5 )
+			{
+				std::cout << "at:" << scanRid.page_number << "," << scanRid.slot_number;
+				std::cout << " -->:" << myRec.i << ":" << myRec.d << ":" << myRec.s << ":" <<std::endl;
+			}
+			else if( numResults == 5 )
+			{
+				std::cout << "..." << std::endl;
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+
+		numResults++;
+	}
+
+  if( numResults >= 5 )
+  {
+    std::cout << "Number of results: " << numResults << std::endl;
+  }
+  fetchScan.endScan();
+  std::cout << std::endl;
+
+	return numResults;
+}
+
+
+// -----------------------------------------------------------------------------
+// doubleTests
+// -----------------------------------------------------------------------------
+
+void doubleTests()
+{
+  std::cout << "Create a B+ Tree index on the double field" << std::endl;
+  BTreeIndex index(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE);
+
+	// run some tests
+	checkPassFail(doubleScan(&index,25,GT,40,LT), 14)
+	checkPassFail(doubleScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(doubleScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(doubleScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(doubleScan(&index,0,GT,1,LT), 0)
+	checkPassFail(doubleScan(&index,300,GT,400,LT), 99)
+	checkPassFail(doubleScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(doubleScan(&index,24.5,GT,25.5,LT), 1)
+	checkPassFail(doubleScan(&index,-100,GT,4000000,LT), relationSize)
+}
+
+int doubleScan(BTreeIndex * index, double lowVal, Operator lowOp, double highVal, Operator highOp)
+{
+  RecordId scanRid;
+	Page *curPage;
+
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+  int numResults = 0;
+
 	try
 	{
   	index->startScan(&lowVal, lowOp, &highVal, highOp);
@@ -461,7 +2512,7 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 
 			if( numResults < 5 )
 			{
-				std::cout << "at:" << scanRid.page_number << "," << scanRid.slot_number;
+				std::cout << "rid:" << scanRid.page_number << "," << scanRid.slot_number;
 				std::cout << " -->:" << myRec.i << ":" << myRec.d << ":" << myRec.s << ":" <<std::endl;
 			}
 			else if( numResults == 5 )
@@ -487,6 +2538,89 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 	return numResults;
 }
 
+// -----------------------------------------------------------------------------
+// stringTests
+// -----------------------------------------------------------------------------
+
+void stringTests()
+{
+  std::cout << "Create a B+ Tree index on the string field" << std::endl;
+  BTreeIndex index(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+
+	// run some tests
+	checkPassFail(stringScan(&index,10,GT,20,LT), 9)
+	checkPassFail(stringScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(stringScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(stringScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(stringScan(&index,0,GT,1,LT), 0)
+	checkPassFail(stringScan(&index,300,GT,400,LT), 99)
+	checkPassFail(stringScan(&index,3000,GTE,4000,LT), 1000)
+}
+
+int stringScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+  RecordId scanRid;
+	Page *curPage;
+
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+  char lowValStr[100];
+  sprintf(lowValStr,"%05d string record",lowVal);
+  char highValStr[100];
+  sprintf(highValStr,"%05d string record",highVal);
+
+  int numResults = 0;
+
+	try
+	{
+  	index->startScan(lowValStr, lowOp, highValStr, highOp);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	while(1)
+	{
+		try
+		{
+			index->scanNext(scanRid);
+			bufMgr->readPage(file1, scanRid.page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			bufMgr->unPinPage(file1, scanRid.page_number, false);
+
+			if( numResults < 5 )
+			{
+				std::cout << "rid:" << scanRid.page_number << "," << scanRid.slot_number;
+				std::cout << " -->:" << myRec.i << ":" << myRec.d << ":" << myRec.s << ":" <<std::endl;
+			}
+			else if( numResults == 5 )
+			{
+				std::cout << "..." << std::endl;
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+
+		numResults++;
+	}
+
+  if( numResults >= 5 )
+  {
+    std::cout << "Number of results: " << numResults << std::endl;
+  }
+  index->endScan();
+  std::cout << std::endl;
+
+	return numResults;
+}
 
 // -----------------------------------------------------------------------------
 // errorTests
@@ -0,0 +1,179 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define BADGERDB_NODE_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+namespace badgerdb
+{
+
+/**
+ * @brief Key search inside a B+Tree node.
+ * nodeLowerBound() and nodeUpperBound() return the position of the first key in the sorted array
+ * keys[0, n) that is not below, respectively above, the key, like std::lower_bound and std::upper_bound.
+ * For INTEGER and DOUBLE keys a binary search narrows the range down to NODE_SEARCH_BLOCK keys, which
+ * are then counted with vector compares and a movemask/popcount. The AVX2 kernels are compiled in
+ * directly when the build targets AVX2 and picked at run time otherwise, SSE2 is the x86 baseline and
+ * other targets use scalar code.
+ */
+    const int NODE_SEARCH_BLOCK = 64;
+
+    namespace nodesearch
+    {
+        /* Number of keys in keys[0, n) below the key, or not above it if orEqual */
+        inline int countScalar( const int* keys, int n, int key, bool orEqual )
+        {
+            int count = 0;
+            for( int i = 0; i < n; i++ )
+                count += orEqual ? keys[ i ] <= key : keys[ i ] < key;
+            return count;
+        }
+
+        inline int countScalar( const double* keys, int n, double key, bool orEqual )
+        {
+            int count = 0;
+            for( int i = 0; i < n; i++ )
+                count += orEqual ? keys[ i ] <= key : keys[ i ] < key;
+            return count;
+        }
+
+#ifdef BADGERDB_NODE_SEARCH_X86
+        inline int countSse2( const int* keys, int n, int key, bool orEqual )
+        {
+            const __m128i k = _mm_set1_epi32( key );
+            int count = 0, i = 0;
+            for( ; i + 4 <= n; i += 4 )
+            {
+                __m128i v = _mm_loadu_si128( (const __m128i*)( keys + i ) );
+                /* keys <= key are the lanes not above it */
+                int mask = orEqual ? ~_mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( v, k ) ) ) & 0xF
+                                   : _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( k, v ) ) );
+                count += __builtin_popcount( mask );
+            }
+            return count + countScalar( keys + i, n - i, key, orEqual );
+        }
+
+        inline int countSse2( const double* keys, int n, double key, bool orEqual )
+        {
+            const __m128d k = _mm_set1_pd( key );
+            int count = 0, i = 0;
+            for( ; i + 2 <= n; i += 2 )
+            {
+                __m128d v = _mm_loadu_pd( keys + i );
+                int mask = _mm_movemask_pd( orEqual ? _mm_cmple_pd( v, k ) : _mm_cmplt_pd( v, k ) );
+                count += __builtin_popcount( mask );
+            }
+            return count + countScalar( keys + i, n - i, key, orEqual );
+        }
+
+        __attribute__(( target( "avx2" ) ))
+        inline int countAvx2( const int* keys, int n, int key, bool orEqual )
+        {
+            const __m256i k = _mm256_set1_epi32( key );
+            int count = 0, i = 0;
+            for( ; i + 8 <= n; i += 8 )
+            {
+                __m256i v = _mm256_loadu_si256( (const __m256i*)( keys + i ) );
+                int mask = orEqual ? ~_mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpgt_epi32( v, k ) ) ) & 0xFF
+                                   : _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpgt_epi32( k, v ) ) );
+                count += __builtin_popcount( mask );
+            }
+            return count + countScalar( keys + i, n - i, key, orEqual );
+        }
+
+        __attribute__(( target( "avx2" ) ))
+        inline int countAvx2( const double* keys, int n, double key, bool orEqual )
+        {
+            const __m256d k = _mm256_set1_pd( key );
+            int count = 0, i = 0;
+            for( ; i + 4 <= n; i += 4 )
+            {
+                __m256d v = _mm256_loadu_pd( keys + i );
+                int mask = _mm256_movemask_pd( orEqual ? _mm256_cmp_pd( v, k, _CMP_LE_OQ ) : _mm256_cmp_pd( v, k, _CMP_LT_OQ ) );
+                count += __builtin_popcount( mask );
+            }
+            return count + countScalar( keys + i, n - i, key, orEqual );
+        }
+
+        inline bool haveAvx2()
+        {
+#ifdef __AVX2__
+            return true;
+#else
+            static const bool avx2 = __builtin_cpu_supports( "avx2" );
+            return avx2;
+#endif
+        }
+#endif
+
+        /* Narrows keys[0, n) down to a block by binary search, then counts the block with the best kernel */
+        template <class T>
+        inline int search( const T* keys, int n, T key, bool orEqual )
+        {
+            int low = 0, high = n;
+            while( high - low > NODE_SEARCH_BLOCK )
+            {
+                int mid = ( low + high ) / 2;
+                if( orEqual ? keys[ mid ] <= key : keys[ mid ] < key )
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+
+#ifdef BADGERDB_NODE_SEARCH_X86
+            if( haveAvx2() )
+                return low + countAvx2( keys + low, high - low, key, orEqual );
+            return low + countSse2( keys + low, high - low, key, orEqual );
+#else
+            return low + countScalar( keys + low, high - low, key, orEqual );
+#endif
+        }
+    }
+
+    template <class T>
+    inline int nodeLowerBound( const T* keys, int n, const T& key )
+    {
+        return std::lower_bound( keys, keys + n, key ) - keys;
+    }
+
+    template <class T>
+    inline int nodeUpperBound( const T* keys, int n, const T& key )
+    {
+        return std::upper_bound( keys, keys + n, key ) - keys;
+    }
+
+    template <>
+    inline int nodeLowerBound<int>( const int* keys, int n, const int& key )
+    {
+        return nodesearch::search( keys, n, key, false );
+    }
+
+    template <>
+    inline int nodeUpperBound<int>( const int* keys, int n, const int& key )
+    {
+        return nodesearch::search( keys, n, key, true );
+    }
+
+    template <>
+    inline int nodeLowerBound<double>( const double* keys, int n, const double& key )
+    {
+        return nodesearch::search( keys, n, key, false );
+    }
+
+    template <>
+    inline int nodeUpperBound<double>( const double* keys, int n, const double& key )
+    {
+        return nodesearch::search( keys, n, key, true );
+    }
+
+}
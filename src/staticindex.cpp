@@ -0,0 +1,241 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "staticindex.h"
+#include "node_search.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/bad_opcodes_exception.h"
+#include "exceptions/bad_scanrange_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+
+namespace badgerdb {
+
+static const char STATIC_MAGIC[8] = {'B', 'D', 'B', 'S', 'N', 'A', 'P', '1'};
+
+static uint64_t alignSection(uint64_t offset)
+{
+  return (offset + 63) / 64 * 64;
+}
+
+// Places the separators from the k-th position of the Eytzinger order on, in order of their keys
+template <class T>
+static void layOutSeparators(const std::vector<T>& keys, int blockKeys, std::vector<T>& separators,
+                             std::vector<uint32_t>& ranks, uint64_t& next, uint64_t k)
+{
+  if (k > separators.size())
+    return;
+  layOutSeparators(keys, blockKeys, separators, ranks, next, 2 * k);
+  separators[k - 1] = keys[(next + 1) * blockKeys];
+  ranks[k - 1] = next++;
+  layOutSeparators(keys, blockKeys, separators, ranks, next, 2 * k + 1);
+}
+
+template <class T>
+void StaticIndex::writeSnapshot(const std::string &snapshotName, Datatype attributeType, int attrByteOffset,
+                                const std::vector<T>& keys, const std::vector<RecordId>& rids)
+{
+  StaticIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, STATIC_MAGIC, sizeof(STATIC_MAGIC));
+  header.attributeType = attributeType;
+  header.attrByteOffset = attrByteOffset;
+  header.keySize = sizeof(T);
+  header.blockKeys = std::max(1, STATIC_BLOCK_BYTES / (int)sizeof(T));
+  header.numEntries = keys.size();
+  uint64_t numBlocks = (keys.size() + header.blockKeys - 1) / header.blockKeys;
+  header.numSeparators = numBlocks > 0 ? numBlocks - 1 : 0;
+
+  std::vector<T> separators(header.numSeparators);
+  std::vector<uint32_t> ranks(header.numSeparators);
+  uint64_t next = 0;
+  layOutSeparators(keys, header.blockKeys, separators, ranks, next, 1);
+
+  header.keysOffset = alignSection(sizeof(header));
+  header.pageNumsOffset = alignSection(header.keysOffset + keys.size() * sizeof(T));
+  header.slotsOffset = alignSection(header.pageNumsOffset + keys.size() * sizeof(PageId));
+  header.separatorsOffset = alignSection(header.slotsOffset + keys.size() * sizeof(SlotId));
+  header.ranksOffset = alignSection(header.separatorsOffset + separators.size() * sizeof(T));
+  header.fileSize = header.ranksOffset + ranks.size() * sizeof(uint32_t);
+
+  std::vector<PageId> pageNums(rids.size());
+  std::vector<SlotId> slots(rids.size());
+  for (size_t i = 0; i < rids.size(); i++)
+  {
+    pageNums[i] = rids[i].page_number;
+    slots[i] = rids[i].slot_number;
+  }
+
+  std::ofstream out(snapshotName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  const char zeros[64] = {0};
+  uint64_t written = 0;
+  auto section = [&out, &zeros, &written](uint64_t offset, const void* bytes, uint64_t size) {
+    out.write(zeros, offset - written);
+    out.write((const char*)bytes, size);
+    written = offset + size;
+  };
+  section(0, &header, sizeof(header));
+  section(header.keysOffset, keys.data(), keys.size() * sizeof(T));
+  section(header.pageNumsOffset, pageNums.data(), pageNums.size() * sizeof(PageId));
+  section(header.slotsOffset, slots.data(), slots.size() * sizeof(SlotId));
+  section(header.separatorsOffset, separators.data(), separators.size() * sizeof(T));
+  section(header.ranksOffset, ranks.data(), ranks.size() * sizeof(uint32_t));
+  out.close();
+  if (!out)
+    throw BadIndexInfoException("ERROR SNAPSHOT NOT WRITTEN");
+}
+
+template void StaticIndex::writeSnapshot<int>(const std::string&, Datatype, int, const std::vector<int>&, const std::vector<RecordId>&);
+template void StaticIndex::writeSnapshot<double>(const std::string&, Datatype, int, const std::vector<double>&, const std::vector<RecordId>&);
+template void StaticIndex::writeSnapshot<StringKey>(const std::string&, Datatype, int, const std::vector<StringKey>&, const std::vector<RecordId>&);
+
+StaticIndex::StaticIndex(const std::string &snapshotName)
+{
+  int fd = open(snapshotName.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw FileNotFoundException(snapshotName);
+  }
+  struct stat st;
+  void* mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(StaticIndexHeader))
+  {
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    throw BadIndexInfoException("ERROR NOT A SNAPSHOT");
+  }
+
+  data = (const char*)mapping;
+  header = (const StaticIndexHeader*)data;
+  if (memcmp(header->magic, STATIC_MAGIC, sizeof(STATIC_MAGIC)) != 0 || header->fileSize != (uint64_t)st.st_size)
+  {
+    munmap(mapping, st.st_size);
+    throw BadIndexInfoException("ERROR NOT A SNAPSHOT");
+  }
+  pageNums = (const PageId*)(data + header->pageNumsOffset);
+  slots = (const SlotId*)(data + header->slotsOffset);
+  nextEntry = 0;
+  endEntry = 0;
+  scanExecuting = false;
+}
+
+StaticIndex::~StaticIndex()
+{
+  munmap((void*)data, header->fileSize);
+}
+
+template <class T>
+uint64_t StaticIndex::rankTyped(const void* keyParm, bool orEqual) const
+{
+  T key = readKey<T>(keyParm);
+  const T* keys = (const T*)(data + header->keysOffset);
+  const T* separators = (const T*)(data + header->separatorsOffset);
+  const uint32_t* ranks = (const uint32_t*)(data + header->ranksOffset);
+  uint64_t numSeparators = header->numSeparators;
+
+  // the descent goes left at the separators the key counts in front of, the separators four levels
+  // down sit next to each other and are fetched while the levels above are compared
+  uint64_t k = 1;
+  while (k <= numSeparators)
+  {
+    if (16 * k <= numSeparators)
+      __builtin_prefetch(separators + 16 * k - 1);
+    const T& separator = separators[k - 1];
+    k = 2 * k + (orEqual ? !(key < separator) : separator < key);
+  }
+
+  // the last separator the descent went left at is the first one the key does not pass, it starts the
+  // block after the one holding the rank
+  k >>= __builtin_ffsll(~k);
+  uint64_t block = k == 0 ? numSeparators : ranks[k - 1];
+  uint64_t begin = block * header->blockKeys;
+  int count = (int)std::min<uint64_t>(header->blockKeys, header->numEntries - begin);
+  return begin + (orEqual ? nodeUpperBound(keys + begin, count, key) : nodeLowerBound(keys + begin, count, key));
+}
+
+void StaticIndex::startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp)
+{
+  if ((lowOp != GT && lowOp != GTE) || (highOp != LT && highOp != LTE))
+  {
+    throw BadOpcodesException();
+  }
+  if (scanExecuting)
+  {
+    endScan();
+  }
+
+  switch (header->attributeType)
+  {
+  case INTEGER:
+    startScanTyped<int>(lowVal, lowOp, highVal, highOp);
+    break;
+  case DOUBLE:
+    startScanTyped<double>(lowVal, lowOp, highVal, highOp);
+    break;
+  case STRING:
+    startScanTyped<StringKey>(lowVal, lowOp, highVal, highOp);
+    break;
+  }
+  scanExecuting = true;
+}
+
+template <class T>
+void StaticIndex::startScanTyped(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp)
+{
+  if (readKey<T>(lowVal) > readKey<T>(highVal))
+  {
+    throw BadScanrangeException();
+  }
+  if (header->numEntries == 0)
+  {
+    throw NoSuchKeyFoundException();
+  }
+
+  // the range is the entries not above the high bound but not below or at the low bound
+  nextEntry = rankTyped<T>(lowVal, lowOp == GT);
+  endEntry = std::max(nextEntry, rankTyped<T>(highVal, highOp == LTE));
+}
+
+void StaticIndex::scanNext(RecordId& outRid)
+{
+  if (!scanExecuting)
+  {
+    throw ScanNotInitializedException();
+  }
+  if (nextEntry == endEntry)
+  {
+    throw IndexScanCompletedException();
+  }
+  outRid.page_number = pageNums[nextEntry];
+  outRid.slot_number = slots[nextEntry];
+  nextEntry++;
+}
+
+void StaticIndex::endScan()
+{
+  if (!scanExecuting)
+  {
+    throw ScanNotInitializedException();
+  }
+  nextEntry = 0;
+  endEntry = 0;
+  scanExecuting = false;
+}
+
+}
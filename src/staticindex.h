@@ -0,0 +1,148 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "types.h"
+#include "btree.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Size in bytes of the leaf blocks of a snapshot, the keys a scan searches after the separators.
+ */
+const int STATIC_BLOCK_BYTES = 256;
+
+/**
+ * @brief Header at the start of a snapshot file. The offsets of the sections are multiples of 64 bytes.
+ */
+struct StaticIndexHeader {
+  char magic[8];
+  int attributeType;
+  int attrByteOffset;
+  int keySize;
+  int blockKeys;              /* Keys per leaf block, every block but the last is full */
+  uint64_t numEntries;
+  uint64_t numSeparators;     /* First keys of the blocks after the first one */
+  uint64_t keysOffset;        /* numEntries keys in index order */
+  uint64_t pageNumsOffset;    /* numEntries page numbers of the record ids, the i-th one that of the i-th key */
+  uint64_t slotsOffset;       /* numEntries slot numbers of the record ids */
+  uint64_t separatorsOffset;  /* Separators in Eytzinger order, the children of the k-th one (from 1) are 2k and 2k+1 */
+  uint64_t ranksOffset;       /* Block number, minus one, of each separator in the same order */
+  uint64_t fileSize;
+};
+
+/**
+ * @brief Read-only snapshot of a BTreeIndex, written by BTreeIndex::exportSnapshot() and read here through a
+ * memory mapping of the whole file. The entries are packed without gaps: the keys in index order, cut into
+ * leaf blocks of STATIC_BLOCK_BYTES, and the page and slot numbers of the record ids in arrays of their own,
+ * so that a search reads keys only and no entry carries padding.
+ * In place of the non-leaf nodes the first key of each block is kept in an array in Eytzinger order, whose
+ * top levels share a few cache lines and whose search makes no unpredictable branch. A search goes through the
+ * separators to one block and searches it, and a scan then moves along the arrays.
+ * The snapshot takes no updates and holds no buffer pool pages. Several threads may read it at once through
+ * their own StaticIndex objects.
+ */
+class StaticIndex
+{
+ public:
+
+  /**
+   * Map the snapshot into memory.
+   * @param snapshotName	Name of the file written by BTreeIndex::exportSnapshot()
+   * @throws  FileNotFoundException If the file does not exist
+   * @throws  BadIndexInfoException If the file is not a snapshot
+   */
+  StaticIndex(const std::string &snapshotName);
+
+  ~StaticIndex();
+
+  /**
+   * The mapping belongs to one object, which unmaps it.
+   */
+  StaticIndex(const StaticIndex&) = delete;
+  StaticIndex& operator=(const StaticIndex&) = delete;
+
+  /**
+   * Write the entries, given in index order, as a snapshot.
+   */
+  template <class T>
+  static void writeSnapshot(const std::string &snapshotName, Datatype attributeType, int attrByteOffset,
+                            const std::vector<T>& keys, const std::vector<RecordId>& rids);
+
+  /**
+   * Begin a scan of the entries whose key is in the range, with the same semantics as BTreeIndex::startScan().
+   * A scan already executing is ended first.
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+   * @throws  NoSuchKeyFoundException If the snapshot is empty.
+   */
+  void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+   * Fetch the record id of the next entry of the scan, in index order.
+   * @param outRid	RecordId of the entry
+   * @throws ScanNotInitializedException If no scan has been initialized.
+   * @throws IndexScanCompletedException If no more entries are left to be scanned.
+   */
+  void scanNext(RecordId& outRid);
+
+  /**
+   * Terminate the scan.
+   * @throws ScanNotInitializedException If no scan has been initialized.
+   */
+  void endScan();
+
+  /**
+   * Number of entries of the snapshot.
+   */
+  uint64_t getNumEntries() const { return header->numEntries; }
+
+  /**
+   * Datatype of the attribute of the snapshot.
+   */
+  Datatype getAttributeType() const { return (Datatype)header->attributeType; }
+
+ private:
+
+  /**
+   * Number of entries whose key is below key, or not above it if orEqual is set.
+   */
+  template <class T>
+  uint64_t rankTyped(const void* keyParm, bool orEqual) const;
+
+  template <class T>
+  void startScanTyped(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+   * Mapping of the file, starting with its header.
+   */
+  const char*   data;
+  const StaticIndexHeader* header;
+
+  /**
+   * Page and slot numbers of the record ids of the entries.
+   */
+  const PageId* pageNums;
+  const SlotId* slots;
+
+  /**
+   * Position of the next entry of the scan, and of the first entry past its range.
+   */
+  uint64_t      nextEntry;
+  uint64_t      endEntry;
+
+  /**
+   * True if a scan has been started.
+   */
+  bool          scanExecuting;
+};
+
+}